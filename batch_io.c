@@ -0,0 +1,158 @@
+#define _GNU_SOURCE    // sendmmsg(), recvmmsg()
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "batch_io.h"
+
+
+// # The Functions #
+
+//// batchInit() - allocates a batch of 'size' packets of up to 'slot' bytes each. Returns 0 on success, -1 if we are out of memory.
+//// The packet buffers are the slabs of a pool, so each starts on its own cache line, and 'slot' is rounded up to whole lines.
+
+int batchInit(struct batch *b, int size, size_t slot)
+{
+    memset(b, 0, sizeof(*b));
+
+    b->size = size;
+    b->msgs = calloc(size, sizeof(*b->msgs));
+    b->iovs = calloc(size, sizeof(*b->iovs));
+    b->addrs = calloc(size, sizeof(*b->addrs));
+    b->control = malloc(size * BATCH_CONTROL);
+
+    if (b->msgs == NULL || b->iovs == NULL || b->addrs == NULL || b->control == NULL || poolInit(&b->pool, size, slot) == -1)
+    {
+        batchFree(b);
+        return -1;
+    }
+
+    // A batch owns every slab of its pool for good, and they lie one after the other, so the buffers are simply indexed.
+
+    b->bufs = poolSlab(&b->pool, 0);
+    b->slot = b->pool.slab;
+    slot = b->slot;
+
+    // Every message points at its own buffer and address for good, only the lengths change from call to call.
+
+    for (int i = 0; i < size; i++)
+    {
+        b->iovs[i].iov_base = b->bufs + i * slot;
+        b->iovs[i].iov_len = slot;
+        b->msgs[i].msg_hdr.msg_iov = &b->iovs[i];
+        b->msgs[i].msg_hdr.msg_iovlen = 1;
+        b->msgs[i].msg_hdr.msg_name = &b->addrs[i];
+        b->msgs[i].msg_hdr.msg_namelen = sizeof(b->addrs[i]);
+    }
+
+    return 0;
+}
+
+
+//// batchFree() - releases the memory of a batch.
+
+void batchFree(struct batch *b)
+{
+    free(b->msgs);
+    free(b->iovs);
+    free(b->addrs);
+    free(b->control);
+    poolFree(&b->pool);
+    memset(b, 0, sizeof(*b));
+}
+
+
+//// batchBuffer() - returns the buffer of the i-th packet of the batch.
+
+char *batchBuffer(struct batch *b, int i)
+{
+    return b->bufs + i * b->slot;
+}
+
+
+//// batchSetPacket() - sets the length and destination of the i-th packet, once its bytes were written to batchBuffer().
+
+void batchSetPacket(struct batch *b, int i, int len, struct in_addr to)
+{
+    memset(&b->addrs[i], 0, sizeof(b->addrs[i]));
+    b->addrs[i].sin_family = AF_INET;
+    b->addrs[i].sin_addr = to;
+
+    b->iovs[i].iov_len = len;
+    b->msgs[i].msg_hdr.msg_namelen = sizeof(b->addrs[i]);
+    b->msgs[i].msg_hdr.msg_control = NULL;
+    b->msgs[i].msg_hdr.msg_controllen = 0;
+}
+
+
+//// batchSend() - sends the first 'count' packets of the batch with a single sendmmsg() call.
+//// Returns how many packets were sent (0 if the send buffer is full), or -1 on error.
+
+int batchSend(int sock, struct batch *b, int count)
+{
+    int sent = sendmmsg(sock, b->msgs, count, 0);
+
+    if (sent == -1)
+    {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) ? 0 : -1;
+    }
+
+    return sent;
+}
+
+
+//// batchRecv() - receives up to a full batch of packets with a single recvmmsg() call, without blocking.
+//// Packet i is in batchBuffer(b, i), its length in b->msgs[i].msg_len, its source in b->addrs[i] and its arrival time in stamps[i].
+//// Returns how many packets we got (0 if there was nothing to read), or -1 on error.
+
+int batchRecv(int sock, struct batch *b, struct tstamp *stamps)
+{
+    return batchRecvRange(sock, b, 0, b->size, stamps);
+}
+
+
+//// batchRecvRange() - like batchRecv(), but fills only packets first .. first + count - 1 of the batch (their stamps go to stamps[0 .. count - 1]).
+//// If the socket reports its drops (SO_RXQ_OVFL), the latest count is kept in b->overflows.
+
+int batchRecvRange(int sock, struct batch *b, int first, int count, struct tstamp *stamps)
+{
+    for (int i = first; i < first + count; i++)
+    {
+        b->iovs[i].iov_len = b->slot;
+        b->msgs[i].msg_hdr.msg_namelen = sizeof(b->addrs[i]);
+        b->msgs[i].msg_hdr.msg_control = b->control + i * BATCH_CONTROL;
+        b->msgs[i].msg_hdr.msg_controllen = BATCH_CONTROL;
+        b->msgs[i].msg_hdr.msg_flags = 0;
+    }
+
+    int got = recvmmsg(sock, b->msgs + first, count, MSG_DONTWAIT, NULL);
+
+    if (got == -1)
+    {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+
+    // The whole burst was read at once, so it shares one userspace timestamp - the kernel's timestamps are still per packet.
+
+    uint64_t now = monotonicNs();
+
+    for (int i = 0; i < got; i++)
+    {
+        struct msghdr *msg = &b->msgs[first + i].msg_hdr;
+
+        stamps[i].mono = now;
+        readRxStamp(msg, &stamps[i]);
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+            {
+                memcpy(&b->overflows, CMSG_DATA(cmsg), sizeof(uint32_t));
+            }
+        }
+    }
+
+    return got;
+}
@@ -0,0 +1,42 @@
+#ifndef BATCH_IO_H
+#define BATCH_IO_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "buf_pool.h"
+#include "tstamp.h"
+
+// Batched I/O on the raw socket: a vector of packets is sent with a single sendmmsg() call,
+// and replies are drained with recvmmsg() in bursts, so the per-packet syscall cost is paid once per batch.
+
+#define BATCH_DEFAULT 64        // packets per batch, unless asked otherwise
+#define BATCH_MAX 1024          // the largest batch we allow
+#define BATCH_SLOT 2048         // bytes per packet buffer, enough for our echo requests and the replies to them
+#define BATCH_CONTROL 256       // bytes of control messages (timestamps) per received packet
+
+struct batch
+{
+    int size;                   // how many packets fit in the batch
+    size_t slot;                // the size of each packet buffer, whole cache lines
+    struct mmsghdr *msgs;       // one message header per packet
+    struct iovec *iovs;         // one buffer per packet
+    struct sockaddr_in *addrs;  // the destination (send) or source (receive) of each packet
+    struct buf_pool pool;       // the arena the packet buffers are carved from (see buf_pool.h)
+    char *bufs;                 // the packet buffers, one after the other
+    char *control;              // the control message buffers, one after the other
+    uint32_t overflows;         // the socket's count of packets it dropped for lack of buffer space, as of the last receive (SO_RXQ_OVFL)
+};
+
+// # Function Headers #
+
+int batchInit(struct batch *b, int size, size_t slot);
+void batchFree(struct batch *b);
+char *batchBuffer(struct batch *b, int i);
+void batchSetPacket(struct batch *b, int i, int len, struct in_addr to);
+int batchSend(int sock, struct batch *b, int count);
+int batchRecv(int sock, struct batch *b, struct tstamp *stamps);
+int batchRecvRange(int sock, struct batch *b, int first, int count, struct tstamp *stamps);
+
+#endif
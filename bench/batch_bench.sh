@@ -0,0 +1,19 @@
+#!/bin/sh
+# Compares the sweep's send rate with one packet per syscall against sendmmsg()/recvmmsg() batches.
+# Every run sweeps a loopback /16 as fast as it can (needs root for the raw socket).
+#
+# Usage: bench/batch_bench.sh [range] [batch sizes...]
+
+PING=${PING:-./parta}
+RANGE=${1:-127.0.0.0/16}
+[ $# -gt 0 ] && shift
+BATCHES=${*:-1 8 64 256}
+
+printf "%-8s %14s %14s %14s\n" batch probes/s send_calls recv_calls
+
+for b in $BATCHES; do
+    $PING -r 100000000 -W 0.2 -b "$b" "$RANGE" | awk -v b="$b" '
+        /sweep done/    { for (i = 1; i <= NF; i++) if ($i == "probes/s") pps = $(i - 1) }
+        /send syscalls/ { send = $2; recv = $5 }
+        END             { printf "%-8s %14s %14s %14s\n", b, pps, send, recv }'
+done
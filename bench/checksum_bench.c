@@ -0,0 +1,212 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "checksum.h"
+
+// Checks every checksum implementation against a plain 16-bit reference for all lengths and alignments,
+// then measures their throughput on payloads from a minimal echo request up to IP_MAXPACKET.
+//
+// Build and run: make checksum_bench && ./checksum_bench
+
+#define MAX_CHECK_LEN 2048      // every length up to this one is checked, at every alignment
+#define MAX_ALIGN 64            // buffer offsets 0..MAX_ALIGN-1 are checked
+#define BIG_LEN 65535           // IP_MAXPACKET, where the old 'int' accumulator could overflow
+
+struct impl
+{
+    const char *name;
+    unsigned short (*fn)(const void *data, int len);
+};
+
+static const struct impl impls[] =
+{
+    {"scalar", checksumScalar},
+    {"sse2", checksumSse2},
+    {"avx2", checksumAvx2},
+};
+
+#define IMPL_COUNT (int)(sizeof(impls) / sizeof(impls[0]))
+
+// # Function Headers #
+
+static unsigned short reference(const unsigned char *p, int len);
+static int checkAll(unsigned char *buf, int len, const char *what);
+static double benchOne(const struct impl *im, const unsigned char *buf, int len);
+static double nowSeconds(void);
+
+// # The Functions #
+
+int main(void)
+{
+    unsigned char *buf = malloc(BIG_LEN + MAX_ALIGN);
+
+    if (buf == NULL)
+    {
+        printf("Out of memory.\n");
+        return 1;
+    }
+
+    printf("calculate_checksum() runs the %s implementation.\n", checksumImplName());
+
+    // Random data, then all-ones data - the case with the most carries to fold.
+
+    srand(1);
+
+    for (int i = 0; i < BIG_LEN + MAX_ALIGN; i++)
+    {
+        buf[i] = rand() & 0xff;
+    }
+
+    int failures = 0;
+
+    for (int len = 0; len <= MAX_CHECK_LEN; len++)
+    {
+        failures += checkAll(buf, len, "random");
+    }
+
+    failures += checkAll(buf, BIG_LEN, "random");
+
+    memset(buf, 0xff, BIG_LEN + MAX_ALIGN);
+
+    for (int len = 0; len <= MAX_CHECK_LEN; len++)
+    {
+        failures += checkAll(buf, len, "all-ones");
+    }
+
+    failures += checkAll(buf, BIG_LEN, "all-ones");
+
+    if (failures != 0)
+    {
+        printf("%d mismatches against the reference checksum.\n", failures);
+        free(buf);
+        return 1;
+    }
+
+    printf("All implementations match the reference for lengths 0..%d and %d, at %d alignments.\n\n", MAX_CHECK_LEN, BIG_LEN, MAX_ALIGN);
+
+    // Throughput:
+
+    const int sizes[] = {14, 64, 576, 1500, 9000, BIG_LEN};
+
+    printf("%-8s", "bytes");
+
+    for (int i = 0; i < IMPL_COUNT; i++)
+    {
+        printf(" %12s", impls[i].name);
+    }
+
+    printf("   (GB/s)\n");
+
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+    {
+        printf("%-8d", sizes[s]);
+
+        for (int i = 0; i < IMPL_COUNT; i++)
+        {
+            printf(" %12.2f", benchOne(&impls[i], buf, sizes[s]));
+        }
+
+        printf("\n");
+    }
+
+    free(buf);
+
+    return 0;
+}
+
+
+//// reference() - the checksum of RFC 1071, one 16-bit word at a time, into an accumulator that can't overflow.
+
+static unsigned short reference(const unsigned char *p, int len)
+{
+    uint64_t sum = 0;
+
+    for (int i = 0; i + 1 < len; i += 2)
+    {
+        uint16_t word;
+        memcpy(&word, p + i, 2);
+        sum += word;
+    }
+
+    if (len % 2 == 1)
+    {
+        uint16_t word = 0;
+        *((unsigned char *)&word) = p[len - 1];
+        sum += word;
+    }
+
+    while (sum >> 16)
+    {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    return (unsigned short)~sum;
+}
+
+
+//// checkAll() - compares every implementation with the reference for one length, at every alignment. Returns the number of mismatches.
+
+static int checkAll(unsigned char *buf, int len, const char *what)
+{
+    int failures = 0;
+
+    for (int align = 0; align < MAX_ALIGN; align++)
+    {
+        unsigned short expected = reference(buf + align, len);
+
+        for (int i = 0; i < IMPL_COUNT; i++)
+        {
+            unsigned short got = impls[i].fn(buf + align, len);
+
+            if (got != expected)
+            {
+                printf("%s: %s data, length %d, offset %d: got 0x%04x, expected 0x%04x\n", impls[i].name, what, len, align, got, expected);
+                failures++;
+            }
+        }
+    }
+
+    return failures;
+}
+
+
+//// benchOne() - runs one implementation over the same buffer for about a fifth of a second, and returns its throughput in GB/s.
+
+static double benchOne(const struct impl *im, const unsigned char *buf, int len)
+{
+    volatile unsigned short sink = 0;
+    long rounds = 0;
+    long batch = 1 + (1 << 20) / len;
+    double start = nowSeconds();
+    double elapsed;
+
+    do
+    {
+        for (long i = 0; i < batch; i++)
+        {
+            sink ^= im->fn(buf, len);
+        }
+
+        rounds += batch;
+        elapsed = nowSeconds() - start;
+    }
+    while (elapsed < 0.2);
+
+    (void)sink;
+
+    return (double)rounds * len / elapsed / 1e9;
+}
+
+
+//// nowSeconds() - the monotonic clock, in seconds.
+
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,143 @@
+#!/bin/sh
+# Measures the sweep over a veth pair into a network namespace, with tc netem shaping the path, so every change to the pingers
+# can be judged with the same numbers on one Linux box (needs root: namespaces, netem and the raw socket).
+#
+# The peer namespace answers for a whole /12 (a local route on its loopback), reached through the veth. The replies get the netem
+# profile on their way back, on the peer's end of the veth - so the delay falls between the pinger's kernel TX stamp (taken in the driver,
+# after our own qdisc) and its RX stamp, and the RTT should be the configured delay. For every profile, the sweep runs at each rate over
+# a range sized to last about DURATION seconds, and we print:
+#
+#     pps         the probes per second the sweep achieved
+#     cpu/probe   the user + system CPU time of the pinger per probe sent, in microseconds
+#     drop%       the probes without a reply, and netem's configured loss next to it
+#     rtt_err     the average and p99 RTT, minus the configured delay, in microseconds
+#
+# Usage: bench/netem_bench.sh [rates...]
+# The environment picks the rest: PING (./parta), PROFILES (netem arguments, ';' between profiles, "none" for no shaping),
+# DURATION (seconds per run), EXTRA (more options for the pinger, e.g. "-b 64" or "-I pb0" - the host end of the veth).
+
+PING=${PING:-./parta}
+RATES=${*:-1000 10000 100000 1000000}
+PROFILES=${PROFILES:-none;delay 1ms;delay 10ms 2ms;delay 5ms loss 1%}
+DURATION=${DURATION:-1}
+EXTRA=${EXTRA:-}
+NETEM_LIMIT=${NETEM_LIMIT:-1000000}    # netem queues 1000 packets by default - too few for the delay times a high rate
+
+NS=pingbench$$
+HOST_IF=pb0
+PEER_IF=pb1
+HOST_ADDR=10.200.0.1
+PEER_ADDR=10.200.0.2
+TARGETS=10.64.0.0                      # the peer answers for TARGETS/12
+
+if [ "$(id -u)" != 0 ]; then
+    echo "The benchmark needs root, for the namespace, netem and the raw socket."
+    exit 1
+fi
+
+if [ ! -x "$PING" ]; then
+    echo "$PING not found - run make first."
+    exit 1
+fi
+
+TMP=$(mktemp -d) || exit 1
+
+cleanup() {
+    ip link del "$HOST_IF" 2>/dev/null
+    ip netns del "$NS" 2>/dev/null
+    rm -rf "$TMP"
+}
+
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+# We now build the path: a veth pair with one end in the peer namespace, and a route to the targets through it.
+# The peer's kernel answers the echo requests - without rate limits, which only apply to a few ICMP types anyway.
+
+ip netns add "$NS" || exit 1
+ip link add "$HOST_IF" type veth peer name "$PEER_IF" netns "$NS" || exit 1
+ip addr add "$HOST_ADDR/24" dev "$HOST_IF"
+ip link set "$HOST_IF" up
+ip netns exec "$NS" ip addr add "$PEER_ADDR/24" dev "$PEER_IF"
+ip netns exec "$NS" ip link set "$PEER_IF" up
+ip netns exec "$NS" ip link set lo up
+ip netns exec "$NS" ip route add local "$TARGETS/12" dev lo
+ip netns exec "$NS" sysctl -qw net.ipv4.icmp_ratelimit=0 net.ipv4.icmp_echo_ignore_broadcasts=0
+ip route add "$TARGETS/12" via "$PEER_ADDR" dev "$HOST_IF"
+
+# cpu_used() - prints the user + system CPU time of our finished children so far, in microseconds, from the output of 'times'
+# ("0m0.123s 0m0.045s" on its second line). 'times' itself must run in this shell - a subshell has no children of its own.
+
+cpu_used() {
+    awk 'NR == 2 {
+        total = 0
+        for (i = 1; i <= 2; i++) { split($i, t, "m"); sub("s", "", t[2]); total += t[1] * 60 + t[2] }
+        printf "%.0f\n", total * 1e6
+    }' "$1"
+}
+
+# prefix_for() - prints the prefix length of a range with at least rate * DURATION targets (between a /24 and a /12).
+
+prefix_for() {
+    awk -v rate="$1" -v d="$DURATION" 'BEGIN {
+        want = rate * d; p = 24
+        while (p > 12 && 2 ^ (32 - p) - 2 < want) p--
+        print p
+    }'
+}
+
+# netem_arg() - prints a netem parameter of the profile ("delay" or "loss"), in microseconds or percent, or 0 if it has none.
+
+netem_arg() {
+    echo "$1" | awk -v key="$2" '{
+        for (i = 1; i < NF; i++) if ($i == key) {
+            v = $(i + 1)
+            if (key == "loss") { sub("%", "", v); print v + 0; exit }
+            if (v ~ /us$/) m = 1; else if (v ~ /ms$/) m = 1000; else if (v ~ /s$/) m = 1e6; else m = 1
+            sub(/[a-z]+$/, "", v); print v * m; exit
+        }
+        print 0
+    }'
+}
+
+printf "%-24s %9s %9s %12s %11s %15s %12s %12s\n" profile rate targets pps cpu/probe "drop% (netem)" rtt_err_avg rtt_err_p99
+
+IFS_SAVED=$IFS
+IFS=';'
+set -f
+
+for profile in $PROFILES; do
+    IFS=$IFS_SAVED
+
+    ip netns exec "$NS" tc qdisc del dev "$PEER_IF" root 2>/dev/null
+
+    if [ "$profile" != none ] && ! ip netns exec "$NS" tc qdisc add dev "$PEER_IF" root netem $profile limit "$NETEM_LIMIT" 2>/dev/null; then
+        printf "%-24s netem is not available on this kernel (sch_netem) - skipped\n" "$profile"
+        IFS=';'
+        continue
+    fi
+
+    delay=$(netem_arg "$profile" delay)
+    loss=$(netem_arg "$profile" loss)
+
+    for rate in $RATES; do
+        range="$TARGETS/$(prefix_for "$rate")"
+        times > "$TMP/before"
+        $PING -r "$rate" -W 1 $EXTRA "$range" > "$TMP/out"
+        times > "$TMP/after"
+        cpu=$(($(cpu_used "$TMP/after") - $(cpu_used "$TMP/before")))
+
+        awk -v profile="$profile" -v rate="$rate" -v cpu="$cpu" -v delay="$delay" -v loss="$loss" '
+            / packets transmitted, /   { sent = $1; got = $4 }
+            /^rtt min\/avg/             { split($4, r, "/"); avg = r[2] }
+            /^rtt p50/                  { split($4, p, "/"); p99 = p[3] }
+            /sweep done/                { targets = $4; for (i = 1; i <= NF; i++) if ($i == "probes/s") pps = $(i - 1) }
+            END {
+                if (sent == 0) { printf "%-24s %9s the sweep failed\n", profile, rate; exit }
+                printf "%-24s %9s %9s %12s %11.2f %7.2f (%4.1f) %12.1f %12.1f\n", profile, rate, targets, pps, cpu / sent,
+                       100 * (sent - got) / sent, loss, avg * 1000 - delay, p99 * 1000 - delay
+            }' "$TMP/out"
+    done
+
+    IFS=';'
+done
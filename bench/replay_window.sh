@@ -0,0 +1,83 @@
+#!/bin/sh
+# Checks that replay keeps an unanswered request waiting for its whole timeout while many answered ones pass it by:
+# they leave the in-flight FIFO behind it, and must not push it out of the window as if it were full.
+#
+# The capture (raw IPv4, written here) holds one echo request that is never answered, then ANSWERED requests, each with its reply
+# 100 microseconds later - many more than the FIFO of a WINDOW-request table holds. Replay must count the first request as lost by its
+# timeout, and drop none from a full window.
+#
+# Usage: bench/replay_window.sh
+# The environment picks REPLAY (./replay), WINDOW (4 - at least 2, so the answered requests fit next to the waiting one) and ANSWERED (200).
+
+REPLAY=${REPLAY:-./replay}
+WINDOW=${WINDOW:-4}
+ANSWERED=${ANSWERED:-200}
+
+if [ ! -x "$REPLAY" ]; then
+    echo "$REPLAY not found - run make first."
+    exit 1
+fi
+
+CAPTURE=$(mktemp) || exit 1
+trap 'rm -f "$CAPTURE"' EXIT
+
+# bytes() - writes its arguments (numbers from 0 to 255) as bytes.
+
+bytes() {
+    for b in "$@"; do
+        printf "\\$(printf %o "$b")"
+    done
+}
+
+# le32() - writes a number as 4 bytes, little-endian (the byte order of the pcap headers below).
+
+le32() {
+    bytes $(($1 & 255)) $(($1 >> 8 & 255)) $(($1 >> 16 & 255)) $(($1 >> 24 & 255))
+}
+
+# echo_packet() - writes a record with an echo request (type 8) or reply (type 0) between 10.0.0.1 and 10.0.0.2, id 1, sequence 'seq',
+# captured at 'usec' microseconds: the record header, the IPv4 header and the ICMP header, with no payload.
+
+echo_packet() {
+    type=$1 seq=$2 usec=$3
+
+    if [ "$type" = 8 ]; then src=1 dst=2; else src=2 dst=1; fi
+
+    sum=$((type * 256 + 1 + seq))
+    sum=$(((sum & 65535) + (sum >> 16)))
+    sum=$((~sum & 65535))
+
+    le32 $((usec / 1000000)); le32 $((usec % 1000000)); le32 28; le32 28
+    bytes 69 0 0 28 0 0 0 0 64 1 0 0 10 0 0 $src 10 0 0 $dst
+    bytes "$type" 0 $((sum >> 8)) $((sum & 255)) 0 1 $((seq >> 8)) $((seq & 255))
+}
+
+# We now write the capture: a pcap header (microsecond stamps, raw IPv4), the request that stays unanswered, then the answered ones -
+# a millisecond apart, so the capture lasts past the timeout of the first.
+
+{
+    le32 2712847316; bytes 2 0 4 0; le32 0; le32 0; le32 65535; le32 228
+
+    echo_packet 8 0 0
+
+    seq=1
+
+    while [ $seq -le "$ANSWERED" ]; do
+        echo_packet 8 $seq $((seq * 1000))
+        echo_packet 0 $seq $((seq * 1000 + 100))
+        seq=$((seq + 1))
+    done
+} > "$CAPTURE"
+
+timeout_s=$(awk -v n="$ANSWERED" 'BEGIN { printf "%.3f", n / 2000 }')
+out=$($REPLAY -w "$WINDOW" -W "$timeout_s" "$CAPTURE")
+echo "$out"
+
+echo "$out" | awk -v n="$ANSWERED" '
+    / packets transmitted, / { sent = $1; got = $4 }
+    /requests dropped from a full window/ { for (i = 1; i <= NF; i++) if ($i == "requests" && $(i + 1) == "dropped") evicted = $(i - 1) }
+    END {
+        if (sent == n + 1 && got == n && evicted == 0) { print "ok"; exit 0 }
+        printf "FAILED: expected %d sent, %d received and none dropped from the window\n", n + 1, n
+        exit 1
+    }'
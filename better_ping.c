@@ -7,39 +7,95 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
-#include <sys/time.h>    // gettimeofday()
 #include <sys/types.h>
 #include <unistd.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/un.h>
+
+#include "buf_pool.h"
+#include "filter.h"
+#include "icmp_util.h"
+#include "stats.h"
+#include "tstamp.h"
+#include "wdproto.h"
+
+#define default_timeout_seconds 10    // how long the watchdog waits for a reply before it times us out, unless -t says otherwise
+
+// To execute the program, run it from the command line with the following syntax:
+// ./ping [-S summary_seconds] [-s size] [-p pattern] [-m auto|raw|dgram] [-t timeout_seconds] [-w watchdog_socket] <destination_ip>
+// -S prints the statistics every that many seconds. Ctrl+C prints them and exits.
+// -s sets the payload size in bytes (at least 12, for the send time and sequence number every probe carries),
+// and -p fills the rest of the payload with a pattern given in hex, e.g. -p ff00.
+// -m picks the socket: an unprivileged Linux ping socket ("dgram"), a raw socket ("raw"), or the first of them we are allowed ("auto", the default).
+// -t sets how long we may go without a reply before the watchdog times us out (10 seconds by default).
+// -w reports to a watchdog server already running on the host (./watchdog -l <socket_path>), instead of starting a watchdog of our own.
 
-#define IP4_HDRLEN 20    // IPv4 header len without options
-#define ICMP_HDRLEN 8    // ICMP header len for echo messages
-#define server_port 3000
-#define server_ip "127.0.0.1"
-#define buffer_size 128
+int main(int argnum, char *argt[])
+{
+    // First, we check for errors regarding the execution of the program:
 
-// # Function Headers #
+    double period = 0;             // seconds between two statistics summaries (0 - only at the end)
+    int size = PAYLOAD_DEFAULT;    // the payload size of every probe
+    unsigned char pattern[PATTERN_MAX];
+    int patternLen = 0;            // the length of the fill pattern (0 - the default one)
+    int kind = ICMP_SOCK_AUTO;     // the kind of socket to send on
+    double timeout = default_timeout_seconds;
+    const char *wdPath = NULL;     // the socket of a watchdog server (NULL - we start our own watchdog)
+    int opt;
 
-unsigned short calculate_checksum(unsigned short *paddress, int len);
-int makePacket(char *pac);
+    while ((opt = getopt(argnum, argt, "S:s:p:m:t:w:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'S': period = atof(optarg); break;
+            case 's': size = atoi(optarg);   break;
+            case 'p':
+                patternLen = parsePattern(optarg, pattern);
 
-// To execute the program, run it from the command line with the following syntax: ./ping <destination_ip>
+                if (patternLen == -1)
+                {
+                    printf("The pattern must be up to %d bytes in hex, e.g. -p ff00.\n", PATTERN_MAX);
+                    return 0;
+                }
 
-int main(int argnum, char *argt[])
-{
-    // First, we check for errors regarding the execution of the program:
+                break;
+            case 'm':
+                kind = parseSocketKind(optarg);
+
+                if (kind == -1)
+                {
+                    printf("The socket kind must be auto, raw or dgram.\n");
+                    return 0;
+                }
+
+                break;
+            case 't': timeout = atof(optarg); break;
+            case 'w': wdPath = optarg;        break;
+            default:
+                printf("Correct usage: ./ping [-S summary_seconds] [-s size] [-p pattern] [-m auto|raw|dgram] [-t timeout_seconds] [-w watchdog_socket] <destination_ip>\n");
+                return 0;
+        }
+    }
     
     // If we have an incorrect number of arguments, we print an error message and exit the program.
 
-    if (argnum != 2)
+    if (argnum - optind != 1 || period < 0 || timeout < 0.001)
+    {
+        printf("Invalid number of arguments when executing. Correct usage: ./ping [-S summary_seconds] [-s size] [-p pattern] [-m auto|raw|dgram] [-t timeout_seconds] [-w watchdog_socket] <destination_ip>\n");
+        return 0;
+    }
+
+    if (size < PAYLOAD_HDRLEN || size > PAYLOAD_MAX)
     {
-        printf("Invalid number of arguments when executing. Correct usage: ./ping <destination_ip>\n");
+        printf("The payload size must be between %d and %d bytes.\n", PAYLOAD_HDRLEN, PAYLOAD_MAX);
         return 0;
     }
 
     char ip[INET_ADDRSTRLEN];
-    strcpy(ip, argt[1]);
+    strcpy(ip, argt[optind]);
     
     struct in_addr pingaddr;
 
@@ -61,16 +117,31 @@ int main(int argnum, char *argt[])
     address.sin_addr.s_addr = inet_addr(ip);
 
 
-    // Next, we create a raw socket which will be used to transfer the ping in ICMP Protocol to the given ip.
+    // Next, we create the socket which will be used to transfer the ping in ICMP Protocol to the given ip:
+    // a ping socket if we are allowed one, or a raw socket. A ping socket gets its ICMP id from the kernel,
+    // and only the replies carrying that id are delivered to it.
+
+    int ident = processIdent();    // The ICMP id of this process, so our replies can be told apart from other pingers' replies.
 
     int rawsock = -1;
-    if ((rawsock = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP)) == -1)
+    if ((rawsock = openIcmpSocket(&kind, &ident)) == -1)
     {
         fprintf(stderr, "socket() failed with error: %d\n", errno);
         fprintf(stderr, "To create a raw socket, the process needs to be run by Admin/root user.\n");
+        fprintf(stderr, "To create a ping socket, the process' group must be in net.ipv4.ping_group_range.\n");
         return -1;
     }
 
+    int ipHeader = kind == ICMP_SOCK_RAW;    // Only a raw socket hands us the IP header of the replies.
+
+    // A raw socket would wake us up for every ICMP packet on the host, so we ask the kernel to drop everything but the replies from our destination.
+    // Without the filter we still work, just with more wakeups.
+
+    if (ipHeader && attachReplyFilter(rawsock, ident, &address.sin_addr, 1) == -1)
+    {
+        printf("Attaching the socket filter failed with error: %d, filtering in userspace only.\n", errno);
+    }
+
 
     // We now want to set the raw socket to be non-blocking.
 
@@ -81,32 +152,125 @@ int main(int argnum, char *argt[])
         return -1;
     }
 
+    // We ask the kernel to timestamp our packets when they leave and arrive, so the RTT reflects the wire and not our scheduling.
+
+    int stamping = enableTimestamps(rawsock);
+
     // We now intialize the variables below:
 
     int seq = 0;                   // We set a sequence counter to 0, which will be used to identify the ICMP packets sent by this program.
-    char pac[IP_MAXPACKET];        // We also create a buffer which will contain the ICMP packet.
-    float time = 0;                // Lastly, we create a variable which will contain the time it took to get a reply from the destination.
+    int64_t rtt = 0;               // We create a variable which will contain the time (in nanoseconds) it took to get a reply from the destination.
+    struct stats st;               // Lastly, the statistics of all the replies so far.
 
-    // We now create variables for a child process which will be used to execute the watchdog program.
+    statsInit(&st);
+
+    // The echo request is built once. Each probe only patches its sequence number and send time (and the checksum) into it.
+
+    struct packet_template tmpl;
+    if (makeTemplate(&tmpl, ident, size, pattern, patternLen) == -1)
+    {
+        printf("Out of memory.\n");
+        close(rawsock);
+        return -1;
+    }
+
+    // We also take a buffer for the replies from a pool (see buf_pool.h). It only has to fit our own reply and the longest IP header,
+    // since anything longer is not a reply of ours. It is never cleared between probes: a reply is only read up to the length we received.
+
+    struct buf_pool replies;
+    if (poolInit(&replies, 1, tmpl.len + IP4_MAXHDRLEN) == -1)
+    {
+        printf("Out of memory.\n");
+        freeTemplate(&tmpl);
+        close(rawsock);
+        return -1;
+    }
+
+    char *pac = poolGet(&replies);
+
+    // We now set up what the watchdog needs, before it is started - so there is nothing to wait for once it is:
+    // a connection for the few messages we exchange (HELLO, BYE and TIMEOUT), and a shared memory region for the heartbeat.
+    // The connection is a socketpair to a watchdog of our own, or a unix socket to the watchdog server of the host (-w).
     // More on the watchdog program is written in the watchdog.c file.
 
-    char *wdarg[2];                // This array will contain the arguments for the watchdog program.
+    int pair[2] = { -1, -1 };      // pair[0] is our end of the channel, pair[1] the watchdog's.
+    struct wd_shared *shared = NULL;
+
+    if (wdPath != NULL)
+    {
+        struct sockaddr_un wdAddr;
+        memset(&wdAddr, 0, sizeof(wdAddr));
+        wdAddr.sun_family = AF_UNIX;
+        strncpy(wdAddr.sun_path, wdPath, sizeof(wdAddr.sun_path) - 1);
+
+        pair[0] = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+        if (pair[0] == -1 || connect(pair[0], (struct sockaddr *)&wdAddr, sizeof(wdAddr)) == -1)
+        {
+            printf("Error : Connecting to the watchdog at %s failed with error: %d\n", wdPath, errno);
+            freeTemplate(&tmpl);
+            poolFree(&replies);
+            if (pair[0] != -1)
+            {
+                close(pair[0]);
+            }
+            close(rawsock);
+            return -1;
+        }
+    }
+    else if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == -1)
+    {
+        printf("Error : socketpair() failed with error: %d\n", errno);
+        freeTemplate(&tmpl);
+        poolFree(&replies);
+        close(rawsock);
+        return -1;
+    }
+
+    int sharedFd = wdSharedCreate(&shared);
+    if (sharedFd == -1)
+    {
+        printf("Error : Creating the heartbeat region failed with error: %d\n", errno);
+        freeTemplate(&tmpl);
+        poolFree(&replies);
+        close(pair[0]);
+        if (pair[1] != -1)
+        {
+            close(pair[1]);
+        }
+        close(rawsock);
+        return -1;
+    }
+
+    wdHeartbeat(shared, 0, monotonicNs());    // The timeout clock starts now.
+
+    // We now create variables for a child process which will be used to execute the watchdog program.
+    // It only gets the watchdog's end of the channel as an argument - the heartbeat region comes along with our HELLO.
+
+    char fdArg[16];
+    snprintf(fdArg, sizeof(fdArg), "%d", pair[1]);
+
+    char *wdarg[3];                // This array will contain the arguments for the watchdog program.
     wdarg[0] = "./watchdog";       // The watchdog program is called watchdog.
-    wdarg[1] = NULL;               // The watchdog program takes no arguments besides its name.
+    wdarg[1] = fdArg;
+    wdarg[2] = NULL;
     int exec = 0;                  // This variable will be used to check if the watchdog program was executed successfully.
 
-    // We now create a fork process which will execute the watchdog program:
+    // We now create a fork process which will execute the watchdog program (unless we report to a watchdog server):
     // If there is an error creating the child process or executing the watchdog program, we print an error message and exit the program.
 
-    int child = fork();                 // create the child process 
+    int child = wdPath != NULL ? 1 : fork();      // create the child process
     if (child == 0)     // child process will  execute the watchdog 
     {
+        close(pair[0]);
+        close(rawsock);
+
         exec = execv(wdarg[0], wdarg);
             
         if (exec == -1)
         {
             printf("Error executing Watchdog program.\n");
-            return -1;
+            _exit(-1);
         }   
     }
 
@@ -114,92 +278,78 @@ int main(int argnum, char *argt[])
 
     else            //  continue from here with the parent process 
     {
-        sleep(1);                                               // We use a sleep() method to let Watchdog get to the neccessary stage in order to proceed.
-
         int temp = 0;                                           // Setting a temporary variable to help check for errors throughout the program.
 
-        int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);   // Creating a socket using the IPv4 module.
+        int sock = pair[0];                                     // Our end of the channel to the watchdog.
 
-        if (sock == -1) {
-            printf("Error : Listen socket creation failed.\n"); // If the socket creation failed, print the error and exit main.   
-            return -1;
+        if (pair[1] != -1)
+        {
+            close(pair[1]);
         }
 
-        struct sockaddr_in serverAddress;                       // Using the imported struct of a socket address using the IPv4 module.
-        memset(&serverAddress, 0, sizeof(serverAddress));       // Resetting it to default values.
-
-        serverAddress.sin_family = AF_INET;
-        serverAddress.sin_port = htons(server_port);                                          // Changing little endian to big endian.
-        temp = inet_pton(AF_INET, (const char *)server_ip, &serverAddress.sin_addr);          // Converting the IP address from string to binary.
-
-        if (temp <= 0) {
-            printf("Error: inet_pton() failed.\n");                                           // If the conversion failed, print the error and exit main.
+        if (child == -1)
+        {
+            printf("Error : fork() failed with error: %d\n", errno);
+            wdSharedUnmap(shared);
+            freeTemplate(&tmpl);
+            poolFree(&replies);
+            close(sharedFd);
+            close(sock);
+            close(rawsock);
             return -1;
         }
 
-        // Make a connection to the server with socket SendingSocket.
+        // We introduce ourselves, tell the watchdog how long it should wait for a reply before it times us out, and hand it the heartbeat region.
+        // If the watchdog failed to start, its end of the channel is already closed and this fails.
+
+        temp = wdSendFd(sock, WD_HELLO, 0, (uint64_t)(timeout * 1000), sharedFd);
+        close(sharedFd);                                        // The mapping stays valid without the descriptor.
 
-        int connectResult = connect(sock, (struct sockaddr *)&serverAddress, sizeof(serverAddress)); 
-        if (connectResult == -1) 
+        if (temp == -1)
         {
-            printf("Error: Connecting to Watchdog failed.\n");   
+            printf("Error : Sending to Watchdog failed.\n");
+            wdSharedUnmap(shared);
+            freeTemplate(&tmpl);
+            poolFree(&replies);
             close(sock);
             close(rawsock);
             return -1;
         }
 
-        // if we passed until here it means that we succussfully connected to watchdog
+        // Ctrl+C now stops the loop gracefully, so the statistics can still be printed.
 
-        printf("Pinging the address: %s\n", ip);
+        statsCatchSigint();
 
-        char buffer[buffer_size] = {0};             // initialize a buffer for holding messages to watchdog 
+        uint64_t period_ns = (uint64_t)(period * 1e9);
+        uint64_t nextSummary = monotonicNs() + period_ns;
+
+        printf("Pinging the address: %s (%s socket)\n", ip, ipHeader ? "raw" : "ping");
+
+        struct wd_reader reader;                    // the bytes we got from the watchdog, until they form whole messages
+        struct wd_msg msg;
+        wdReaderInit(&reader);
         
         // For each packet sent, we track the time of sending it and getting a reply from the destination.
-        // We use the gettimeofday() function to get the time in seconds and microseconds.
+        // The kernel's timestamps are used when we have them, and the monotonic clock otherwise (see tstamp.c).
 
-        struct timeval start, end;
+        struct tstamp start, end;
 
-        while(1)
+        while (!statsStopRequested())
         {
             sleep(1);                                                       // sleep in order to enable more convenient printing
-            
-            strcpy(buffer,"start");                                 // message for watchdog
-            
-           //  send Watchdog to start mesuring the timeout clock
-            temp = send(sock, buffer, strlen(buffer) + 1, 0);
-           
-            // checking possible errors of send()
-            if (temp < 0) 
-            {
-                printf("Error : Sending failed.\n");    // If receiving failed, print an error and exit main.
-                close(sock);
-                close(rawsock);
-                return -1;
-            } 
-            else if (temp == 0) 
+
+            if (statsStopRequested())
             {
-                printf("Error : Client's socket is closed, nowhere to send to.\n");   // If receiving failed, print an error and exit main.
-                close(sock);
-                close(rawsock);
-                return -1;
+                break;                                                      // Ctrl+C interrupted the sleep
             }
-            else if (temp != strlen(buffer) + 1)
-            {
-                printf("Error: client received a corrupted buffer.\n");
-                close(sock);
-                close(rawsock);
-                return -1;
-            }
-            
-            memset(buffer, 0, strlen(buffer) + 1);                      // reset the buffer. 
-
-            gettimeofday(&start, 0);                                    // start mesuring the times it takes to send a ping and receive the 'pong' message
 
             // We use the sendto() function to send the packet to the destination.
             
-            int len = makePacket(pac);                                  // make the packet header. len indicates on the length of the header
+            stampNow(&start);                                           // start mesuring the times it takes to send a ping and receive the 'pong' message
+
+            patchPacket(&tmpl, tmpl.data, ident, seq, start.mono);     // patch our sequence number and the send time into the prebuilt packet
 
-            int temp = sendto(rawsock, pac, len, 0, (struct sockaddr *)&address, sizeof(address));              // send the 'ping' message to distination 
+            int temp = sendto(rawsock, tmpl.data, tmpl.len, 0, (struct sockaddr *)&address, sizeof(address));  // send the 'ping' message to distination 
             
             if (temp == -1) // check error on send()
             {
@@ -209,238 +359,188 @@ int main(int argnum, char *argt[])
                 return -1;
             }
 
-            // We now clear the packet buffer receiving a reply from the destination.
-
-            bzero(pac, IP_MAXPACKET);
+            statsSent(&st);
 
-            socklen_t addlen = sizeof(address);    
+            struct sockaddr_in from;
 
             // We now begin a receiving loop, for getting the reply message for our 'ping'.
-            // we are recv with a non-blocking socket, for enabling the communication with the watchdog
-            // so the watch dog will be able to notify us if the timeout clock ran out.(10 seconds)
+            // We sleep in poll() on two descriptors at once: the raw socket (a reply arrived) and the watchdog socket.
+            // The watchdog keeps the timeout clock on its own, and only speaks up when it runs out - so waiting costs no CPU and no traffic.
+
+            struct pollfd fds[2];
+            fds[0].fd = rawsock;    fds[0].events = POLLIN;             // the 'pong' message
+            fds[1].fd = sock;       fds[1].events = POLLIN;             // the watchdog connection
 
             ssize_t rec = -1; 
+            int gotReply = 0;
 
-            while (1)  
+            while (!gotReply)  
             {
-              
-                rec = recvfrom(rawsock, pac, sizeof(pac), 0, (struct sockaddr *)&address, &addlen);   // receive 'pong' on non-blocking socket    
-                
-                // in case we got the message 
-                if (rec > 0)                           
-                {   
-                    // We now get the end time of receiving the reply from the destination, and calculate the time it took to get the reply.
-
-                    gettimeofday(&end, 0);
-                    
-                    strcpy(buffer, "got reply");
-
-                    temp = send(sock, buffer, strlen(buffer) + 1, 0); // notify the watchdog that we got the message, so he can reset the timeout clock
-                    
-                    //  checking errors of send() 
-                    if (temp < 0) 
-                    {
-                        printf("Error : Sending failed.\n");    // If receiving failed, print an error and exit main.
-                        close(sock);
-                        close(rawsock);
-                        return -1;
-                    } 
-                    else if (temp == 0) 
+                if (poll(fds, 2, -1) == -1)
+                {
+                    if (errno == EINTR)
                     {
-                        printf("Error : Watchdog's socket is closed, nowhere to send to.\n");   // If receiving failed, print an error and exit main.
-                        close(sock);
-                        close(rawsock);
-                        return -1;
+                        if (statsStopRequested())
+                        {
+                            break;                      // Ctrl+C - stop waiting, the statistics are printed below
+                        }
+
+                        continue;
                     }
-                    else if (temp != strlen(buffer) + 1)
+
+                    printf("Error : poll() failed with error: %d\n", errno);
+                    close(sock);
+                    close(rawsock);
+                    return -1;
+                }
+
+                // The kernel's TX timestamp for our 'ping' is waiting on the error queue.
+                // The timestamps are keyed by the order the packets were sent in, which is our sequence number.
+
+                if (stamping == TSTAMP_RXTX && (fds[0].revents & POLLERR))
+                {
+                    uint32_t key = 0;
+                    uint64_t txStamp = 0;
+
+                    while (recvTxStamp(rawsock, &key, &txStamp) == 1)
                     {
-                        printf("Error: Watchdog received a corrupted buffer.\n");
-                        close(sock);
-                        close(rawsock);
-                        return -1;
+                        if (key == (uint32_t)seq)
+                        {
+                            start.kernel = txStamp;
+                        }
                     }
-                    
-                    // no errors on sending - break and send another ping message
-                    
-                    break;     // If we got a reply, we break the loop.
                 }
-                // we didn't got the message yet. check with watch if time ran out
-                else
+
+                // The raw socket is readable - receive the 'pong' message.
+
+                if (fds[0].revents & POLLIN)
                 {
-                    strcpy(buffer, "continue?");            // send watch dog a message asking if to continue receiving? 
-                    
-                    temp = send(sock, buffer, strlen(buffer) + 1, 0);
-                    
-                    //  check errors of send()
-                    if (temp < 0) 
-                    {
-                        printf("Error : Sending failed.\n");    // If receiving failed, print an error and exit main.
-                        close(sock);
-                        close(rawsock);
-                        return -1;
-                    } 
-                    else if (temp == 0) 
+                    rec = recvStamped(rawsock, pac, replies.slab, &from, &end);   // receive 'pong' on non-blocking socket, along with its arrival time
+
+                    struct icmp *reply = NULL;
+                    int icmplen = -1;
+                    uint32_t replySeq = 0;
+                    uint64_t sentNs = 0;
+
+                    // The raw socket sees every ICMP packet on the host - only the reply to the request we just sent stops the clock.
+                    // The reply must also echo our payload back intact, otherwise it is counted as corrupted and we keep waiting.
+
+                    if (rec > 0 && from.sin_addr.s_addr == address.sin_addr.s_addr
+                        && (icmplen = parseReply(pac, rec, ipHeader, ident, NULL, &reply)) > 0
+                        && ntohs(reply->icmp_seq) == (seq & 0xffff))
                     {
-                        printf("Error : Watchdog's socket is closed, nowhere to send to.\n");   // If receiving failed, print an error and exit main.
-                        close(sock);
-                        close(rawsock);
-                        return -1;
+                        if (parsePayload(&tmpl, reply, icmplen, &replySeq, &sentNs) == -1 || replySeq != (uint32_t)seq)
+                        {
+                            printf("-- Corrupted reply from %s : seq = %d, bytes = %ld.\n", ip, seq, rec);
+                            statsCorrupted(&st);
+                            continue;
+                        }
+
+                        // recvStamped() already got us the end time of receiving the reply from the destination,
+                        // and the reply itself tells us when it was sent (unless the kernel's TX timestamp is more precise).
+
+                        start.mono = sentNs;
+                        gotReply = 1;
+                        break;
                     }
-                    else if (temp != strlen(buffer) + 1)
+                    else if (rec == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
                     {
-                        printf("Error: Watchdog received a corrupted buffer.\n");
+                        printf("Receiving packet failed with error: %d\n", errno);
                         close(sock);
                         close(rawsock);
                         return -1;
                     }
+                }
 
-                    memset(buffer,0,10); // reset the buffer 
+                // The watchdog speaks only when the timeout ran out. It may also have closed the connection, or sent something we don't understand.
 
-                    temp = recv(sock, buffer, 4, 0); // recv answer from watchdog whether to continue
-                   
-                    // check errors on recv() 
-                    if (temp < 0) 
-                    {
-                        printf("Error : Sending failed.\n");    // If receiving failed, print an error and exit main.
-                        close(sock);
-                        close(rawsock);
-                        return -1;
-                    } 
-                    else if (temp == 0) 
+                if (fds[1].revents & (POLLIN | POLLHUP | POLLERR))
+                {
+                    temp = wdRead(sock, &reader);
+
+                    if (temp == 0 || (temp == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
                     {
-                        printf("Error : Watchdog's socket is closed, nowhere to receive from.\n");   // If receiving failed, print an error and exit main.
+                        printf("Error : Watchdog's socket is closed, nowhere to receive from.\n");
                         close(sock);
                         close(rawsock);
                         return -1;
                     }
-                    else if (temp != 4)
+
+                    while ((temp = wdNext(&reader, &msg)) == 1)
                     {
-                        printf("Error: Received a corrupted buffer.\n");
+                        if (msg.type == WD_TIMEOUT)
+                        {
+                            printf("Time out! Closing socket.\n");
+                            statsLost(&st);
+                            statsPrint(&st, ip);
+                            freeTemplate(&tmpl);
+                            poolFree(&replies);
+                            close(sock);
+                            close(rawsock);
+                            return -1;
+                        }
+
+                        printf("Invalid response from Watchdog, closing socket.\n");
                         close(sock);
                         close(rawsock);
                         return -1;
                     }
 
-                     
-                    // if the answer is no - close socket and quit program 
-                    else if ( strcmp (buffer, "no!") == 0 ) 
+                    if (temp == -1)
                     {
-                        printf("Time out! Closing socket.\n");
-                        close(sock);
-                        close(rawsock);
-                        return -1;                        
-                    }
-                    
-                    
-                    // if answer is yes - continue 
-                    else if ( strcmp (buffer, "yes") == 0 ) 
-                    {
-                        continue;
-                    }
-                    
-                    // there is an invalid response - quit 
-                    else 
-                    {
-                        printf("Invalid response from Watchdog, closing socket.\n");
+                        printf("Error: Received a corrupted message from Watchdog.\n");
                         close(sock);
                         close(rawsock);
                         return -1;
                     }
-
-                    memset(buffer,0,4);
                 }
             }
+
+            if (!gotReply)
+            {
+                break;                                                      // we were asked to stop while waiting
+            }
+
+            // We got the reply - store its time in the shared region, which resets the watchdog's timeout clock. No message is sent.
+
+            wdHeartbeat(shared, seq, monotonicNs());
             
             // calculate the time of sending and receiving the ping message 
             
-            float milliseconds = (end.tv_sec - start.tv_sec) * 1000.0f + (end.tv_usec - start.tv_usec) / 1000.0f;
-            unsigned long microseconds = (end.tv_sec - start.tv_sec) * 1000.0f + (end.tv_usec - start.tv_usec);
-            time = (end.tv_sec - start.tv_sec) * 1000.0f + (end.tv_usec - start.tv_usec) / 1000.0f;
+            rtt = stampDiff(&start, &end);
+            statsReply(&st, rtt);
 
             // We will now print data about the reply we got from the destination.
 
-            printf("-- Reply from %s : seq = %d, bytes = %ld, time = %.3f ms.\n", ip, seq, rec, time);
+            printf("-- Reply from %s : seq = %d, bytes = %ld, time = %.3f ms.\n", ip, seq, rec, rtt / 1e6);
 
-            // We now increment the sequence counter, and clear the packet buffer for the next iteration of the loop, if any occur.
+            // We now increment the sequence counter for the next iteration of the loop, if any occur.
 
-            bzero(pac, IP_MAXPACKET);
             seq++;
+
+            // Print the statistics so far, if it is time to.
+
+            if (period_ns > 0 && monotonicNs() >= nextSummary)
+            {
+                statsPrint(&st, ip);
+                nextSummary += period_ns;
+            }
         }
     
-        // If we broke the loop, it means we didn't receive a reply propperly.
-        // Therefore, we close the socket and exit the program.
+        // If we broke the loop, we were asked to stop.
+        // Therefore, we let the watchdog go, print the statistics, close the socket and exit the program.
 
+        wdSend(sock, WD_BYE, seq, 0);
+
+        statsPrint(&st, ip);
         printf("Closing socket, goodbye!.\n");
 
+        wdSharedUnmap(shared);
+        freeTemplate(&tmpl);
+        poolFree(&replies);
         close(sock);
         close(rawsock);
 
         return 0;
     } 
 }
-
-
-// # The Functions #
-
-//// calculate_checksum() - is used for calculating checksum of the packet, which is inserted in the ICMP header.
-
-unsigned short calculate_checksum(unsigned short *paddress, int len)
-{
-    int nleft = len;
-    int sum = 0;
-    unsigned short *w = paddress;
-    unsigned short answer = 0;
-
-    while (nleft > 1)
-    {
-        sum += *w++;
-        nleft -= 2;
-    }
-
-    if (nleft == 1)
-    {
-        *((unsigned char *)&answer) = *((unsigned char *)w);
-        sum += answer;
-    }
-
-    // add back carry outs from top 16 bits to low 16 bits
-    sum = (sum >> 16) + (sum & 0xffff); // add hi 16 to low 16
-    sum += (sum >> 16);                 // add carry
-    answer = ~sum;                      // truncate to 16 bits
-
-    return answer;
-}
-
-
-//// makePacket() - creates the packet meant to be sent to the destination.
-
-int makePacket(char *pac)
-{
-    // Creating the parts of the ICMP header and adding it to the packet:
-    
-    struct icmp header;
-
-    header.icmp_type = ICMP_ECHO;         // Message Type (Consists of 8 bits)      - the type of the message, which in our case is an echo message.
-    header.icmp_code = 0;                 // Message Code (Consists of 8 bits)      - 0 represents the package is an echo request.
-    header.icmp_id = 24;                  // Message ID (Consists of 16 bits)       - helps the receiver to identify the full message created by the packets.
-    header.icmp_seq = 0;                  // Message Sequence (Consists of 16 bits) - keeps track of the numbers and order of packets sent
-    header.icmp_cksum = 0;                // Checksum (Consists of 16 bits)         - used to verify the integrity of the packet (Will be calculated later)
-
-    memcpy(pac, &header, ICMP_HDRLEN);    // Copying the ICMP header to the packet.
-
-    // Adding the data to the packet:
-
-    char data[IP_MAXPACKET] = "Ping!";     // Setting the data to be sent.
-    int len = strlen(data) + 1;            
-
-    memcpy(pac + ICMP_HDRLEN, data, len);  // Copying the data to the packet right after the ICMP header.
-
-    // Calculate the checksum and add it to the packet:
-
-    header.icmp_cksum = calculate_checksum((unsigned short *)(pac), ICMP_HDRLEN + len);
-    memcpy(pac, &header, ICMP_HDRLEN);
-
-    // We return the number of bytes used in the packet.
-
-    return ICMP_HDRLEN + len;
-}
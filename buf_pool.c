@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "buf_pool.h"
+
+
+// # The Functions #
+
+//// poolSlabSize() - returns the size of the slab that holds 'size' bytes: 'size' rounded up to whole cache lines.
+
+size_t poolSlabSize(size_t size)
+{
+    if (size == 0)
+    {
+        size = 1;
+    }
+
+    return (size + POOL_CACHE_LINE - 1) & ~(size_t)(POOL_CACHE_LINE - 1);
+}
+
+
+//// poolInit() - maps an arena of 'count' slabs of at least 'size' bytes each, all of them free.
+//// The slabs are taken in the order they lie in the arena. Returns 0 on success, -1 if we are out of memory.
+
+int poolInit(struct buf_pool *p, uint32_t count, size_t size)
+{
+    memset(p, 0, sizeof(*p));
+
+    if (count == 0)
+    {
+        return -1;
+    }
+
+    p->slab = poolSlabSize(size);
+    p->count = count;
+    p->arenaSize = p->slab * count;
+    p->next = malloc(count * sizeof(*p->next));
+
+    // The mapping starts on a page, so every slab starts on a cache line.
+
+    void *arena = mmap(NULL, p->arenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (arena == MAP_FAILED || p->next == NULL)
+    {
+        if (arena != MAP_FAILED)
+        {
+            munmap(arena, p->arenaSize);
+        }
+
+        free(p->next);
+        memset(p, 0, sizeof(*p));
+        return -1;
+    }
+
+    p->arena = arena;
+
+    // We now stack the free slabs, the first one on top.
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        atomic_init(&p->next[i], i + 1 < count ? i + 2 : 0);
+    }
+
+    atomic_init(&p->top, 1);
+
+    return 0;
+}
+
+
+//// poolFree() - unmaps the arena of a pool. Every slab taken from it is gone too.
+
+void poolFree(struct buf_pool *p)
+{
+    if (p->arena != NULL)
+    {
+        munmap(p->arena, p->arenaSize);
+    }
+
+    free(p->next);
+    memset(p, 0, sizeof(*p));
+}
+
+
+//// poolSlab() - returns the i-th slab of the arena, whether it is free or not. The slabs lie one after the other, 'slab' bytes apart.
+
+char *poolSlab(const struct buf_pool *p, uint32_t i)
+{
+    return p->arena + (size_t)i * p->slab;
+}
+
+
+//// poolGet() - takes a free slab off the pool, as it was left by its last user. Returns NULL if none is free.
+
+char *poolGet(struct buf_pool *p)
+{
+    uint64_t top = atomic_load_explicit(&p->top, memory_order_acquire);
+
+    for (;;)
+    {
+        uint32_t index = (uint32_t)top;
+
+        if (index == 0)
+        {
+            return NULL;
+        }
+
+        // The link may already be stale if another thread took this slab first - but then the counter changed too, and the swap fails.
+
+        uint64_t below = atomic_load_explicit(&p->next[index - 1], memory_order_relaxed);
+        uint64_t swapped = ((top >> 32) + 1) << 32 | below;
+
+        if (atomic_compare_exchange_weak_explicit(&p->top, &top, swapped, memory_order_acquire, memory_order_acquire))
+        {
+            return poolSlab(p, index - 1);
+        }
+    }
+}
+
+
+//// poolPut() - returns a slab taken by poolGet() to the pool. Any thread may return it, not only the one that took it.
+
+void poolPut(struct buf_pool *p, char *buf)
+{
+    uint32_t index = (uint32_t)((size_t)(buf - p->arena) / p->slab);
+    uint64_t top = atomic_load_explicit(&p->top, memory_order_relaxed);
+
+    for (;;)
+    {
+        atomic_store_explicit(&p->next[index], (uint32_t)top, memory_order_relaxed);
+
+        uint64_t swapped = ((top >> 32) + 1) << 32 | (index + 1);
+
+        if (atomic_compare_exchange_weak_explicit(&p->top, &top, swapped, memory_order_release, memory_order_relaxed))
+        {
+            return;
+        }
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef BUF_POOL_H
+#define BUF_POOL_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A pool of packet buffers, all carved out of one arena that is mapped once when the pool is created.
+// Every buffer (a slab) has the same size - the largest packet its user expects, rounded up to whole cache lines - and starts
+// on a cache line of its own, so two threads working on neighbouring slabs never share a line.
+//
+// Slabs are reused as they are: nothing is ever zeroed, since every packet is written over (or received into) before it is read,
+// and only its first 'len' bytes are ever looked at. The arena comes from anonymous memory, which the kernel zeroes once, page by page, on first touch.
+//
+// Taking and returning a slab is lock-free, so a slab may be taken on one thread and returned on another. The free slabs form a stack,
+// linked by their indexes; its top is swapped with compare-and-swap, together with a counter that changes on every swap,
+// so a slab that was taken and returned in between can't fool a swap (the ABA problem).
+
+#define POOL_CACHE_LINE 64
+
+struct buf_pool
+{
+    char *arena;                    // the slabs, one after the other
+    size_t arenaSize;               // the size of the mapping
+    size_t slab;                    // the size of each slab, a multiple of POOL_CACHE_LINE
+    uint32_t count;                 // the number of slabs
+    _Atomic uint32_t *next;         // for every free slab, the index of the free slab below it in the stack, plus one (0 - the bottom)
+    _Atomic uint64_t top;           // the index of the top free slab plus one (0 - none is free) in the low 32 bits, and the swap counter in the high ones
+};
+
+// # Function Headers #
+
+size_t poolSlabSize(size_t size);
+int poolInit(struct buf_pool *p, uint32_t count, size_t size);
+void poolFree(struct buf_pool *p);
+char *poolSlab(const struct buf_pool *p, uint32_t i);
+char *poolGet(struct buf_pool *p);
+void poolPut(struct buf_pool *p, char *buf);
+
+#endif
@@ -0,0 +1,208 @@
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHECKSUM_X86
+#endif
+
+#include "checksum.h"
+
+// # Function Headers #
+
+static uint64_t sumWords(const unsigned char *p, int len, uint64_t sum);
+static unsigned short foldSum(uint64_t sum);
+static void resolveChecksum(void);
+
+// The implementation calculate_checksum() uses, chosen on its first call.
+
+static unsigned short (*checksumImpl)(const void *data, int len) = NULL;
+static const char *checksumName = "scalar";
+
+
+// # The Functions #
+
+//// calculate_checksum() - is used for calculating checksum of the packet, which is inserted in the ICMP header.
+//// It runs the fastest implementation this CPU supports. All of them return exactly what the scalar one does.
+
+unsigned short calculate_checksum(unsigned short *paddress, int len)
+{
+    if (checksumImpl == NULL)
+    {
+        resolveChecksum();
+    }
+
+    return checksumImpl(paddress, len);
+}
+
+
+//// checksumImplName() - returns the name of the implementation calculate_checksum() runs ("scalar", "sse2" or "avx2").
+
+const char *checksumImplName(void)
+{
+    if (checksumImpl == NULL)
+    {
+        resolveChecksum();
+    }
+
+    return checksumName;
+}
+
+
+//// resolveChecksum() - picks the widest implementation the CPU supports.
+
+static void resolveChecksum(void)
+{
+    checksumImpl = checksumScalar;
+    checksumName = "scalar";
+
+#ifdef CHECKSUM_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        checksumImpl = checksumAvx2;
+        checksumName = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        checksumImpl = checksumSse2;
+        checksumName = "sse2";
+    }
+#endif
+}
+
+
+//// sumWords() - adds the data to a one's complement sum, 32 bits at a time.
+//// Since 2^16 = 1 (mod 2^16 - 1), summing 32-bit words and folding later gives the same result as summing 16-bit words,
+//// as long as every word starts at an even offset from the start of the packet. A 64-bit accumulator can't overflow for any 'int' length.
+//// A trailing odd byte is padded with a zero byte, as RFC 1071 requires.
+
+static uint64_t sumWords(const unsigned char *p, int len, uint64_t sum)
+{
+    uint32_t word32;
+    uint16_t word16 = 0;
+
+    while (len >= 4)
+    {
+        memcpy(&word32, p, 4);
+        sum += word32;
+        p += 4;
+        len -= 4;
+    }
+
+    if (len >= 2)
+    {
+        memcpy(&word16, p, 2);
+        sum += word16;
+        p += 2;
+        len -= 2;
+    }
+
+    if (len == 1)
+    {
+        word16 = 0;
+        *((unsigned char *)&word16) = *p;
+        sum += word16;
+    }
+
+    return sum;
+}
+
+
+//// foldSum() - adds the carries of a 64-bit sum back into its low 16 bits, and returns the complement - the checksum itself.
+
+static unsigned short foldSum(uint64_t sum)
+{
+    while (sum >> 16)
+    {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    return (unsigned short)~sum;
+}
+
+
+//// checksumScalar() - the portable implementation.
+
+unsigned short checksumScalar(const void *data, int len)
+{
+    return foldSum(sumWords(data, len, 0));
+}
+
+
+#ifdef CHECKSUM_X86
+
+//// checksumSse2() - sums 16 bytes per step: every 32-bit lane is widened into a 64-bit accumulator, so no carry is ever lost.
+//// The rest of the data (fewer than 16 bytes, at an even offset) is summed by sumWords().
+
+__attribute__((target("sse2")))
+unsigned short checksumSse2(const void *data, int len)
+{
+    const unsigned char *p = data;
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+
+    while (len >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, zero));
+
+        p += 16;
+        len -= 16;
+    }
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+
+    uint64_t sum = lanes[0] + lanes[1];
+
+    return foldSum(sumWords(p, len, sum));
+}
+
+
+//// checksumAvx2() - the same as checksumSse2(), 32 bytes per step.
+
+__attribute__((target("avx2")))
+unsigned short checksumAvx2(const void *data, int len)
+{
+    const unsigned char *p = data;
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = _mm256_setzero_si256();
+
+    while (len >= 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+
+        acc = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(v, zero));
+        acc = _mm256_add_epi64(acc, _mm256_unpackhi_epi32(v, zero));
+
+        p += 32;
+        len -= 32;
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+
+    uint64_t sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+    return foldSum(sumWords(p, len, sum));
+}
+
+#else
+
+// Without x86 vector units the "vector" implementations are the scalar one.
+
+unsigned short checksumSse2(const void *data, int len)
+{
+    return checksumScalar(data, len);
+}
+
+unsigned short checksumAvx2(const void *data, int len)
+{
+    return checksumScalar(data, len);
+}
+
+#endif
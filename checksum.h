@@ -0,0 +1,16 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+// The Internet checksum (RFC 1071) used by the ICMP header.
+// The sum is accumulated in 64 bits, so any length up to IP_MAXPACKET (and beyond) is safe,
+// and on x86 the bulk of the data is summed with SSE2 or AVX2, picked at runtime by what the CPU supports.
+
+// # Function Headers #
+
+unsigned short calculate_checksum(unsigned short *paddress, int len);
+unsigned short checksumScalar(const void *data, int len);
+unsigned short checksumSse2(const void *data, int len);
+unsigned short checksumAvx2(const void *data, int len);
+const char *checksumImplName(void);
+
+#endif
@@ -0,0 +1,165 @@
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "filter.h"
+
+#define FILTER_KEEP IP_MAXPACKET    // a filter returns how many bytes of the packet to keep - all of them
+#define FILTER_DROP 0
+
+
+// # The Functions #
+
+//// attachReplyFilter() - attaches a filter to a raw ICMP socket that keeps only the echo replies with the given id.
+//// If 'count' addresses are given (up to FILTER_MAX_ADDRS), a reply must also come from one of them. With more addresses
+//// than that, or none at all, the source isn't checked. Returns 0 on success, -1 (with errno set) if the filter couldn't be attached.
+////
+//// The raw socket sees the packet from its IP header on, so the program is:
+////
+////        ldb  [9]                     protocol
+////        jne  #IPPROTO_ICMP, drop
+////        ldxb 4 * ([0] & 0xf)         X = the length of the IP header, options included
+////        ldb  [x + 0]                 ICMP type
+////        jne  #ICMP_ECHOREPLY, drop
+////        ldh  [x + 4]                 ICMP id
+////        jne  #id, drop
+////        ld   [12]                    source address (only if addresses are given)
+////        jeq  #addr[i], keep          (once per address)
+////        ja   drop
+////  keep: ret  #FILTER_KEEP
+////  drop: ret  #FILTER_DROP
+
+int attachReplyFilter(int sock, int id, const struct in_addr *addrs, int count)
+{
+    if (count > FILTER_MAX_ADDRS)
+    {
+        count = 0;
+    }
+
+    struct sock_filter code[9 + FILTER_MAX_ADDRS + 2];
+    int len = 0;
+
+    // Every jump is relative to the next instruction, so the offsets to 'keep' and 'drop' are known only once we know the program's length.
+    // The checks are written with placeholder offsets, and patched below.
+
+    int checks[3];
+
+    code[len++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, offsetof(struct ip, ip_p));
+    checks[0] = len;
+    code[len++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_ICMP, 0, 0);
+
+    code[len++] = (struct sock_filter)BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0);
+    code[len++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_IND, offsetof(struct icmp, icmp_type));
+    checks[1] = len;
+    code[len++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHOREPLY, 0, 0);
+
+    code[len++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_IND, offsetof(struct icmp, icmp_id));
+    checks[2] = len;
+    code[len++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint16_t)id, 0, 0);
+
+    int matches = len;
+
+    if (count > 0)
+    {
+        code[len++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct ip, ip_src));
+
+        matches = len;
+
+        for (int i = 0; i < count; i++)
+        {
+            code[len++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(addrs[i].s_addr), 0, 0);
+        }
+
+        code[len++] = (struct sock_filter)BPF_STMT(BPF_JMP | BPF_JA, 1);
+    }
+
+    int keep = len;
+    code[len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, FILTER_KEEP);
+    int drop = len;
+    code[len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, FILTER_DROP);
+
+    // A failed check jumps to 'drop'. A passed check falls through to the next one - except that the address comparisons
+    // jump to 'keep' on a match, and fall through to the next address otherwise.
+
+    for (int i = 0; i < 3; i++)
+    {
+        code[checks[i]].jf = drop - checks[i] - 1;
+    }
+
+    for (int i = matches; i < matches + count; i++)
+    {
+        code[i].jt = keep - i - 1;
+    }
+
+    struct sock_fprog prog;
+    prog.len = len;
+    prog.filter = code;
+
+    if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == -1)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+//// attachDropFilter() - attaches a filter to a raw socket that drops every packet, for a socket that only sends.
+//// Its TX timestamps still come through, since the error queue isn't filtered. Returns 0 on success, -1 (with errno set) on failure.
+
+int attachDropFilter(int sock)
+{
+    struct sock_filter code[1] = { BPF_STMT(BPF_RET | BPF_K, FILTER_DROP) };
+    struct sock_fprog prog;
+    prog.len = 1;
+    prog.filter = code;
+
+    if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == -1)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+//// attachRequestFilter() - attaches a filter that keeps only ICMP echo requests, for the responder (a raw ICMP socket, or a packet ring -
+//// either way the packet starts at its IP header). Returns 0 on success, -1 (with errno set) if the filter couldn't be attached.
+////
+////        ldb  [9]                     protocol
+////        jne  #IPPROTO_ICMP, drop
+////        ldxb 4 * ([0] & 0xf)         X = the length of the IP header, options included
+////        ldb  [x + 0]                 ICMP type
+////        jne  #ICMP_ECHO, drop
+////        ret  #FILTER_KEEP
+////  drop: ret  #FILTER_DROP
+
+int attachRequestFilter(int sock)
+{
+    struct sock_filter code[] =
+    {
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, offsetof(struct ip, ip_p)),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_ICMP, 0, 4),
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),
+        BPF_STMT(BPF_LD | BPF_B | BPF_IND, offsetof(struct icmp, icmp_type)),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHO, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, FILTER_KEEP),
+        BPF_STMT(BPF_RET | BPF_K, FILTER_DROP),
+    };
+
+    struct sock_fprog prog;
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+
+    if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == -1)
+    {
+        return -1;
+    }
+
+    return 0;
+}
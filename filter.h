@@ -0,0 +1,21 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <netinet/in.h>
+
+// An in-kernel filter for the raw socket. A raw ICMP socket gets a copy of every ICMP packet on the host - other pingers'
+// traffic, unreachables, our own requests on loopback - and each of them costs a wakeup and a copy to userspace.
+// A classic BPF program attached with SO_ATTACH_FILTER drops all of them before they are queued on the socket,
+// so only echo replies carrying our id (and, optionally, coming from one of our targets) ever reach us.
+// A raw socket that only sends (a sweep's sender threads each have one) gets a filter that drops everything,
+// and the responder's socket one that keeps only echo requests.
+
+#define FILTER_MAX_ADDRS 64     // the most source addresses the filter compares one by one - beyond that only the id is checked
+
+// # Function Headers #
+
+int attachReplyFilter(int sock, int id, const struct in_addr *addrs, int count);
+int attachDropFilter(int sock);
+int attachRequestFilter(int sock);
+
+#endif
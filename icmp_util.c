@@ -0,0 +1,378 @@
+#include <arpa/inet.h>
+#include <endian.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "icmp_util.h"
+
+
+// # The Functions #
+
+//// makeTemplate() - builds the echo request once: the ICMP header and a payload of 'size' bytes, checksummed for the given id and sequence number 0.
+//// The payload starts with room for the send time and the sequence number, and the rest of it repeats the pattern
+//// (PING_PAYLOAD if no pattern is given). Every packet we send is a copy of the template, patched by patchPacket().
+//// Returns 0 on success, or -1 if the size is out of range or we are out of memory.
+
+int makeTemplate(struct packet_template *t, int id, int size, const unsigned char *pattern, int patternLen)
+{
+    if (size < PAYLOAD_HDRLEN || size > PAYLOAD_MAX)
+    {
+        return -1;
+    }
+
+    t->len = ICMP_HDRLEN + size;
+    t->data = malloc(t->len);
+
+    if (t->data == NULL)
+    {
+        return -1;
+    }
+
+    // Adding the data to the packet: the send time and sequence number stay zero until a packet is patched,
+    // and the pattern is repeated over the rest of the payload.
+
+    if (pattern == NULL || patternLen <= 0)
+    {
+        pattern = (const unsigned char *)PING_PAYLOAD;
+        patternLen = strlen(PING_PAYLOAD);
+    }
+
+    char *payload = t->data + ICMP_HDRLEN;
+
+    memset(payload, 0, PAYLOAD_HDRLEN);
+
+    for (int i = PAYLOAD_HDRLEN; i < size; i++)
+    {
+        payload[i] = pattern[(i - PAYLOAD_HDRLEN) % patternLen];
+    }
+
+    // Creating the parts of the ICMP header and adding it to the packet:
+
+    struct icmp header;
+
+    header.icmp_type = ICMP_ECHO;         // Message Type (Consists of 8 bits)      - the type of the message, which in our case is an echo message.
+    header.icmp_code = 0;                 // Message Code (Consists of 8 bits)      - 0 represents the package is an echo request.
+    header.icmp_id = htons(id);           // Message ID (Consists of 16 bits)       - helps the receiver to identify the full message created by the packets.
+    header.icmp_seq = 0;                  // Message Sequence (Consists of 16 bits) - keeps track of the numbers and order of packets sent
+    header.icmp_cksum = 0;                // Checksum (Consists of 16 bits)         - used to verify the integrity of the packet (Will be calculated later)
+
+    memcpy(t->data, &header, ICMP_HDRLEN);                 // Copying the ICMP header to the packet, right before the data.
+
+    // Calculate the checksum and add it to the packet:
+
+    header.icmp_cksum = calculate_checksum((unsigned short *)t->data, t->len);
+    memcpy(t->data, &header, ICMP_HDRLEN);
+
+    t->id = header.icmp_id;
+    t->seq = header.icmp_seq;
+    t->cksum = header.icmp_cksum;
+
+    return 0;
+}
+
+
+//// freeTemplate() - releases the memory of a template.
+
+void freeTemplate(struct packet_template *t)
+{
+    free(t->data);
+    t->data = NULL;
+}
+
+
+//// copyTemplate() - copies the template into a packet buffer, and returns the length of the packet.
+//// This only has to be done once per buffer: after that, patchPacket() turns the buffer into any packet we want to send.
+
+int copyTemplate(const struct packet_template *t, char *pac)
+{
+    memcpy(pac, t->data, t->len);
+
+    return t->len;
+}
+
+
+//// patchPacket() - turns a buffer holding a copy of the template into the echo request with the given id and sequence number,
+//// sent at 'sent' (CLOCK_MONOTONIC nanoseconds). The header carries the low 16 bits of the sequence number and the payload all 32 of them.
+//// Only these fields and the checksum are written. The checksum is derived from the template's checksum
+//// incrementally (RFC 1624), so the cost doesn't depend on the payload size.
+
+void patchPacket(const struct packet_template *t, char *pac, int id, uint32_t seq, uint64_t sent)
+{
+    struct icmp *header = (struct icmp *)pac;
+
+    uint16_t newId = htons(id);
+    uint16_t newSeq = htons(seq & 0xffff);
+
+    char stamp[PAYLOAD_HDRLEN];
+    uint64_t sentBe = htobe64(sent);
+    uint32_t seqBe = htonl(seq);
+
+    memcpy(stamp, &sentBe, 8);
+    memcpy(stamp + 8, &seqBe, 4);
+
+    // The template's checksum covers a zeroed send time and sequence number. The template's own buffer may have been patched since,
+    // so we don't read them back from it.
+
+    static const char zeroStamp[PAYLOAD_HDRLEN];
+
+    uint16_t cksum = checksumAdjust(t->cksum, &t->id, &newId, 2);
+    cksum = checksumAdjust(cksum, &t->seq, &newSeq, 2);
+    cksum = checksumAdjust(cksum, zeroStamp, stamp, PAYLOAD_HDRLEN);
+
+    header->icmp_id = newId;
+    header->icmp_seq = newSeq;
+    header->icmp_cksum = cksum;
+    memcpy(pac + ICMP_HDRLEN, stamp, PAYLOAD_HDRLEN);
+}
+
+
+//// checksumAdjust() - updates an Internet checksum after 'len' bytes (an even number, at an even offset) of the data changed from 'oldData' to 'newData'.
+//// This is equation 3 of RFC 1624: HC' = ~(~HC + ~m + m'), in one's complement arithmetic, applied to every 16-bit word at once.
+
+uint16_t checksumAdjust(uint16_t cksum, const void *oldData, const void *newData, int len)
+{
+    uint32_t sum = (uint16_t)~cksum;
+
+    for (int i = 0; i < len; i += 2)
+    {
+        uint16_t oldWord, newWord;
+
+        memcpy(&oldWord, (const char *)oldData + i, 2);
+        memcpy(&newWord, (const char *)newData + i, 2);
+
+        sum += (uint16_t)~oldWord + (uint32_t)newWord;
+    }
+
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+
+    return (uint16_t)~sum;
+}
+
+
+//// parseReply() - checks whether a datagram read from the socket is an echo reply to one of our requests.
+//// A raw socket hands us the IP header too ('ipHeader' is set), so we skip it (including any options) to reach the ICMP message.
+//// A ping socket hands us the ICMP message alone.
+//// The message must be an echo reply carrying the given id (unless ANY_ID is passed) and a valid checksum -
+//// this filters out other pingers' replies and our own echo requests looped back on the loopback interface.
+//// On success we return the length of the ICMP message and hand back its sequence number and header, otherwise we return -1.
+
+int parseReply(char *pac, ssize_t len, int ipHeader, int id, int *seq, struct icmp **reply)
+{
+    int iplen = 0;
+
+    if (ipHeader)
+    {
+        if (len < IP4_HDRLEN)
+        {
+            return -1;
+        }
+
+        struct ip *iphdr = (struct ip *)pac;
+        iplen = iphdr->ip_hl * 4;
+
+        if (iphdr->ip_p != IPPROTO_ICMP || iplen < IP4_HDRLEN)
+        {
+            return -1;
+        }
+    }
+
+    if (len < iplen + ICMP_HDRLEN)
+    {
+        return -1;
+    }
+
+    struct icmp *header = (struct icmp *)(pac + iplen);
+    int icmplen = len - iplen;
+
+    if (header->icmp_type != ICMP_ECHOREPLY || header->icmp_code != 0)
+    {
+        return -1;
+    }
+
+    if (id != ANY_ID && ntohs(header->icmp_id) != id)
+    {
+        return -1;
+    }
+
+    // A message with a correct checksum sums up to zero, checksum field included.
+
+    if (calculate_checksum((unsigned short *)header, icmplen) != 0)
+    {
+        return -1;
+    }
+
+    if (seq != NULL)
+    {
+        *seq = ntohs(header->icmp_seq);
+    }
+
+    if (reply != NULL)
+    {
+        *reply = header;
+    }
+
+    return icmplen;
+}
+
+
+//// parsePayload() - reads the send time and the full sequence number back from the payload of one of our echo replies,
+//// and verifies that the rest of the payload came back exactly as we sent it.
+//// Returns 0 on success, or -1 if the reply was truncated, its pattern was altered, or its two sequence numbers disagree -
+//// which all mean the echo was corrupted on the way.
+
+int parsePayload(const struct packet_template *t, const struct icmp *reply, int icmplen, uint32_t *seq, uint64_t *sent)
+{
+    if (icmplen != t->len)
+    {
+        return -1;
+    }
+
+    const char *payload = (const char *)reply + ICMP_HDRLEN;
+    const char *expected = t->data + ICMP_HDRLEN;
+
+    if (memcmp(payload + PAYLOAD_HDRLEN, expected + PAYLOAD_HDRLEN, t->len - ICMP_HDRLEN - PAYLOAD_HDRLEN) != 0)
+    {
+        return -1;
+    }
+
+    uint64_t sentBe;
+    uint32_t seqBe;
+
+    memcpy(&sentBe, payload, 8);
+    memcpy(&seqBe, payload + 8, 4);
+
+    if ((ntohl(seqBe) & 0xffff) != ntohs(reply->icmp_seq))
+    {
+        return -1;
+    }
+
+    if (seq != NULL)
+    {
+        *seq = ntohl(seqBe);
+    }
+
+    if (sent != NULL)
+    {
+        *sent = be64toh(sentBe);
+    }
+
+    return 0;
+}
+
+
+//// parsePattern() - parses a fill pattern given in hex ("ff00a5") into bytes, the way the classic ping's -p does.
+//// Returns the number of bytes, or -1 if the string isn't hex or is longer than PATTERN_MAX bytes.
+
+int parsePattern(const char *hex, unsigned char *pattern)
+{
+    int len = 0;
+
+    while (hex[0] != '\0')
+    {
+        char digits[3] = {hex[0], hex[1] != '\0' ? hex[1] : '0', '\0'};
+
+        if (len == PATTERN_MAX || strspn(digits, "0123456789abcdefABCDEF") != 2)
+        {
+            return -1;
+        }
+
+        pattern[len++] = (unsigned char)strtoul(digits, NULL, 16);
+        hex += hex[1] != '\0' ? 2 : 1;
+    }
+
+    return len > 0 ? len : -1;
+}
+
+
+//// parseSocketKind() - parses the name of a socket kind ("auto", "raw" or "dgram"). Returns one of the ICMP_SOCK_* values, or -1.
+
+int parseSocketKind(const char *name)
+{
+    if (strcmp(name, "auto") == 0)
+    {
+        return ICMP_SOCK_AUTO;
+    }
+
+    if (strcmp(name, "raw") == 0)
+    {
+        return ICMP_SOCK_RAW;
+    }
+
+    if (strcmp(name, "dgram") == 0)
+    {
+        return ICMP_SOCK_DGRAM;
+    }
+
+    return -1;
+}
+
+
+//// openIcmpSocket() - opens the socket the echo requests are sent on: a ping socket (SOCK_DGRAM) if the kind allows it and the kernel lets us,
+//// otherwise a raw socket. A ping socket is bound to our id, or to any free id the kernel picks if ours is taken,
+//// and 'ident' is updated to the id the kernel will put in our requests.
+//// Returns the socket and sets 'kind' to ICMP_SOCK_DGRAM or ICMP_SOCK_RAW, or returns -1 (with errno set) if no socket could be opened.
+
+int openIcmpSocket(int *kind, int *ident)
+{
+    int sock = -1;
+
+    if (*kind != ICMP_SOCK_RAW)
+    {
+        sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_ICMP);
+
+        if (sock != -1)
+        {
+            struct sockaddr_in local;
+            socklen_t len = sizeof(local);
+
+            memset(&local, 0, sizeof(local));
+            local.sin_family = AF_INET;
+            local.sin_port = htons(*ident);
+
+            if (bind(sock, (struct sockaddr *)&local, sizeof(local)) == -1)
+            {
+                local.sin_port = 0;
+
+                if (bind(sock, (struct sockaddr *)&local, sizeof(local)) == -1)
+                {
+                    close(sock);
+                    return -1;
+                }
+            }
+
+            if (getsockname(sock, (struct sockaddr *)&local, &len) == -1)
+            {
+                close(sock);
+                return -1;
+            }
+
+            *ident = ntohs(local.sin_port);
+            *kind = ICMP_SOCK_DGRAM;
+
+            return sock;
+        }
+
+        if (*kind == ICMP_SOCK_DGRAM)
+        {
+            return -1;
+        }
+    }
+
+    *kind = ICMP_SOCK_RAW;
+
+    return socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+}
+
+
+//// processIdent() - returns the ICMP id used by this process. Every pinger uses its own id, so replies to other pingers can be told apart from ours.
+
+int processIdent(void)
+{
+    return getpid() & 0xffff;
+}
@@ -0,0 +1,64 @@
+#ifndef ICMP_UTIL_H
+#define ICMP_UTIL_H
+
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "checksum.h"
+
+// Helpers for building our ICMP echo requests and recognizing the echo replies to them.
+// They are shared by ping.c, better_ping.c and the sweep mode.
+
+#define IP4_HDRLEN 20    // IPv4 header len without options
+#define IP4_MAXHDRLEN 60 // IPv4 header len with the most options it may carry
+#define ICMP_HDRLEN 8    // ICMP header len for echo messages
+
+#define ANY_ID -1        // passed to parseReply() when the caller checks the id on its own
+
+// The kinds of socket the echo requests can be sent on. Linux ping sockets (SOCK_DGRAM) need no privileges when
+// net.ipv4.ping_group_range includes our group, and the kernel hands them only the replies carrying their own id.
+// Raw sockets need root and see every ICMP packet on the host, IP header included.
+
+#define ICMP_SOCK_AUTO 0     // a ping socket if we are allowed one, a raw socket otherwise
+#define ICMP_SOCK_RAW 1
+#define ICMP_SOCK_DGRAM 2
+
+// Every payload starts with the time the request was sent and its full 32-bit sequence number, so a reply carries
+// everything needed to compute its RTT. The rest of the payload is filled with a repeating pattern, which the reply
+// must echo back unchanged.
+
+#define PING_PAYLOAD "Ping!"                                            // the default fill pattern
+#define PAYLOAD_HDRLEN 12                                               // the send time (8 bytes) and the sequence number (4 bytes)
+#define PAYLOAD_DEFAULT 56                                              // the default payload size, as in the classic ping
+#define PAYLOAD_MAX (IP_MAXPACKET - IP4_HDRLEN - ICMP_HDRLEN)           // the largest payload that fits in an IPv4 datagram
+#define PATTERN_MAX 16                                                  // the longest fill pattern (-p)
+
+// A prebuilt echo request. The header and payload are built (and checksummed) once, and every packet we send
+// is a copy of it with a different id, sequence number and send time.
+
+struct packet_template
+{
+    char *data;          // the ICMP header and payload
+    int len;             // the length of the ICMP message
+    uint16_t id;         // the id field of the template, as it is stored in the packet (network byte order)
+    uint16_t seq;        // the sequence field of the template, as it is stored in the packet
+    uint16_t cksum;      // the checksum of the template, as it is stored in the packet
+};
+
+// # Function Headers #
+
+int makeTemplate(struct packet_template *t, int id, int size, const unsigned char *pattern, int patternLen);
+void freeTemplate(struct packet_template *t);
+int copyTemplate(const struct packet_template *t, char *pac);
+void patchPacket(const struct packet_template *t, char *pac, int id, uint32_t seq, uint64_t sent);
+uint16_t checksumAdjust(uint16_t cksum, const void *oldData, const void *newData, int len);
+int parseReply(char *pac, ssize_t len, int ipHeader, int id, int *seq, struct icmp **reply);
+int parsePayload(const struct packet_template *t, const struct icmp *reply, int icmplen, uint32_t *seq, uint64_t *sent);
+int parsePattern(const char *hex, unsigned char *pattern);
+int parseSocketKind(const char *name);
+int openIcmpSocket(int *kind, int *ident);
+int processIdent(void);
+
+#endif
@@ -0,0 +1,341 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "inflight.h"
+
+// A key packs the destination address and the sequence number into one word, so a slot is claimed with a single compare-and-swap.
+// No destination is 0.0.0.0, so a real key is at least 2^32 and never collides with the markers below.
+
+#define INFLIGHT_EMPTY 0            // a slot that was never used - a lookup stops here
+#define INFLIGHT_TOMBSTONE 1        // a slot whose request was taken out - a lookup goes on past it, an insert may reuse it
+#define INFLIGHT_BUSY 2             // a slot an insert claimed, while it writes the rest of the slot
+
+// # Function Headers #
+
+static uint64_t makeKey(struct in_addr addr, uint32_t seq);
+static uint64_t hashKey(uint64_t key);
+static struct inflight_slot *findSlot(struct inflight_table *t, uint64_t key);
+static struct inflight_slot *findEntry(struct inflight_table *t, const struct inflight_entry *e);
+static uint64_t compactFifo(struct inflight_table *t);
+
+
+// # The Functions #
+
+//// inflightInit() - allocates an empty table for up to 'capacity' requests in flight. Returns 0 on success, -1 if we are out of memory.
+
+int inflightInit(struct inflight_table *t, uint64_t capacity)
+{
+    memset(t, 0, sizeof(*t));
+
+    // The table has twice as many slots as requests may be in flight, so it is never more than half full.
+    // The FIFO has room for twice as many entries too: the answered requests it still holds are squeezed out once it fills up,
+    // and then at least half of it is free again.
+
+    uint64_t most = 16;
+
+    while (most < capacity)
+    {
+        most *= 2;
+    }
+
+    uint64_t fifo = 2 * most;
+    uint64_t slots = 2 * most;
+
+    t->slots = calloc(slots, sizeof(*t->slots));
+    t->fifo = calloc(fifo, sizeof(*t->fifo));
+
+    if (t->slots == NULL || t->fifo == NULL)
+    {
+        inflightFree(t);
+        return -1;
+    }
+
+    t->mask = slots - 1;
+    t->capacity = most;
+    t->fifoSize = fifo;
+
+    return 0;
+}
+
+
+//// inflightFree() - releases the memory of a table.
+
+void inflightFree(struct inflight_table *t)
+{
+    free(t->slots);
+    free(t->fifo);
+    memset(t, 0, sizeof(*t));
+}
+
+
+//// inflightInsert() - adds a request that was just sent. Returns 0 on success, or -1 if the table is full
+//// (as many requests as it was made for are in flight - the caller should wait for some to be answered or expire).
+//// Answered requests never keep a new one out, wherever they sit in the FIFO.
+
+int inflightInsert(struct inflight_table *t, struct in_addr addr, uint16_t id, uint32_t seq, uint64_t sent)
+{
+    if (atomic_load_explicit(&t->count, memory_order_relaxed) >= t->capacity)
+    {
+        return -1;
+    }
+
+    // Requests answered behind an unanswered one stay in the FIFO until it expires. When they fill it, we squeeze them out.
+
+    uint64_t head = atomic_load_explicit(&t->fifoHead, memory_order_relaxed);
+
+    if (head - atomic_load_explicit(&t->fifoTail, memory_order_acquire) >= t->fifoSize)
+    {
+        head = compactFifo(t);
+    }
+
+    uint64_t key = makeKey(addr, seq);
+    uint64_t index = hashKey(key);
+
+    // We claim the first empty slot or tombstone along the probe sequence. The table is never more than half full, so there always is one.
+
+    for (uint32_t distance = 0; ; distance++, index++)
+    {
+        struct inflight_slot *s = &t->slots[index & t->mask];
+        uint64_t current = atomic_load_explicit(&s->key, memory_order_relaxed);
+
+        if ((current != INFLIGHT_EMPTY && current != INFLIGHT_TOMBSTONE)
+            || !atomic_compare_exchange_strong_explicit(&s->key, &current, INFLIGHT_BUSY, memory_order_acquire, memory_order_relaxed))
+        {
+            continue;
+        }
+
+        // The slot is ours. Its fields are written before the key is, so whoever sees the key (with an acquire load) sees them too.
+
+        s->sent = sent;
+        s->id = id;
+        atomic_store_explicit(&s->kernel, 0, memory_order_relaxed);
+        atomic_store_explicit(&s->key, key, memory_order_release);
+
+        uint32_t longest = atomic_load_explicit(&t->longest, memory_order_relaxed);
+
+        while (distance > longest && !atomic_compare_exchange_weak(&t->longest, &longest, distance))
+        {
+        }
+
+        break;
+    }
+
+    atomic_fetch_add_explicit(&t->count, 1, memory_order_relaxed);
+
+    t->fifo[head & (t->fifoSize - 1)].key = key;
+    t->fifo[head & (t->fifoSize - 1)].sent = sent;
+    atomic_store_explicit(&t->fifoHead, head + 1, memory_order_release);
+
+    return 0;
+}
+
+
+//// inflightContains() - returns 1 if the request is in flight, 0 if it isn't. It stays in flight either way.
+
+int inflightContains(struct inflight_table *t, struct in_addr addr, uint16_t id, uint32_t seq)
+{
+    struct inflight_slot *s = findSlot(t, makeKey(addr, seq));
+
+    return s != NULL && s->id == id;
+}
+
+
+//// inflightTake() - takes out the request a reply answers, and returns when it was sent in '*sent' (the kernel's TX timestamp, if we got it,
+//// and the userspace send time). Returns 1 if the request was in flight, 0 if it wasn't (never sent, already answered, or expired).
+
+int inflightTake(struct inflight_table *t, struct in_addr addr, uint16_t id, uint32_t seq, struct tstamp *sent)
+{
+    uint64_t key = makeKey(addr, seq);
+    struct inflight_slot *s = findSlot(t, key);
+
+    if (s == NULL || s->id != id)
+    {
+        return 0;
+    }
+
+    // The fields are read before the slot is released: once it is a tombstone, an insert may reuse it at any moment.
+    // If another thread takes the same request first, our compare-and-swap fails, and the reply counts only once.
+
+    uint64_t kernel = atomic_load_explicit(&s->kernel, memory_order_relaxed);
+    uint64_t mono = s->sent;
+
+    if (!atomic_compare_exchange_strong_explicit(&s->key, &key, INFLIGHT_TOMBSTONE, memory_order_acq_rel, memory_order_relaxed))
+    {
+        return 0;
+    }
+
+    atomic_fetch_sub_explicit(&t->count, 1, memory_order_relaxed);
+
+    sent->kernel = kernel;
+    sent->mono = mono;
+
+    return 1;
+}
+
+
+//// inflightSetKernel() - attaches the kernel's TX timestamp to a request still in flight.
+
+void inflightSetKernel(struct inflight_table *t, struct in_addr addr, uint32_t seq, uint64_t kernel)
+{
+    struct inflight_slot *s = findSlot(t, makeKey(addr, seq));
+
+    if (s != NULL)
+    {
+        atomic_store_explicit(&s->kernel, kernel, memory_order_relaxed);
+    }
+}
+
+
+//// inflightExpire() - takes out the oldest request, if it was sent before 'before' and is still in flight, and returns its destination and sequence number.
+//// Requests at the front of the FIFO that were answered meanwhile are dropped from it on the way, whenever they were sent - so they
+//// don't hold room in it. Returns 1 if a request expired, 0 if none is due.
+
+int inflightExpire(struct inflight_table *t, uint64_t before, struct in_addr *addr, uint32_t *seq)
+{
+    uint64_t tail = atomic_load_explicit(&t->fifoTail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&t->fifoHead, memory_order_acquire);
+
+    for (; tail != head; tail++)
+    {
+        struct inflight_entry *e = &t->fifo[tail & (t->fifoSize - 1)];
+        uint64_t key = e->key;
+        struct inflight_slot *s = findEntry(t, e);
+
+        if (s == NULL)
+        {
+            continue;                   // answered already
+        }
+
+        if (e->sent >= before)
+        {
+            break;
+        }
+
+        if (atomic_compare_exchange_strong_explicit(&s->key, &key, INFLIGHT_TOMBSTONE, memory_order_acq_rel, memory_order_relaxed))
+        {
+            atomic_fetch_sub_explicit(&t->count, 1, memory_order_relaxed);
+            atomic_store_explicit(&t->fifoTail, tail + 1, memory_order_release);
+
+            addr->s_addr = htonl((uint32_t)(e->key >> 32));
+            *seq = (uint32_t)e->key;
+
+            return 1;
+        }
+    }
+
+    atomic_store_explicit(&t->fifoTail, tail, memory_order_release);
+
+    return 0;
+}
+
+
+//// inflightOldest() - returns in '*sent' when the oldest request that may still be in flight was sent (after inflightExpire(), the oldest one that is).
+//// Returns 1 if there is one, 0 if the FIFO is empty.
+
+int inflightOldest(struct inflight_table *t, uint64_t *sent)
+{
+    uint64_t tail = atomic_load_explicit(&t->fifoTail, memory_order_relaxed);
+
+    if (tail == atomic_load_explicit(&t->fifoHead, memory_order_acquire))
+    {
+        return 0;
+    }
+
+    *sent = t->fifo[tail & (t->fifoSize - 1)].sent;
+
+    return 1;
+}
+
+
+//// inflightCount() - returns how many requests are in flight.
+
+uint64_t inflightCount(struct inflight_table *t)
+{
+    return atomic_load_explicit(&t->count, memory_order_relaxed);
+}
+
+
+//// makeKey() - packs a destination and a sequence number into a key.
+
+static uint64_t makeKey(struct in_addr addr, uint32_t seq)
+{
+    return (uint64_t)ntohl(addr.s_addr) << 32 | seq;
+}
+
+
+//// hashKey() - spreads a key over the table (the finalizer of splitmix64). Consecutive sequence numbers land far apart, so runs of them don't cluster.
+
+static uint64_t hashKey(uint64_t key)
+{
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ull;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebull;
+    key ^= key >> 31;
+
+    return key;
+}
+
+
+//// findSlot() - returns the slot holding a key, or NULL if the key isn't in the table. The probe sequence ends at an empty slot,
+//// or once it went further than any insert ever had to - so a miss costs the same even when tombstones pile up.
+
+static struct inflight_slot *findSlot(struct inflight_table *t, uint64_t key)
+{
+    uint64_t index = hashKey(key);
+    uint32_t longest = atomic_load_explicit(&t->longest, memory_order_relaxed);
+
+    for (uint32_t distance = 0; distance <= longest; distance++, index++)
+    {
+        struct inflight_slot *s = &t->slots[index & t->mask];
+        uint64_t current = atomic_load_explicit(&s->key, memory_order_acquire);
+
+        if (current == key)
+        {
+            return s;
+        }
+
+        if (current == INFLIGHT_EMPTY)
+        {
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+
+//// findEntry() - returns the slot of the request a FIFO entry stands for, or NULL if it isn't in flight any more.
+//// The send time must match as well: the same key may have been sent again since (the sequence number wrapped), and then this entry is stale.
+
+static struct inflight_slot *findEntry(struct inflight_table *t, const struct inflight_entry *e)
+{
+    struct inflight_slot *s = findSlot(t, e->key);
+
+    return s != NULL && s->sent == e->sent ? s : NULL;
+}
+
+
+//// compactFifo() - drops the entries of the requests that were answered from the FIFO, wherever they are, keeping the others in order.
+//// Returns the new head. Only the thread that inserts and expires calls it, so the FIFO can't change under it.
+
+static uint64_t compactFifo(struct inflight_table *t)
+{
+    uint64_t tail = atomic_load_explicit(&t->fifoTail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&t->fifoHead, memory_order_relaxed);
+    uint64_t kept = tail;
+
+    for (uint64_t i = tail; i != head; i++)
+    {
+        struct inflight_entry *e = &t->fifo[i & (t->fifoSize - 1)];
+
+        if (findEntry(t, e) != NULL)
+        {
+            t->fifo[kept++ & (t->fifoSize - 1)] = *e;
+        }
+    }
+
+    atomic_store_explicit(&t->fifoHead, kept, memory_order_release);
+
+    return kept;
+}
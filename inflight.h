@@ -0,0 +1,62 @@
+#ifndef INFLIGHT_H
+#define INFLIGHT_H
+
+#include <netinet/in.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "tstamp.h"
+
+// The in-flight table: every echo request that was sent and not yet answered or timed out, keyed by (destination, id, sequence number),
+// with the time it was sent. Requests are inserted when they are sent, taken out when their reply arrives, and expired in the order they were sent.
+//
+// The table is a flat, open-addressed hash table with linear probing, allocated once for the most requests that may be in flight,
+// so it costs the same per operation - and no allocation - with ten requests outstanding or millions. Its load stays under a half,
+// and a slot is 32 bytes, two to a cache line, so a lookup rarely touches more than one line.
+//
+// Inserting and taking are lock-free, so any thread may do them: a slot is claimed and released with compare-and-swap on its key.
+// A taken slot becomes a tombstone, which later inserts reuse. Next to the table, a FIFO remembers the requests in the order they were sent -
+// since they all share one timeout, that is also the order they expire in, so expiry never scans the table. The FIFO belongs to one thread,
+// the one that inserts and expires: answered requests are dropped from its front as expiry reaches them, and squeezed out of the middle
+// when it fills up behind an unanswered one.
+
+struct inflight_slot
+{
+    _Atomic uint64_t key;           // the destination and sequence number (see inflight.c), or one of the INFLIGHT_* markers
+    uint64_t sent;                  // when the request was sent (CLOCK_MONOTONIC nanoseconds)
+    _Atomic uint64_t kernel;        // the kernel's TX timestamp of the request, once we got it (0 until then)
+    uint16_t id;                    // the ICMP id of the request
+};
+
+struct inflight_entry
+{
+    uint64_t key;                   // the key of a request, in the FIFO
+    uint64_t sent;
+};
+
+struct inflight_table
+{
+    struct inflight_slot *slots;
+    uint64_t mask;                  // the number of slots minus one (a power of two)
+    _Atomic uint32_t longest;       // the longest probe sequence any insert needed - a lookup that goes further can stop
+    _Atomic uint64_t count;         // how many requests are in flight
+    uint64_t capacity;              // the most requests that may be in flight (a power of two, at least what the table was made for)
+    struct inflight_entry *fifo;    // the requests in the order they were sent (a ring)
+    uint64_t fifoSize;              // twice the capacity
+    _Atomic uint64_t fifoHead;      // the end of the entries pushed (by inserts, and moved back when answered entries are squeezed out)
+    _Atomic uint64_t fifoTail;      // the entries ever popped (by expiry)
+};
+
+// # Function Headers #
+
+int inflightInit(struct inflight_table *t, uint64_t capacity);
+void inflightFree(struct inflight_table *t);
+int inflightInsert(struct inflight_table *t, struct in_addr addr, uint16_t id, uint32_t seq, uint64_t sent);
+int inflightContains(struct inflight_table *t, struct in_addr addr, uint16_t id, uint32_t seq);
+int inflightTake(struct inflight_table *t, struct in_addr addr, uint16_t id, uint32_t seq, struct tstamp *sent);
+void inflightSetKernel(struct inflight_table *t, struct in_addr addr, uint32_t seq, uint64_t kernel);
+int inflightExpire(struct inflight_table *t, uint64_t before, struct in_addr *addr, uint32_t *seq);
+int inflightOldest(struct inflight_table *t, uint64_t *sent);
+uint64_t inflightCount(struct inflight_table *t);
+
+#endif
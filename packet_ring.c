@@ -0,0 +1,207 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "packet_ring.h"
+
+#define PACKET_RING_LL_OFFSET TPACKET_ALIGN(sizeof(struct tpacket3_hdr))    // where the link-layer address follows the frame header
+
+// # Function Headers #
+
+static void releaseBlock(struct packet_ring *r);
+
+
+// # The Functions #
+
+//// packetRingOpen() - opens an AF_PACKET socket for the interface 'iface', and maps a TPACKET_V3 ring for it, whose blocks are handed over
+//// at the latest 'blockTimeoutMs' milliseconds after their first packet.
+//// The socket receives nothing until packetRingBind(), so a filter attached in between sees every packet that reaches the ring.
+//// Returns 0 on success, -1 with errno set on error (ENODEV if there is no such interface, EPERM without CAP_NET_RAW).
+
+int packetRingOpen(struct packet_ring *r, const char *iface, int blockTimeoutMs)
+{
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+
+    r->ifindex = if_nametoindex(iface);
+
+    if (r->ifindex == 0)
+    {
+        errno = ENODEV;
+        return -1;
+    }
+
+    // A protocol of 0 doesn't hook the socket into the receive path yet - that is left for the bind.
+
+    r->fd = socket(AF_PACKET, SOCK_DGRAM, 0);
+
+    if (r->fd == -1)
+    {
+        return -1;
+    }
+
+    int version = TPACKET_V3;
+
+    if (setsockopt(r->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1)
+    {
+        packetRingClose(r);
+        return -1;
+    }
+
+    // We don't want the packets we send ourselves (on loopback, every reply would show up twice). Older kernels can't skip them,
+    // and then packetRingNext() does.
+
+    int ignore = 1;
+    setsockopt(r->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignore, sizeof(ignore));
+
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = PACKET_RING_BLOCK_SIZE;
+    req.tp_block_nr = PACKET_RING_BLOCKS;
+    req.tp_frame_size = PACKET_RING_FRAME_SIZE;
+    req.tp_frame_nr = PACKET_RING_BLOCK_SIZE / PACKET_RING_FRAME_SIZE * PACKET_RING_BLOCKS;
+    req.tp_retire_blk_tov = blockTimeoutMs;
+
+    if (setsockopt(r->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1)
+    {
+        packetRingClose(r);
+        return -1;
+    }
+
+    r->blockSize = req.tp_block_size;
+    r->blockCount = req.tp_block_nr;
+    r->mapSize = (size_t)r->blockSize * r->blockCount;
+
+    void *map = mmap(NULL, r->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, 0);
+
+    if (map == MAP_FAILED)
+    {
+        packetRingClose(r);
+        return -1;
+    }
+
+    r->map = map;
+
+    return 0;
+}
+
+
+//// packetRingBind() - binds the socket to its interface, so the IPv4 packets arriving on it start filling the ring.
+//// Returns 0 on success, -1 with errno set on error.
+
+int packetRingBind(struct packet_ring *r)
+{
+    struct sockaddr_ll addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_IP);
+    addr.sll_ifindex = r->ifindex;
+
+    return bind(r->fd, (struct sockaddr *)&addr, sizeof(addr));
+}
+
+
+//// packetRingClose() - unmaps the ring and closes the socket.
+
+void packetRingClose(struct packet_ring *r)
+{
+    if (r->map != NULL)
+    {
+        munmap(r->map, r->mapSize);
+    }
+
+    if (r->fd != -1)
+    {
+        close(r->fd);
+    }
+
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+
+//// packetRingNext() - hands out the next packet of the ring, in place. Returns 1 if there was one, or 0 if the kernel hasn't handed us
+//// another block yet. The packet stays where it is until the next call - then the block it is in may go back to the kernel.
+
+int packetRingNext(struct packet_ring *r, struct packet_frame *frame)
+{
+    while (1)
+    {
+        if (r->frame != NULL)
+        {
+            if (r->left == 0)
+            {
+                releaseBlock(r);
+                continue;
+            }
+
+            struct tpacket3_hdr *hdr = (struct tpacket3_hdr *)r->frame;
+            struct sockaddr_ll *ll = (struct sockaddr_ll *)(r->frame + PACKET_RING_LL_OFFSET);
+
+            r->frame += hdr->tp_next_offset;
+            r->left--;
+
+            if (ll->sll_pkttype == PACKET_OUTGOING)
+            {
+                continue;
+            }
+
+            frame->data = (const unsigned char *)hdr + hdr->tp_net;
+            frame->len = hdr->tp_snaplen;
+            frame->time = hdr->tp_sec * 1000000000ull + hdr->tp_nsec;
+            r->packets++;
+
+            return 1;
+        }
+
+        // The kernel fills the block before it flips its status to ours, so the status is read with an acquire load - the packets behind it are complete.
+
+        struct tpacket_block_desc *desc = (struct tpacket_block_desc *)(r->map + (size_t)r->block * r->blockSize);
+
+        if (!(__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+        {
+            return 0;
+        }
+
+        r->frame = (unsigned char *)desc + desc->hdr.bh1.offset_to_first_pkt;
+        r->left = desc->hdr.bh1.num_pkts;
+    }
+}
+
+
+//// packetRingDrops() - returns the packets the kernel dropped so far because the ring was full.
+//// The kernel resets its counters every time they are read, so we keep the total.
+
+uint64_t packetRingDrops(struct packet_ring *r)
+{
+    struct tpacket_stats_v3 st;
+    socklen_t len = sizeof(st);
+
+    if (getsockopt(r->fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) == 0)
+    {
+        r->drops += st.tp_drops;
+    }
+
+    return r->drops;
+}
+
+
+//// releaseBlock() - hands the block we finished reading back to the kernel, and moves on to the next one.
+//// The release store makes sure we are done with its packets before the kernel may write over them.
+
+static void releaseBlock(struct packet_ring *r)
+{
+    struct tpacket_block_desc *desc = (struct tpacket_block_desc *)(r->map + (size_t)r->block * r->blockSize);
+
+    __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+
+    r->block = (r->block + 1) % r->blockCount;
+    r->frame = NULL;
+    r->left = 0;
+}
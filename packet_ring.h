@@ -0,0 +1,50 @@
+#ifndef PACKET_RING_H
+#define PACKET_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A zero-copy receive path: an AF_PACKET socket with a TPACKET_V3 ring mapped into our memory.
+// The kernel writes every packet it lets through the socket's filter straight into the ring, and hands us whole blocks of them at once,
+// each packet with its timestamp - so reading the replies of a sweep costs no system call and no copy, however many there are.
+// We only wake up (in poll()) when a block is full or its timeout passed.
+//
+// The socket is of type SOCK_DGRAM, so every packet starts at its IP header, as on a raw ICMP socket - and the raw socket's reply filter
+// (filter.c) works on it unchanged.
+
+#define PACKET_RING_BLOCK_SIZE (1 << 20)    // the bytes of one block (a multiple of the page size)
+#define PACKET_RING_BLOCKS 32               // the blocks of the ring
+#define PACKET_RING_FRAME_SIZE 2048         // the frame size the kernel accounts the ring in (frames are variable-sized in TPACKET_V3)
+#define PACKET_RING_BLOCK_TIMEOUT_MS 8      // how long the kernel fills a block before handing it over anyway, unless told otherwise
+
+struct packet_ring
+{
+    int fd;                           // the AF_PACKET socket
+    int ifindex;                      // the interface the socket is bound to
+    unsigned char *map;               // the mapped ring
+    size_t mapSize;
+    uint32_t blockSize;
+    uint32_t blockCount;
+    uint32_t block;                   // the block we read next
+    uint32_t left;                    // the packets of the current block we haven't read yet (valid while 'frame' isn't NULL)
+    unsigned char *frame;             // the next packet of the current block, or NULL if we hold no block
+    uint64_t packets;                 // the packets we read off the ring
+    uint64_t drops;                   // the packets the kernel dropped because the ring was full (PACKET_STATISTICS)
+};
+
+struct packet_frame
+{
+    const unsigned char *data;        // the packet, from its IP header on, inside the ring
+    uint32_t len;                     // how many bytes of it are there
+    uint64_t time;                    // when the kernel received it, in nanoseconds since the epoch (CLOCK_REALTIME)
+};
+
+// # Function Headers #
+
+int packetRingOpen(struct packet_ring *r, const char *iface, int blockTimeoutMs);
+int packetRingBind(struct packet_ring *r);
+void packetRingClose(struct packet_ring *r);
+int packetRingNext(struct packet_ring *r, struct packet_frame *frame);
+uint64_t packetRingDrops(struct packet_ring *r);
+
+#endif
@@ -0,0 +1,432 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pcap_reader.h"
+
+#define PCAP_MAGIC_USEC 0xa1b2c3d4    // a classic pcap file with microsecond timestamps
+#define PCAP_MAGIC_NSEC 0xa1b23c4d    // a classic pcap file with nanosecond timestamps
+#define PCAP_FILE_HDRLEN 24
+#define PCAP_RECORD_HDRLEN 16
+
+#define PCAPNG_SHB 0x0a0d0d0a         // the section header block, which also starts the file
+#define PCAPNG_IDB 1                  // an interface description block
+#define PCAPNG_PB 2                   // the obsolete packet block
+#define PCAPNG_SPB 3                  // a simple packet block (it has no timestamp, so we skip it)
+#define PCAPNG_EPB 6                  // an enhanced packet block
+#define PCAPNG_BYTE_ORDER 0x1a2b3c4d  // the byte-order magic of a section
+#define PCAPNG_PACKET_HDRLEN 28       // the block header and the fixed fields of a (enhanced) packet block
+#define PCAPNG_OPT_TSRESOL 9          // the if_tsresol option of an interface
+#define PCAPNG_OPT_TSOFFSET 14        // the if_tsoffset option of an interface
+
+// # Function Headers #
+
+static uint16_t get16(const struct pcap_reader *r, const unsigned char *p);
+static uint32_t get32(const struct pcap_reader *r, const unsigned char *p);
+static uint64_t toNs(const struct pcap_interface *iface, uint64_t ticks);
+static void releaseBehind(struct pcap_reader *r);
+static int nextPcap(struct pcap_reader *r, struct pcap_packet *pkt);
+static int nextPcapng(struct pcap_reader *r, struct pcap_packet *pkt);
+static int readSection(struct pcap_reader *r, const unsigned char *block, size_t left);
+static void readInterface(struct pcap_reader *r, const unsigned char *block, uint32_t length);
+
+
+// # The Functions #
+
+//// pcapOpen() - maps a capture file and reads its header. Returns 0 on success, or -1 (with 'error' set, if the file was opened) if the file
+//// can't be read or isn't a pcap or pcapng file.
+
+int pcapOpen(struct pcap_reader *r, const char *path)
+{
+    memset(r, 0, sizeof(*r));
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd == -1 || fstat(fd, &st) == -1)
+    {
+        r->error = "the file can't be opened";
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+
+    if (st.st_size < 12)
+    {
+        r->error = "the file is too short to be a capture";
+        close(fd);
+        return -1;
+    }
+
+    // The mapping outlives the descriptor, and the kernel reads the file ahead of us, since we walk it from start to end.
+
+    r->size = st.st_size;
+    void *map = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+    {
+        r->error = "the file can't be mapped";
+        return -1;
+    }
+
+    r->map = map;
+    madvise(map, r->size, MADV_SEQUENTIAL);
+
+    r->interfaces = calloc(PCAP_MAX_INTERFACES, sizeof(*r->interfaces));
+    if (r->interfaces == NULL)
+    {
+        r->error = "out of memory";
+        pcapClose(r);
+        return -1;
+    }
+
+    // We now tell the two formats (and byte orders) apart by their first four bytes.
+
+    uint32_t magic;
+    memcpy(&magic, r->map, sizeof(magic));
+
+    if (magic == PCAPNG_SHB)
+    {
+        r->ng = 1;
+
+        if (readSection(r, r->map, r->size) == -1)
+        {
+            pcapClose(r);
+            return -1;
+        }
+
+        return 0;
+    }
+
+    if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC)
+    {
+        r->swapped = 0;
+    }
+    else if (magic == __builtin_bswap32(PCAP_MAGIC_USEC) || magic == __builtin_bswap32(PCAP_MAGIC_NSEC))
+    {
+        r->swapped = 1;
+    }
+    else
+    {
+        r->error = "the file is neither a pcap nor a pcapng file";
+        pcapClose(r);
+        return -1;
+    }
+
+    if (r->size < PCAP_FILE_HDRLEN)
+    {
+        r->error = "the file header is truncated";
+        pcapClose(r);
+        return -1;
+    }
+
+    r->pcap.linktype = get32(r, r->map + 20) & 0x0fffffff;      // the top bits tell whether the frames carry their FCS
+    r->pcap.unitsPerSecond = get32(r, r->map) == PCAP_MAGIC_NSEC ? 1000000000 : 1000000;
+    r->pcap.offset = 0;
+    r->pos = PCAP_FILE_HDRLEN;
+
+    return 0;
+}
+
+
+//// pcapClose() - unmaps the file. The packets handed out by the reader are gone too.
+
+void pcapClose(struct pcap_reader *r)
+{
+    if (r->map != NULL)
+    {
+        munmap((void *)r->map, r->size);
+    }
+
+    free(r->interfaces);
+
+    const char *error = r->error;
+    memset(r, 0, sizeof(*r));
+    r->error = error;
+}
+
+
+//// pcapNext() - hands out the next packet of the file. It points into the mapping, and stays valid until pcapNext() is called again.
+//// Returns 1 if there was a packet, 0 at the end of the file - or when the file turns out truncated or malformed, with 'error' set.
+
+int pcapNext(struct pcap_reader *r, struct pcap_packet *pkt)
+{
+    releaseBehind(r);
+
+    return r->ng ? nextPcapng(r, pkt) : nextPcap(r, pkt);
+}
+
+
+//// nextPcap() - reads the next record of a classic pcap file.
+
+static int nextPcap(struct pcap_reader *r, struct pcap_packet *pkt)
+{
+    size_t left = r->size - r->pos;
+
+    if (left == 0)
+    {
+        return 0;
+    }
+
+    if (left < PCAP_RECORD_HDRLEN)
+    {
+        r->error = "the last record header is truncated";
+        return 0;
+    }
+
+    const unsigned char *record = r->map + r->pos;
+    uint32_t caplen = get32(r, record + 8);
+
+    if (caplen > left - PCAP_RECORD_HDRLEN)
+    {
+        r->error = "the last packet is truncated";
+        return 0;
+    }
+
+    pkt->data = record + PCAP_RECORD_HDRLEN;
+    pkt->caplen = caplen;
+    pkt->len = get32(r, record + 12);
+    pkt->time = (uint64_t)get32(r, record) * 1000000000 + toNs(&r->pcap, get32(r, record + 4));
+    pkt->linktype = r->pcap.linktype;
+
+    r->pos += PCAP_RECORD_HDRLEN + caplen;
+
+    return 1;
+}
+
+
+//// nextPcapng() - walks the blocks of a pcapng file up to the next packet, taking in the section headers and interfaces on the way.
+
+static int nextPcapng(struct pcap_reader *r, struct pcap_packet *pkt)
+{
+    while (r->pos < r->size)
+    {
+        size_t left = r->size - r->pos;
+        const unsigned char *block = r->map + r->pos;
+
+        if (left < 12)
+        {
+            r->error = "the last block is truncated";
+            return 0;
+        }
+
+        // A section header sets the byte order of everything after it, its own length included - so it is read before the length is.
+
+        uint32_t type;
+        memcpy(&type, block, sizeof(type));
+
+        if (type == PCAPNG_SHB && readSection(r, block, left) == -1)
+        {
+            return 0;
+        }
+
+        type = get32(r, block);
+        uint32_t length = get32(r, block + 4);
+
+        if (length < 12 || length % 4 != 0 || length > left)
+        {
+            r->error = "a block has a bad length, or is truncated";
+            return 0;
+        }
+
+        r->pos += length;
+
+        if (type == PCAPNG_SHB)
+        {
+            continue;
+        }
+
+        if (type == PCAPNG_IDB)
+        {
+            readInterface(r, block, length);
+            continue;
+        }
+
+        if ((type != PCAPNG_EPB && type != PCAPNG_PB) || length < PCAPNG_PACKET_HDRLEN + 4)
+        {
+            r->skipped++;
+            continue;
+        }
+
+        // The obsolete packet block has a 16-bit interface id (and a drop counter), the enhanced one a 32-bit id - the rest is laid out alike.
+
+        uint32_t ifid = type == PCAPNG_EPB ? get32(r, block + 8) : get16(r, block + 8);
+        uint32_t caplen = get32(r, block + 20);
+
+        if (ifid >= r->interfaceCount || caplen > length - PCAPNG_PACKET_HDRLEN - 4)
+        {
+            r->skipped++;
+            continue;
+        }
+
+        const struct pcap_interface *iface = &r->interfaces[ifid];
+        uint64_t ticks = (uint64_t)get32(r, block + 12) << 32 | get32(r, block + 16);
+
+        pkt->data = block + PCAPNG_PACKET_HDRLEN;
+        pkt->caplen = caplen;
+        pkt->len = get32(r, block + 24);
+        pkt->time = toNs(iface, ticks) + iface->offset * 1000000000;
+        pkt->linktype = iface->linktype;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+
+//// readSection() - takes in a section header block: its byte order, and a fresh (empty) list of interfaces. Returns 0 on success, -1 with 'error' set if it is malformed.
+
+static int readSection(struct pcap_reader *r, const unsigned char *block, size_t left)
+{
+    if (left < 28)
+    {
+        r->error = "a section header is truncated";
+        return -1;
+    }
+
+    uint32_t magic;
+    memcpy(&magic, block + 8, sizeof(magic));
+
+    if (magic == PCAPNG_BYTE_ORDER)
+    {
+        r->swapped = 0;
+    }
+    else if (magic == __builtin_bswap32(PCAPNG_BYTE_ORDER))
+    {
+        r->swapped = 1;
+    }
+    else
+    {
+        r->error = "a section header has a bad byte-order magic";
+        return -1;
+    }
+
+    r->interfaceCount = 0;
+
+    return 0;
+}
+
+
+//// readInterface() - takes in an interface description block: the link type, and the timestamp resolution and offset from its options.
+
+static void readInterface(struct pcap_reader *r, const unsigned char *block, uint32_t length)
+{
+    if (r->interfaceCount == PCAP_MAX_INTERFACES || length < 20)
+    {
+        r->skipped++;
+        return;
+    }
+
+    struct pcap_interface *iface = &r->interfaces[r->interfaceCount++];
+
+    iface->linktype = get16(r, block + 8);
+    iface->unitsPerSecond = 1000000;        // microseconds, unless an option says otherwise
+    iface->offset = 0;
+
+    // The options follow the fixed fields, each padded to 4 bytes, up to the trailing copy of the block length.
+
+    uint32_t pos = 16;
+
+    while (pos + 4 <= length - 4)
+    {
+        uint16_t code = get16(r, block + pos);
+        uint16_t len = get16(r, block + pos + 2);
+        const unsigned char *value = block + pos + 4;
+
+        if (code == 0 || pos + 4 + len > length - 4)
+        {
+            break;
+        }
+
+        if (code == PCAPNG_OPT_TSRESOL && len >= 1)
+        {
+            // The high bit tells a power of two from a power of ten. Resolutions finer than 64 bits can count are clamped.
+
+            uint8_t exponent = value[0] & 0x7f;
+            uint64_t units = 1;
+
+            if (value[0] & 0x80)
+            {
+                units = (uint64_t)1 << (exponent < 63 ? exponent : 63);
+            }
+            else
+            {
+                for (int i = 0; i < exponent && i < 19; i++)
+                {
+                    units *= 10;
+                }
+            }
+
+            iface->unitsPerSecond = units;
+        }
+        else if (code == PCAPNG_OPT_TSOFFSET && len >= 8)
+        {
+            uint64_t offset = r->swapped ? (uint64_t)get32(r, value) << 32 | get32(r, value + 4) : (uint64_t)get32(r, value + 4) << 32 | get32(r, value);
+            iface->offset = (int64_t)offset;
+        }
+
+        pos += 4 + ((len + 3) & ~3u);
+    }
+}
+
+
+//// releaseBehind() - drops the pages the reader is done with, once in a while, so reading a huge file doesn't pile it all up in our memory.
+//// The page cache may still keep them, but they no longer count against us.
+
+static void releaseBehind(struct pcap_reader *r)
+{
+    if (r->pos - r->released < PCAP_RELEASE_CHUNK)
+    {
+        return;
+    }
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t upto = r->pos & ~(page - 1);
+
+    madvise((void *)(r->map + r->released), upto - r->released, MADV_DONTNEED);
+    r->released = upto;
+}
+
+
+//// toNs() - converts a timestamp in the units of an interface to nanoseconds.
+
+static uint64_t toNs(const struct pcap_interface *iface, uint64_t ticks)
+{
+    uint64_t units = iface->unitsPerSecond;
+
+    if (units == 1000000000)
+    {
+        return ticks;
+    }
+
+    return ticks / units * 1000000000 + (uint64_t)((unsigned __int128)(ticks % units) * 1000000000 / units);
+}
+
+
+//// get16() - reads a 16-bit field in the byte order of the file.
+
+static uint16_t get16(const struct pcap_reader *r, const unsigned char *p)
+{
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+
+    return r->swapped ? __builtin_bswap16(v) : v;
+}
+
+
+//// get32() - reads a 32-bit field in the byte order of the file.
+
+static uint32_t get32(const struct pcap_reader *r, const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+
+    return r->swapped ? __builtin_bswap32(v) : v;
+}
@@ -0,0 +1,63 @@
+#ifndef PCAP_READER_H
+#define PCAP_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A streaming reader of capture files, in either the classic pcap format or pcapng, of either byte order.
+// The file is mapped into memory and walked block by block, and every packet is handed out as a pointer into the mapping,
+// so nothing is copied and the memory it takes does not grow with the file: the pages behind the reader are dropped as it goes.
+//
+// A pcapng file may hold several sections, each with its own interfaces, link types and timestamp resolutions. The reader keeps
+// the interfaces of the current section only, and converts every timestamp to nanoseconds since the epoch.
+
+#define PCAP_MAX_INTERFACES 256       // the most interfaces a pcapng section may describe - packets of the ones after are skipped
+#define PCAP_RELEASE_CHUNK (16 << 20) // the bytes read between two drops of the pages behind the reader
+
+// The link types we know how to find the IPv4 header in (see replay.c).
+
+#define PCAP_LINK_NULL 0              // BSD loopback: a 4-byte address family, in the byte order of the capturing host
+#define PCAP_LINK_ETHERNET 1
+#define PCAP_LINK_RAW 101             // a bare IP packet
+#define PCAP_LINK_LINUX_SLL 113       // Linux "cooked" capture (the 'any' interface)
+#define PCAP_LINK_IPV4 228            // a bare IPv4 packet
+#define PCAP_LINK_LINUX_SLL2 276      // Linux "cooked" capture, version 2
+
+struct pcap_interface
+{
+    int linktype;                     // the link type of the interface
+    uint64_t unitsPerSecond;          // the timestamp resolution (pcapng if_tsresol)
+    int64_t offset;                   // seconds to add to every timestamp (pcapng if_tsoffset)
+};
+
+struct pcap_packet
+{
+    const unsigned char *data;        // the captured bytes, inside the mapping
+    uint32_t caplen;                  // how many bytes were captured
+    uint32_t len;                     // how long the packet was on the wire
+    uint64_t time;                    // when it was captured, in nanoseconds since the epoch
+    int linktype;                     // the link type of the interface it was captured on
+};
+
+struct pcap_reader
+{
+    const unsigned char *map;         // the mapped file
+    size_t size;                      // the size of the file
+    size_t pos;                       // the offset of the next record or block
+    size_t released;                  // the offset up to which the pages were dropped
+    int ng;                           // whether the file is pcapng
+    int swapped;                      // whether the file (or current section) is of the other byte order
+    struct pcap_interface pcap;       // the single "interface" of a classic pcap file
+    struct pcap_interface *interfaces;    // the interfaces of the current pcapng section
+    uint32_t interfaceCount;
+    uint64_t skipped;                 // the blocks and records we skipped (unknown types, packets without a timestamp or an interface)
+    const char *error;                // why the reader stopped early, if it did (NULL - it reached the end of the file)
+};
+
+// # Function Headers #
+
+int pcapOpen(struct pcap_reader *r, const char *path);
+void pcapClose(struct pcap_reader *r);
+int pcapNext(struct pcap_reader *r, struct pcap_packet *pkt);
+
+#endif
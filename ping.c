@@ -1,40 +1,261 @@
+#define _GNU_SOURCE    // ppoll()
+
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <netinet/ip_icmp.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
-#include <sys/time.h>    // gettimeofday()
 #include <sys/types.h>
 #include <unistd.h>
 
-#define IP4_HDRLEN 20    // IPv4 header len without options
-#define ICMP_HDRLEN 8    // ICMP header len for echo messages
-
-// # Function Headers #
+#include "batch_io.h"
+#include "buf_pool.h"
+#include "filter.h"
+#include "icmp_util.h"
+#include "inflight.h"
+#include "stats.h"
+#include "sweep.h"
+#include "tstamp.h"
+#include "uring_ping.h"
 
-unsigned short calculate_checksum(unsigned short *paddress, int len);
-int makePacket(int seq, char *pac);
+#define max_window (1 << 22)    // the most probes in flight - replies are matched by the 32-bit sequence number in their payload, so the 16-bit one in the header may wrap
 
 // To execute the program, run it from the command line with the following syntax: ./ping <destination_ip>
+// To probe many hosts at once, pass several addresses or CIDR ranges (or a file of them with -f):
+//     ./ping [-r probes_per_second] [-b batch] [-P senders] [-T workers] [-R rcvbuf_bytes] [-I capture_iface] [-W timeout_seconds] [-f targets_file] <destination_ip | cidr> ...
+// -b sets how many probes (and replies) share one sendmmsg() (recvmmsg()) call; -b 1 sends and receives one packet per syscall.
+// -P spreads the sending of a sweep over that many threads, one per core, each with its own raw socket and share of the targets.
+// -T hands the replies of a sweep to that many worker threads, fed by a thread that does nothing but drain the socket,
+// and -R sets the socket's receive buffer (4 MiB by default with -T, the system default otherwise).
+// -I reads the replies of a sweep off a TPACKET_V3 ring on that interface (the one the replies arrive on, e.g. -I eth0) instead of the raw socket:
+// the kernel writes them into memory we share with it, so receiving costs no syscall and no copy. It needs a raw socket and no -T.
+// For a single destination, -i sets the interval between probes (fractions of a second are fine, e.g. -i 0.0005)
+// and -w how many probes may be in flight at once; a probe that isn't answered within -W seconds is counted as lost.
+// -c stops after that many probes, and -S prints the statistics every that many seconds. Ctrl+C prints them and exits.
+// -E picks the engine of the single-destination mode: "poll" (the default) sends with sendto() and waits in ppoll(),
+// "uring" drives the probes, their deadlines and the replies through io_uring (see uring_ping.h), for comparing the two.
+// -m picks the socket: "dgram" for an unprivileged Linux ping socket, "raw" for a raw socket (needs root),
+// or "auto" (the default) for a ping socket if net.ipv4.ping_group_range allows it and a raw socket otherwise.
+// -s sets the payload size in bytes (at least 12, for the send time and sequence number every probe carries),
+// and -p fills the rest of the payload with a pattern given in hex, e.g. -p ff00. Replies that don't echo the payload back intact are counted as corrupted.
 
 int main(int argnum, char *argt[])
 {
     // First, we check for errors regarding the execution of the program:
-    
+
+    struct sweep sw;
+    sweep_init(&sw);
+
+    const char *targetFile = NULL;
+    double interval = 1.0;         // seconds between two probes to a single destination
+    int window = 1;                // how many probes to a single destination may be in flight at once
+    long count = 0;                // how many probes to send before stopping (0 - until Ctrl+C)
+    double period = 0;             // seconds between two statistics summaries (0 - only at the end)
+    int kind = ICMP_SOCK_AUTO;     // the kind of socket to send on
+    int useUring = 0;              // whether the single destination is pinged through io_uring (-E uring)
+    int opt;
+
+    while ((opt = getopt(argnum, argt, "r:W:f:i:w:c:S:b:s:p:m:T:R:P:E:I:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r': sw.rate = atof(optarg);    break;
+            case 'W': sw.timeout = atof(optarg); break;
+            case 'f': targetFile = optarg;       break;
+            case 'i': interval = atof(optarg);   break;
+            case 'w': window = atoi(optarg);     break;
+            case 'c': count = atol(optarg);      break;
+            case 'S': period = sw.period = atof(optarg); break;
+            case 'b': sw.batch = atoi(optarg);   break;
+            case 's': sw.size = atoi(optarg);    break;
+            case 'T': sw.workers = atoi(optarg); break;
+            case 'P': sw.senders = atoi(optarg); break;
+            case 'R': sw.rcvbuf = atoi(optarg);  break;
+            case 'I': sw.iface = optarg;         break;
+            case 'p':
+                sw.patternLen = parsePattern(optarg, sw.pattern);
+
+                if (sw.patternLen == -1)
+                {
+                    printf("The pattern must be up to %d bytes in hex, e.g. -p ff00.\n", PATTERN_MAX);
+                    return 0;
+                }
+
+                break;
+            case 'E':
+                if (strcmp(optarg, "poll") != 0 && strcmp(optarg, "uring") != 0)
+                {
+                    printf("The engine must be poll or uring.\n");
+                    return 0;
+                }
+
+                useUring = strcmp(optarg, "uring") == 0;
+                break;
+            case 'm':
+                kind = parseSocketKind(optarg);
+
+                if (kind == -1)
+                {
+                    printf("The socket kind must be auto, raw or dgram.\n");
+                    return 0;
+                }
+
+                break;
+            default:
+                printf("Correct usage: ./ping [-c count] [-i interval] [-w window] [-S summary_seconds] [-s size] [-p pattern] [-m auto|raw|dgram] [-E poll|uring] [-r probes_per_second] [-b batch] [-P senders] [-T workers] [-R rcvbuf_bytes] [-I capture_iface] [-W timeout_seconds] [-f targets_file] <destination_ip | cidr> ...\n");
+                return 0;
+        }
+    }
+
+    if (sw.rate <= 0 || sw.timeout <= 0 || interval <= 0 || count < 0 || period < 0)
+    {
+        printf("The probe rate, interval and timeout must be positive.\n");
+        return 0;
+    }
+
+    // Ctrl+C stops the loop gracefully, so the statistics can still be printed.
+
+    statsCatchSigint();
+
+    if (sw.batch < 1 || sw.batch > BATCH_MAX)
+    {
+        printf("The batch must be between 1 and %d probes.\n", BATCH_MAX);
+        return 0;
+    }
+
+    if (sw.size < PAYLOAD_HDRLEN || sw.size > PAYLOAD_MAX)
+    {
+        printf("The payload size must be between %d and %d bytes.\n", PAYLOAD_HDRLEN, PAYLOAD_MAX);
+        return 0;
+    }
+
+    if (sw.workers < 0 || sw.workers > SWEEP_MAX_WORKERS || sw.rcvbuf < 0)
+    {
+        printf("The sweep may have between 0 and %d reply workers, and the receive buffer can't be negative.\n", SWEEP_MAX_WORKERS);
+        return 0;
+    }
+
+    if (sw.senders < 0 || sw.senders > SWEEP_MAX_SENDERS)
+    {
+        printf("The sweep may have between 0 and %d senders.\n", SWEEP_MAX_SENDERS);
+        return 0;
+    }
+
+    // Every sender has a raw socket of its own. A ping socket wouldn't do: the replies to its probes would come back to it, and not to us.
+
+    if (sw.senders > 0 && kind == ICMP_SOCK_DGRAM)
+    {
+        printf("Sender threads (-P) need raw sockets.\n");
+        return 0;
+    }
+
+    // The ring is an AF_PACKET socket, which takes the same privileges as a raw socket. Its replies are read on the main thread,
+    // so there is nothing left for an RX thread and workers to do.
+
+    if (sw.iface != NULL && kind == ICMP_SOCK_DGRAM)
+    {
+        printf("Capturing the replies on an interface (-I) needs a raw socket.\n");
+        return 0;
+    }
+
+    if (sw.iface != NULL && sw.workers > 0)
+    {
+        printf("The capture ring (-I) can't be combined with reply workers (-T).\n");
+        return 0;
+    }
+
+    if (sw.senders > 0 || sw.iface != NULL)
+    {
+        kind = ICMP_SOCK_RAW;
+    }
+
+    if (window < 1 || window > max_window)
+    {
+        printf("The window must be between 1 and %d probes.\n", max_window);
+        return 0;
+    }
+
+    double timeout = sw.timeout;                 // seconds before an unanswered probe counts as lost
+    int size = sw.size;                          // the payload size of every probe
+    int patternLen = sw.patternLen;              // the fill pattern of the payload (0 - the default one)
+    unsigned char pattern[PATTERN_MAX];
+    memcpy(pattern, sw.pattern, sizeof(pattern));
+    uint64_t interval_ns = (uint64_t)(interval * 1e9);   // the interval in nanoseconds
+    uint64_t timeout_ns = (uint64_t)(timeout * 1e9);     // the timeout in nanoseconds
+    uint64_t period_ns = (uint64_t)(period * 1e9);       // the summary period in nanoseconds
+
+    if (interval_ns < 1)
+    {
+        interval_ns = 1;
+    }
+
+    // If we were given more than one target, a CIDR range or a target file, we sweep all of them at once.
+
+    if (targetFile != NULL || argnum - optind > 1 || (argnum - optind == 1 && strchr(argt[optind], '/') != NULL))
+    {
+        if (targetFile != NULL && sweep_add_file(&sw, targetFile) == -1)
+        {
+            sweep_free(&sw);
+            return 0;
+        }
+
+        for (int i = optind; i < argnum; i++)
+        {
+            if (sweep_add_targets(&sw, argt[i]) == -1)
+            {
+                printf("Invalid target: %s\n", argt[i]);
+                sweep_free(&sw);
+                return 0;
+            }
+        }
+
+        if (useUring)
+        {
+            printf("The io_uring engine (-E uring) drives a single destination only.\n");
+            sweep_free(&sw);
+            return 0;
+        }
+
+        int ident = sw.ident;
+        int rawsock = openIcmpSocket(&kind, &ident);
+        if (rawsock == -1)
+        {
+            fprintf(stderr, "socket() failed with error: %d\n", errno);
+            fprintf(stderr, "To create a raw socket, the process needs to be run by Admin/root user.\n");
+            fprintf(stderr, "To create a ping socket, the process' group must be in net.ipv4.ping_group_range.\n\n");
+            sweep_free(&sw);
+            return -1;
+        }
+
+        sw.ident = ident;
+        sw.dgram = kind == ICMP_SOCK_DGRAM;
+
+        int status = sweep_run(&sw, rawsock);
+
+        close(rawsock);
+        sweep_free(&sw);
+
+        return status;
+    }
+
+    sweep_free(&sw);
+
     // If we have an incorrect number of arguments, we print an error message and exit the program.
 
-    if (argnum != 2)
+    if (argnum - optind != 1)
     {
         printf("Invalid number of arguments when executing. Correct usage: ./ping <destination_ip>\n");
         return 0;
     }
     
     char ip[INET_ADDRSTRLEN];
-    strcpy(ip, argt[1]);
+    strcpy(ip, argt[optind]);
     
     struct in_addr pingaddr;
 
@@ -54,161 +275,357 @@ int main(int argnum, char *argt[])
     address.sin_addr.s_addr = inet_addr(ip);
 
 
-    // Next, we create a raw socket which will be used to transfer the ping in ICMP Protocol to the given ip.
+    // Next, we create the socket which will be used to transfer the ping in ICMP Protocol to the given ip:
+    // a ping socket if we are allowed one, or a raw socket. A ping socket gets its ICMP id from the kernel,
+    // and only the replies carrying that id are delivered to it.
+
+    int ident = processIdent();    // The ICMP id of this process, so our replies can be told apart from other pingers' replies.
 
     int rawsock = -1;;
-    if ((rawsock = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP)) == -1)
+    if ((rawsock = openIcmpSocket(&kind, &ident)) == -1)
     {
         fprintf(stderr, "socket() failed with error: %d\n", errno);
-        fprintf(stderr, "To create a raw socket, the process needs to be run by Admin/root user.\n\n");
+        fprintf(stderr, "To create a raw socket, the process needs to be run by Admin/root user.\n");
+        fprintf(stderr, "To create a ping socket, the process' group must be in net.ipv4.ping_group_range.\n\n");
         return -1;
     }
 
+    int ipHeader = kind == ICMP_SOCK_RAW;    // Only a raw socket hands us the IP header of the replies.
+
+    // A raw socket would wake us up for every ICMP packet on the host, so we ask the kernel to drop everything but the replies from our destination.
+    // Without the filter we still work, just with more wakeups.
+
+    if (ipHeader && attachReplyFilter(rawsock, ident, &address.sin_addr, 1) == -1)
+    {
+        printf("Attaching the socket filter failed with error: %d, filtering in userspace only.\n", errno);
+    }
+
+    // The socket is non-blocking: we wait for replies with ppoll(), so we can keep sending while earlier probes are still in flight.
+
+    if (fcntl(rawsock, F_SETFL, fcntl(rawsock, F_GETFL, 0) | O_NONBLOCK) == -1)
+    {
+        printf("Setting rawsock to be non-blocking failed, closing program.\n");
+        close(rawsock);
+        return -1;
+    }
+
+    // We ask the kernel to timestamp our packets when they leave and arrive, so the RTT reflects the wire and not our scheduling.
+
+    int stamping = enableTimestamps(rawsock);
+
     // We now intialize the variables below:
 
     int seq = 0;                   // We set a sequence counter to 0, which will be used to identify the ICMP packets sent by this program.
-    char pac[IP_MAXPACKET];        // We also create a buffer which will contain the ICMP packet.
-    float time = 0;                // Lastly, we create a variable which will contain the time it took to get a reply from the destination.
+    int64_t rtt = 0;               // We create a variable which will contain the time (in nanoseconds) it took to get a reply from the destination.
+    struct stats st;               // Lastly, the statistics of all the replies so far.
 
-    // We now begin a loop of sending ICMP ping packets to the destination, and receiving replies from it.
+    statsInit(&st);
+
+    // The echo request is built once. Each probe only patches its sequence number and send time (and the checksum) into it.
+
+    struct packet_template tmpl;
+    if (makeTemplate(&tmpl, ident, size, pattern, patternLen) == -1)
+    {
+        printf("Out of memory.\n");
+        close(rawsock);
+        return -1;
+    }
+
+    // The in-flight table holds every outstanding probe, keyed by its destination and sequence number (see inflight.h).
+    // It is allocated once, for the whole window.
+
+    struct inflight_table inflight;
+    if (inflightInit(&inflight, window) == -1)
+    {
+        printf("Out of memory.\n");
+        freeTemplate(&tmpl);
+        close(rawsock);
+        return -1;
+    }
+
+    // We also take a buffer for the replies from a pool (see buf_pool.h). It only has to fit our own reply and the longest IP header,
+    // since anything longer is not a reply of ours - so it stays in cache, and is reused as it is from reply to reply.
+
+    struct buf_pool replies;
+    if (poolInit(&replies, 1, tmpl.len + IP4_MAXHDRLEN) == -1)
+    {
+        printf("Out of memory.\n");
+        inflightFree(&inflight);
+        freeTemplate(&tmpl);
+        close(rawsock);
+        return -1;
+    }
 
-    printf("Pinging the address: %s\n", ip);
+    char *pac = poolGet(&replies);
 
-    while(1)
+    // With -E uring, the io_uring engine takes it from here, with the same socket, template, in-flight table and statistics.
+
+    if (useUring)
     {
-        // We used the sleep() method to wait 1 second between each ping, just for making the printout more readable.
-        
-        sleep(1);
-        
-        // We first create the ICMP packet, and get its length.
+        printf("Pinging the address: %s (%s socket, %s timestamps, io_uring)\n", ip, ipHeader ? "raw" : "ping",
+               stamping == TSTAMP_RXTX ? "kernel RX/TX" : stamping == TSTAMP_RX ? "kernel RX" : "userspace");
+
+        struct uring_ping up;
+        memset(&up, 0, sizeof(up));
+        up.sock = rawsock;
+        up.address = address;
+        up.ip = ip;
+        up.ident = ident;
+        up.ipHeader = ipHeader;
+        up.stamping = stamping;
+        up.tmpl = &tmpl;
+        up.inflight = &inflight;
+        up.st = &st;
+        up.interval_ns = interval_ns;
+        up.timeout_ns = timeout_ns;
+        up.period_ns = period_ns;
+        up.count = count;
+        up.window = window;
+
+        int status = uringPing(&up);
+
+        statsPrint(&st, ip);
+        printf("--- %lu io_uring_enter() calls for %lu probes ---\n", (unsigned long)up.enterCalls, (unsigned long)st.sent);
+        printf("Closing socket, goodbye!.\n");
+
+        inflightFree(&inflight);
+        poolFree(&replies);
+        freeTemplate(&tmpl);
+        close(rawsock);
+
+        return status;
+    }
 
-        int len = makePacket(seq, pac);
+    struct pollfd fds;
+    fds.fd = rawsock;
+    fds.events = POLLIN;
+    fds.revents = 0;        // The loop looks at it before the first ppoll() has run.
 
-        // For each packet sent, we track the time of sending it and getting a reply from the destination.
-        // We use the gettimeofday() function to get the time in seconds and microseconds.
+    uint64_t nextSend = monotonicNs();    // When the next probe is due.
+    uint64_t nextSummary = nextSend + period_ns;
 
-        struct timeval start, end;
-        gettimeofday(&start, 0);
+    // We now begin a loop of sending ICMP ping packets to the destination, and receiving replies from it.
 
-        // We use the sendto() function to send the packet to the destination.
+    printf("Pinging the address: %s (%s socket, %s timestamps)\n", ip, ipHeader ? "raw" : "ping",
+           stamping == TSTAMP_RXTX ? "kernel RX/TX" : stamping == TSTAMP_RX ? "kernel RX" : "userspace");
 
-        int send = sendto(rawsock, pac, len, 0, (struct sockaddr *)&address, sizeof(address));
-        if (send == -1)
+    while (!statsStopRequested())
+    {
+        uint64_t now = monotonicNs();
+
+        // Probes that waited longer than the timeout are counted as lost, which frees their room in the window for the next probe.
+        // They expire in the order they were sent, so only the oldest ones are ever looked at.
+
+        struct in_addr lostAddr;
+        uint32_t lostSeq = 0;
+
+        while (inflightExpire(&inflight, now > timeout_ns ? now - timeout_ns : 0, &lostAddr, &lostSeq) == 1)
         {
-            printf("Sending packet failed with error: %d\n", errno);
-            return -1;
+            printf("-- Request timeout for seq = %u.\n", lostSeq);
+            statsLost(&st);
         }
 
-        // We now clear the packet buffer receiving a reply from the destination.
+        // Once we sent all the probes we were asked for and every one of them was answered or lost, we are done.
 
-        bzero(pac, IP_MAXPACKET);
+        if (count > 0 && seq >= count && inflightCount(&inflight) == 0)
+        {
+            break;
+        }
+
+        int sentNow = 0;
+        int full = 0;       // Whether the table turned a probe away, and we wait for one to be answered or lost - as with a full window.
 
-        socklen_t addlen = sizeof(address);
-        
-        // We now begin a receiving loop, which will only break when we get a reply from the destination.
-        // The continuation rule is: As long as we can receive packets, we will continue to do so.
+        // Send every probe that is due, as long as there is room in the window.
 
-        ssize_t recv = -1;
-        while ( recv = recvfrom(rawsock, pac, sizeof(pac), 0, (struct sockaddr *)&address, &addlen) )   // If we got a reply, we break the loop. 
+        while (inflightCount(&inflight) < (uint64_t)window && nextSend <= now && (count == 0 || seq < count))
         {
-            if (recv > 0)
-            {   
-                break;     // If we got a reply, we break the loop.
+            // We first patch the sequence number and the send time into the template - it is the packet we send.
+            // The probe is in the table before it leaves, since a fast reply may be waiting as soon as sendto() returns.
+
+            struct tstamp sent;
+            stampNow(&sent);
+            patchPacket(&tmpl, tmpl.data, ident, seq, sent.mono);
+
+            if (inflightInsert(&inflight, address.sin_addr, ident, seq, sent.mono) == -1)
+            {
+                full = 1;
+                break;
             }
 
-            
+            // We use the sendto() function to send the packet to the destination, and remember when we sent it.
+
+            int send = sendto(rawsock, tmpl.data, tmpl.len, 0, (struct sockaddr *)&address, sizeof(address));
+            if (send == -1)
+            {
+                struct tstamp unsent;
+                inflightTake(&inflight, address.sin_addr, ident, seq, &unsent);
+
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+                {
+                    break;      // The send buffer is full, we will try again once we drained some replies.
+                }
+
+                printf("Sending packet failed with error: %d\n", errno);
+                inflightFree(&inflight);
+                poolFree(&replies);
+                freeTemplate(&tmpl);
+                close(rawsock);
+                return -1;
+            }
+
+            statsSent(&st);
+
+            seq++;
+            sentNow++;
+            nextSend += interval_ns;
         }
 
-        // We now get the end time of receiving the reply from the destination, and calculate the time it took to get the reply.
+        // The kernel's TX timestamps come back on the socket's error queue, keyed by the order the packets were sent in -
+        // which is their sequence number, since only successful sends are counted.
+        // A fast reply (on loopback, it is queued before sendto() even returns) may be waiting already,
+        // so after sending we collect the timestamps before the replies, without waiting for POLLERR.
 
-        gettimeofday(&end, 0);
+        if (stamping == TSTAMP_RXTX && ((fds.revents & POLLERR) || sentNow > 0))
+        {
+            uint32_t key = 0;
+            uint64_t txStamp = 0;
 
-        float milliseconds = (end.tv_sec - start.tv_sec) * 1000.0f + (end.tv_usec - start.tv_usec) / 1000.0f;
-        unsigned long microseconds = (end.tv_sec - start.tv_sec) * 1000.0f + (end.tv_usec - start.tv_usec);
-        time = (end.tv_sec - start.tv_sec) * 1000.0f + (end.tv_usec - start.tv_usec) / 1000.0f;
-    
-        // We will now print data about the reply we got from the destination.
+            while (recvTxStamp(rawsock, &key, &txStamp) == 1)
+            {
+                inflightSetKernel(&inflight, address.sin_addr, key, txStamp);
+            }
+        }
 
-        printf("-- Reply from %s : seq = %d, bytes = %ld, time = %.3f ms.\n", ip, seq, recv, time);
+        fds.revents = 0;
 
-        // We now increment the sequence counter, and clear the packet buffer for the next iteration of the loop, if any occur.
+        // We now drain every datagram the socket has for us, and match echo replies to their probes by sequence number.
+        // The raw socket sees every ICMP packet on the host, so anything else (other pingers' replies,
+        // our own echo requests on loopback, replies to probes we already gave up on) is skipped.
+        // The reply carries its full sequence number and send time in the payload, so the RTT is computed from the reply itself -
+        // the in-flight table is only needed to count the losses and to hold the kernel's TX timestamps.
 
-        seq++;
-        bzero(pac, IP_MAXPACKET);
-    }
+        while (1)
+        {
+            struct sockaddr_in from;
+            struct tstamp end;
+            ssize_t recv = recvStamped(rawsock, pac, replies.slab, &from, &end);
+
+            if (recv == -1)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                {
+                    break;
+                }
+
+                printf("Receiving packet failed with error: %d\n", errno);
+                inflightFree(&inflight);
+                poolFree(&replies);
+                freeTemplate(&tmpl);
+                close(rawsock);
+                return -1;
+            }
 
-    // If we broke the loop, it means we didn't receive a reply propperly.
-    // Therefore, we close the socket and exit the program.
+            struct icmp *reply = NULL;
+            int icmplen = -1;
 
-    printf("Closing socket, goodbye!.\n");
+            if (from.sin_addr.s_addr != address.sin_addr.s_addr || (icmplen = parseReply(pac, recv, ipHeader, ident, NULL, &reply)) == -1)
+            {
+                continue;
+            }
 
-    close(rawsock);
+            uint32_t replySeq = 0;
+            uint64_t sentNs = 0;
 
-    return 0;
-}
+            if (parsePayload(&tmpl, reply, icmplen, &replySeq, &sentNs) == -1)
+            {
+                printf("-- Corrupted reply from %s : seq = %d, bytes = %ld.\n", ip, ntohs(reply->icmp_seq), recv);
+                statsCorrupted(&st);
+                continue;
+            }
 
+            // Only a probe still in flight is answered - a duplicate, or a reply to a probe we already gave up on, is skipped.
 
-// # The Functions #
+            int fullSeq = (int)replySeq;
+            struct tstamp sent;
 
-//// calculate_checksum() - is used for calculating checksum of the packet, which is inserted in the ICMP header.
+            if (inflightTake(&inflight, from.sin_addr, ident, replySeq, &sent) == 0)
+            {
+                continue;
+            }
 
-unsigned short calculate_checksum(unsigned short *paddress, int len)
-{
-    int nleft = len;
-    int sum = 0;
-    unsigned short *w = paddress;
-    unsigned short answer = 0;
+            struct tstamp start = { sent.kernel, sentNs };    // the kernel's TX timestamp if we got one, otherwise the send time in the payload
+            rtt = stampDiff(&start, &end);
+            statsReply(&st, rtt);
 
-    while (nleft > 1)
-    {
-        sum += *w++;
-        nleft -= 2;
-    }
+            // We will now print data about the reply we got from the destination.
 
-    if (nleft == 1)
-    {
-        *((unsigned char *)&answer) = *((unsigned char *)w);
-        sum += answer;
-    }
+            printf("-- Reply from %s : seq = %d, bytes = %ld, time = %.3f ms.\n", ip, fullSeq, recv, rtt / 1e6);
+        }
 
-    // add back carry outs from top 16 bits to low 16 bits
-    sum = (sum >> 16) + (sum & 0xffff); // add hi 16 to low 16
-    sum += (sum >> 16);                 // add carry
-    answer = ~sum;                      // truncate to 16 bits
+        // Print the statistics so far, if it is time to.
 
-    return answer;
-}
+        now = monotonicNs();
+
+        if (period_ns > 0 && now >= nextSummary)
+        {
+            statsPrint(&st, ip);
+            nextSummary += period_ns;
+        }
 
+        // Sleep until the next probe is due, the oldest probe times out or a reply arrives - whichever comes first.
 
-//// makePacket() - creates the packet meant to be sent to the destination.
+        uint64_t wake = now + timeout_ns;
 
-int makePacket(int seq, char *pac)
-{
-    // Creating the parts of the ICMP header and adding it to the packet:
-    
-    struct icmp header;
+        if (count > 0 && seq >= count)
+        {
+            // Nothing more to send, we are only waiting for the last replies.
+        }
+        else if (!full && inflightCount(&inflight) < (uint64_t)window)
+        {
+            wake = nextSend;
+        }
+        else if (nextSend < now)
+        {
+            nextSend = now;     // A full window held the next probe back - don't make up for it with a burst once a slot frees.
+        }
 
-    header.icmp_type = ICMP_ECHO;         // Message Type (Consists of 8 bits)      - the type of the message, which in our case is an echo message.
-    header.icmp_code = 0;                 // Message Code (Consists of 8 bits)      - 0 represents the package is an echo request.
-    header.icmp_id = 18;                  // Message ID (Consists of 16 bits)       - helps the receiver to identify the full message created by the packets.
-    header.icmp_seq = 0;                  // Message Sequence (Consists of 16 bits) - keeps track of the numbers and order of packets sent
-    header.icmp_cksum = 0;                // Checksum (Consists of 16 bits)         - used to verify the integrity of the packet (Will be calculated later)
+        uint64_t oldestSent = 0;
 
-    memcpy(pac, &header, ICMP_HDRLEN);    // Copying the ICMP header to the packet.
+        if (inflightOldest(&inflight, &oldestSent) && oldestSent + timeout_ns < wake)
+        {
+            wake = oldestSent + timeout_ns;
+        }
 
-    // Adding the data to the packet:
+        if (period_ns > 0 && nextSummary < wake)
+        {
+            wake = nextSummary;
+        }
 
-    char data[IP_MAXPACKET] = "Ping!";     // Setting the data to be sent.
-    int len = strlen(data) + 1;            
+        if (wake > now)
+        {
+            struct timespec ts;
+            ts.tv_sec = (wake - now) / 1000000000ull;
+            ts.tv_nsec = (wake - now) % 1000000000ull;
+
+            if (ppoll(&fds, 1, &ts, NULL) == -1 && errno != EINTR)
+            {
+                printf("Error : ppoll() failed with error: %d\n", errno);
+                break;
+            }
+        }
+    }
 
-    memcpy(pac + ICMP_HDRLEN, data, len);  // Copying the data to the packet right after the ICMP header.
+    // We broke the loop - either we were asked to stop, sent all the probes, or something failed.
+    // Therefore, we print the statistics, close the socket and exit the program.
 
-    // Calculate the checksum and add it to the packet:
+    statsPrint(&st, ip);
+    printf("Closing socket, goodbye!.\n");
 
-    header.icmp_cksum = calculate_checksum((unsigned short *)(pac), ICMP_HDRLEN + len);
-    memcpy(pac, &header, ICMP_HDRLEN);
+    inflightFree(&inflight);
+    poolFree(&replies);
+    freeTemplate(&tmpl);
+    close(rawsock);
 
-    // We return the number of bytes used in the packet.
+    return 0;
+}
 
-    return ICMP_HDRLEN + len;
-}
\ No newline at end of file
@@ -0,0 +1,384 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "checksum.h"
+#include "icmp_util.h"
+#include "inflight.h"
+#include "pcap_reader.h"
+#include "stats.h"
+
+#define default_window (1 << 18)    // the most echo requests that may wait for their reply at once, unless told otherwise
+#define max_window (1 << 26)
+
+// To execute the program, run it from the command line with the following syntax: ./replay <capture.pcap | capture.pcapng>
+//     ./replay [-W timeout_seconds] [-w window] [-S summary_seconds] [-v] <capture_file>
+// It reads a capture of ping traffic (from tcpdump, dumpcap or Wireshark, in pcap or pcapng) and prints the statistics the pingers would have:
+// every echo request is paired with the echo reply that has the same address, id and sequence number, and its RTT is the time between the two
+// in the capture. A request that isn't answered within -W seconds (of capture time) is counted as lost.
+// The file is read in one pass, in the same memory however large it is: at most -w requests are kept while they wait for their reply,
+// and once that many are waiting, the oldest one is counted as lost to make room.
+// -S prints the statistics every that many seconds of capture time, and -v prints every reply and timeout, as ping does.
+
+struct replay
+{
+    struct inflight_table inflight;    // the requests waiting for their reply
+    struct stats st;                   // the statistics of all the replies so far
+    uint64_t timeout;                  // how long a request waits for its reply, in nanoseconds
+    uint64_t window;                   // the most requests that may wait at once
+    int verbose;                       // whether to print every reply and timeout
+    uint64_t packets;                  // the packets read from the file
+    uint64_t replies;                  // the echo replies seen
+    uint64_t unmatched;                // the echo replies no request was waiting for (duplicates, late ones, or their request wasn't captured)
+    uint64_t duplicates;               // the echo requests seen again while the first copy was still waiting
+    uint64_t evicted;                  // the requests counted as lost because the window was full
+};
+
+// # Function Headers #
+
+static const unsigned char *findIpv4(const struct pcap_packet *pkt, uint32_t *len);
+static void expire(struct replay *rp, uint64_t now);
+static void onRequest(struct replay *rp, struct in_addr to, uint16_t id, uint16_t seq, uint64_t time);
+static void onReply(struct replay *rp, struct in_addr from, uint16_t id, uint16_t seq, uint64_t time, int corrupted);
+
+
+int main(int argnum, char *argt[])
+{
+    // First, we check for errors regarding the execution of the program:
+
+    double timeout = 1.0;          // seconds to wait for a reply
+    double period = 0;             // seconds of capture time between two statistics summaries (0 - only at the end)
+    int window = default_window;
+    int verbose = 0;
+    int opt;
+
+    while ((opt = getopt(argnum, argt, "W:w:S:v")) != -1)
+    {
+        switch (opt)
+        {
+            case 'W': timeout = atof(optarg); break;
+            case 'w': window = atoi(optarg);  break;
+            case 'S': period = atof(optarg);  break;
+            case 'v': verbose = 1;            break;
+            default:
+                printf("Correct usage: ./replay [-W timeout_seconds] [-w window] [-S summary_seconds] [-v] <capture_file>\n");
+                return 0;
+        }
+    }
+
+    if (optind != argnum - 1)
+    {
+        printf("Correct usage: ./replay [-W timeout_seconds] [-w window] [-S summary_seconds] [-v] <capture_file>\n");
+        return 0;
+    }
+
+    if (timeout <= 0 || period < 0)
+    {
+        printf("The timeout must be positive.\n");
+        return 0;
+    }
+
+    if (window < 1 || window > max_window)
+    {
+        printf("The window must be between 1 and %d requests.\n", max_window);
+        return 0;
+    }
+
+    const char *path = argt[optind];
+    struct pcap_reader reader;
+
+    if (pcapOpen(&reader, path) == -1)
+    {
+        printf("Reading %s failed: %s.\n", path, reader.error);
+        return -1;
+    }
+
+    // The in-flight table is allocated once, for the whole window - it is the only memory that depends on the options, and none depends on the file.
+
+    struct replay rp;
+    memset(&rp, 0, sizeof(rp));
+    rp.timeout = (uint64_t)(timeout * 1e9);
+    rp.window = window;
+    rp.verbose = verbose;
+    statsInit(&rp.st);
+
+    if (inflightInit(&rp.inflight, window) == -1)
+    {
+        printf("Out of memory.\n");
+        pcapClose(&reader);
+        return -1;
+    }
+
+    // Ctrl+C stops the replay gracefully, so the statistics so far can still be printed.
+
+    statsCatchSigint();
+
+    printf("Replaying the capture: %s (%s)\n", path, reader.ng ? "pcapng" : "pcap");
+
+    uint64_t period_ns = (uint64_t)(period * 1e9);
+    uint64_t nextSummary = 0;
+    uint64_t last = 0;
+    struct pcap_packet pkt;
+
+    while (pcapNext(&reader, &pkt) && !statsStopRequested())
+    {
+        rp.packets++;
+        last = pkt.time;
+
+        // Requests whose time ran out by the time of this packet are lost - the capture's clock drives the timeouts, not ours.
+
+        expire(&rp, pkt.time);
+
+        if (period_ns > 0)
+        {
+            if (nextSummary == 0)
+            {
+                nextSummary = pkt.time + period_ns;
+            }
+            else if (pkt.time >= nextSummary)
+            {
+                statsPrint(&rp.st, path);
+                nextSummary += period_ns;
+            }
+        }
+
+        // We now find the ICMP message in the packet. Fragments other than the first one carry no ICMP header.
+
+        uint32_t len = 0;
+        const unsigned char *pac = findIpv4(&pkt, &len);
+
+        if (pac == NULL || len < IP4_HDRLEN)
+        {
+            continue;
+        }
+
+        struct ip iphdr;
+        memcpy(&iphdr, pac, IP4_HDRLEN);
+
+        uint32_t iplen = iphdr.ip_hl * 4;
+
+        if (iphdr.ip_v != 4 || iphdr.ip_p != IPPROTO_ICMP || iplen < IP4_HDRLEN || len < iplen + ICMP_HDRLEN
+            || (ntohs(iphdr.ip_off) & IP_OFFMASK) != 0)
+        {
+            continue;
+        }
+
+        struct icmp header;
+        memcpy(&header, pac + iplen, ICMP_HDRLEN);
+
+        if (header.icmp_code != 0)
+        {
+            continue;
+        }
+
+        if (header.icmp_type == ICMP_ECHO)
+        {
+            onRequest(&rp, iphdr.ip_dst, ntohs(header.icmp_id), ntohs(header.icmp_seq), pkt.time);
+        }
+        else if (header.icmp_type == ICMP_ECHOREPLY)
+        {
+            // The checksum can only be checked when the whole message was captured (and not cut short by the snap length),
+            // and the packet wasn't split into fragments.
+
+            int total = ntohs(iphdr.ip_len);
+            int corrupted = 0;
+
+            if (!(ntohs(iphdr.ip_off) & IP_MF) && total >= (int)iplen + ICMP_HDRLEN && (uint32_t)total <= len)
+            {
+                corrupted = calculate_checksum((unsigned short *)(pac + iplen), total - iplen) != 0;
+            }
+
+            onReply(&rp, iphdr.ip_src, ntohs(header.icmp_id), ntohs(header.icmp_seq), pkt.time, corrupted);
+        }
+    }
+
+    // Requests that ran out of time by the end of the capture are lost; the ones sent shortly before it ended are left in flight.
+
+    expire(&rp, last);
+
+    if (reader.error != NULL)
+    {
+        printf("The capture ended early: %s.\n", reader.error);
+    }
+
+    statsPrint(&rp.st, path);
+    printf("--- %lu packets read, %lu echo replies, %lu unmatched replies, %lu duplicate requests, %lu requests dropped from a full window, %lu blocks skipped ---\n",
+           (unsigned long)rp.packets, (unsigned long)rp.replies, (unsigned long)rp.unmatched, (unsigned long)rp.duplicates,
+           (unsigned long)rp.evicted, (unsigned long)reader.skipped);
+
+    inflightFree(&rp.inflight);
+    pcapClose(&reader);
+
+    return 0;
+}
+
+
+//// findIpv4() - finds the IPv4 packet inside a captured frame, by its link type. Returns the IPv4 header and the bytes captured from it in '*len',
+//// or NULL if the frame doesn't carry IPv4 (or its link type is one we don't know).
+
+static const unsigned char *findIpv4(const struct pcap_packet *pkt, uint32_t *len)
+{
+    const unsigned char *p = pkt->data;
+    uint32_t caplen = pkt->caplen;
+    uint32_t skip = 0;
+    uint16_t proto = 0;
+
+    switch (pkt->linktype)
+    {
+        case PCAP_LINK_ETHERNET:
+            // The EtherType follows the two MAC addresses, after any VLAN tags (802.1Q and 802.1ad).
+
+            skip = 12;
+
+            while (skip + 2 <= caplen)
+            {
+                proto = (uint16_t)(p[skip] << 8 | p[skip + 1]);
+                skip += 2;
+
+                if (proto != 0x8100 && proto != 0x88a8)
+                {
+                    break;
+                }
+
+                skip += 2;
+            }
+
+            break;
+        case PCAP_LINK_LINUX_SLL:
+            if (caplen < 16)
+            {
+                return NULL;
+            }
+
+            proto = (uint16_t)(p[14] << 8 | p[15]);
+            skip = 16;
+            break;
+        case PCAP_LINK_LINUX_SLL2:
+            if (caplen < 20)
+            {
+                return NULL;
+            }
+
+            proto = (uint16_t)(p[0] << 8 | p[1]);
+            skip = 20;
+            break;
+        case PCAP_LINK_NULL:
+            // The address family is in the byte order of the host that captured the packet, and AF_INET is 2 everywhere.
+
+            if (caplen < 4)
+            {
+                return NULL;
+            }
+
+            proto = (p[0] == 2 && p[3] == 0) || (p[3] == 2 && p[0] == 0) ? 0x0800 : 0;
+            skip = 4;
+            break;
+        case PCAP_LINK_RAW:
+        case PCAP_LINK_IPV4:
+            proto = 0x0800;
+            break;
+        default:
+            return NULL;
+    }
+
+    if (proto != 0x0800 || skip > caplen)
+    {
+        return NULL;
+    }
+
+    *len = caplen - skip;
+
+    return p + skip;
+}
+
+
+//// expire() - counts the requests that waited longer than the timeout by 'now' as lost.
+
+static void expire(struct replay *rp, uint64_t now)
+{
+    struct in_addr addr;
+    uint32_t key = 0;
+
+    while (inflightExpire(&rp->inflight, now > rp->timeout ? now - rp->timeout : 0, &addr, &key) == 1)
+    {
+        if (rp->verbose)
+        {
+            printf("-- Request timeout for %s : id = %u, seq = %u.\n", inet_ntoa(addr), key >> 16, key & 0xffff);
+        }
+
+        statsLost(&rp->st);
+    }
+}
+
+
+//// onRequest() - starts waiting for the reply to an echo request. The in-flight table is keyed by the destination and a 32-bit sequence number,
+//// so the id goes in the upper half of it - two pingers to the same host never share a key.
+
+static void onRequest(struct replay *rp, struct in_addr to, uint16_t id, uint16_t seq, uint64_t time)
+{
+    uint32_t key = (uint32_t)id << 16 | seq;
+
+    // The same request may be captured twice (on the 'any' interface, or when it is retransmitted) - only its first copy counts.
+
+    if (inflightContains(&rp->inflight, to, id, key))
+    {
+        rp->duplicates++;
+        return;
+    }
+
+    // When the window is full, the oldest request makes room. It is counted as lost - its reply may still come, but there's nowhere to keep it.
+    // Only requests still waiting fill the window: the answered ones behind the oldest never hold room in the table.
+
+    struct in_addr addr;
+    uint32_t oldest = 0;
+
+    while (inflightCount(&rp->inflight) >= rp->window && inflightExpire(&rp->inflight, UINT64_MAX, &addr, &oldest) == 1)
+    {
+        statsLost(&rp->st);
+        rp->evicted++;
+    }
+
+    inflightInsert(&rp->inflight, to, id, key, time);      // the table was made for the window, so there is room now
+
+    statsSent(&rp->st);
+}
+
+
+//// onReply() - pairs an echo reply with the request it answers, and folds its RTT into the statistics.
+
+static void onReply(struct replay *rp, struct in_addr from, uint16_t id, uint16_t seq, uint64_t time, int corrupted)
+{
+    rp->replies++;
+
+    // A corrupted reply doesn't answer the request - it keeps waiting for a good one, as in the pingers.
+
+    if (corrupted)
+    {
+        statsCorrupted(&rp->st);
+        return;
+    }
+
+    struct tstamp sent;
+
+    if (inflightTake(&rp->inflight, from, id, (uint32_t)id << 16 | seq, &sent) == 0)
+    {
+        rp->unmatched++;
+        return;
+    }
+
+    // The clocks of two interfaces may disagree a little, so a reply captured "before" its request counts as an RTT of zero.
+
+    int64_t rtt = time > sent.mono ? (int64_t)(time - sent.mono) : 0;
+
+    if (rp->verbose)
+    {
+        printf("-- Reply from %s : id = %u, seq = %u, time = %.3f ms.\n", inet_ntoa(from), id, seq, rtt / 1e6);
+    }
+
+    statsReply(&rp->st, rtt);
+}
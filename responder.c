@@ -0,0 +1,825 @@
+#define _GNU_SOURCE    // ppoll(), sendmmsg(), SO_RCVBUFFORCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch_io.h"
+#include "buf_pool.h"
+#include "checksum.h"
+#include "filter.h"
+#include "icmp_util.h"
+#include "packet_ring.h"
+#include "timerwheel.h"
+#include "tstamp.h"
+
+#define default_queue 16384           // the most replies held back at once, unless told otherwise
+#define default_reorder_ms 1.0        // how much longer a reordered reply is held back, unless told otherwise
+#define default_rcvbuf (8 << 20)      // the receive buffer we ask for on the raw socket, unless told otherwise
+#define ring_timeout_ms 1             // how soon the packet ring hands over a block that isn't full
+#define tick_ns 1000                  // the timer wheel's tick: a microsecond
+#define echo_sysctl "/proc/sys/net/ipv4/icmp_echo_ignore_all"
+
+// A userspace ICMP echo responder, for load-testing the pingers without the kernel's own echo replies in the way.
+// It reads the echo requests off a raw ICMP socket in batches (recvmmsg()), or off a TPACKET_V3 ring on an interface (-I, see packet_ring.h),
+// and sends the replies in batches (sendmmsg()) on an IPPROTO_RAW socket, with the IP header built by us - so every reply comes from
+// the address its request was sent to, and a sweep over a whole range can be answered by one responder.
+//
+// Every reply can be made to misbehave: dropped (-l), held back by a delay drawn from a distribution (-d), or held back longer so the
+// replies after it overtake it (-o). The delay counts from when the kernel received the request, so the time we take to read it doesn't add to it.
+// The held replies wait in a timer wheel with microsecond ticks (see timerwheel.c), in buffers from a pool (see buf_pool.c).
+//
+// By default the kernel keeps answering echo requests alongside us, so the pinger sees its reply too (as a duplicate, or first).
+// -K tells the kernel to stop (net.ipv4.icmp_echo_ignore_all, for our whole network namespace) while we run, and puts the old setting back
+// on the way out - but a crash or SIGKILL leaves it set, and every ping to the namespace goes unanswered. So only use -K inside a throwaway
+// namespace (e.g. 'unshare -n', or behind the veth of bench/netem_bench.sh), never on the host.
+//
+// To execute the program (needs root, for the raw sockets):
+//     ./responder [-I iface] [-b batch] [-d delay] [-l loss_percent] [-o reorder_percent] [-O reorder_ms] [-q queue] [-R rcvbuf_bytes] [-S summary_seconds] [-s seed] [-K]
+// -d takes a distribution, in milliseconds: "fixed:5" (or just "5"), "uniform:1:10", "normal:5:1" (mean:stddev), "exp:5" (mean),
+// or "pareto:2:1.5" (minimum:shape). Negative draws are treated as 0.
+// -q bounds how many replies may be held back at once - a request that finds the queue full goes unanswered.
+
+enum delay_kind
+{
+    DELAY_NONE = 0,
+    DELAY_FIXED,
+    DELAY_UNIFORM,
+    DELAY_NORMAL,
+    DELAY_EXP,
+    DELAY_PARETO
+};
+
+struct delay_dist
+{
+    int kind;                         // one of the delay_kind values
+    double a;                         // the first parameter, in nanoseconds
+    double b;                         // the second one, in nanoseconds (pareto: the shape)
+};
+
+struct responder;
+
+// A reply held back until it is due. It lives in a slab of the responder's pool.
+
+struct held_reply
+{
+    struct tw_timer timer;            // fires when the reply is due
+    struct responder *rs;
+    struct in_addr to;                // where the reply goes
+    uint32_t len;                     // the length of the reply, IP header included
+    char pac[];                       // the reply
+};
+
+struct responder
+{
+    int rxsock;                       // the raw ICMP socket the requests are read from (-1 with a ring)
+    int txsock;                       // the IPPROTO_RAW socket the replies are sent on
+    const char *iface;                // the interface of the ring (NULL - the raw socket)
+    struct packet_ring ring;
+    struct batch rx;                  // the requests of one recvmmsg() call
+    struct batch tx;                  // the replies of the next sendmmsg() call
+    int pending;                      // how many replies 'tx' holds
+    struct buf_pool held;             // the buffers of the replies held back
+    struct timer_wheel wheel;         // the replies held back, by when they are due (in microseconds of CLOCK_MONOTONIC)
+    struct delay_dist delay;
+    double loss;                      // the share of the requests we leave unanswered (0..1)
+    double reorder;                   // the share of the replies we hold back longer (0..1)
+    uint64_t reorderNs;               // by how much longer
+    uint64_t rng;                     // the state of the random number generator
+    uint64_t requests;                // the echo requests we read
+    uint64_t answered;                // the replies we sent
+    uint64_t lost;                    // the requests we left unanswered on purpose
+    uint64_t reordered;               // the replies we held back longer on purpose
+    uint64_t queueFull;               // the requests we left unanswered because the queue was full
+    uint64_t ignored;                 // the packets that weren't echo requests we can answer (malformed, fragmented or too big)
+    uint64_t sendFailed;              // the replies the kernel refused to send
+    uint64_t sendCalls;
+    uint64_t recvCalls;
+};
+
+static volatile sig_atomic_t stop = 0;
+
+// # Function Headers #
+
+static void onStopSignal(int sig);
+static int parseDelay(const char *spec, struct delay_dist *d);
+static uint64_t nextRandom(uint64_t *state);
+static double uniform(uint64_t *state);
+static uint64_t sampleDelay(struct responder *rs);
+static int requestLength(const unsigned char *pac, uint32_t len, int *iplen);
+static int buildReply(const unsigned char *req, int iplen, int icmplen, char *out, struct in_addr *to);
+static void handleRequest(struct responder *rs, const unsigned char *pac, uint32_t len, uint64_t arrived, uint64_t now);
+static void onDue(struct tw_timer *timer, void *data);
+static void flushReplies(struct responder *rs);
+static int receiveRaw(struct responder *rs, int64_t offset);
+static int receiveRing(struct responder *rs, int64_t offset);
+static void printCounters(struct responder *rs);
+static int quietKernel(void);
+static void restoreKernel(int saved);
+
+
+// # The Functions #
+
+int main(int argnum, char *argt[])
+{
+    struct responder rs;
+    memset(&rs, 0, sizeof(rs));
+    rs.rxsock = -1;
+    rs.txsock = -1;
+    rs.ring.fd = -1;
+
+    int batch = BATCH_DEFAULT;
+    int queue = default_queue;
+    int rcvbuf = default_rcvbuf;
+    double reorderMs = default_reorder_ms;
+    double period = 0;                 // seconds between two counter summaries (0 - only at the end)
+    int quiet = 0;                     // whether the kernel stops answering echo requests while we run
+    uint64_t seed = 0;
+    int opt;
+
+    while ((opt = getopt(argnum, argt, "I:b:d:l:o:O:q:R:S:s:K")) != -1)
+    {
+        switch (opt)
+        {
+            case 'I': rs.iface = optarg;                 break;
+            case 'b': batch = atoi(optarg);              break;
+            case 'l': rs.loss = atof(optarg) / 100;      break;
+            case 'o': rs.reorder = atof(optarg) / 100;   break;
+            case 'O': reorderMs = atof(optarg);          break;
+            case 'q': queue = atoi(optarg);              break;
+            case 'R': rcvbuf = atoi(optarg);             break;
+            case 'S': period = atof(optarg);             break;
+            case 's': seed = strtoull(optarg, NULL, 0);  break;
+            case 'K': quiet = 1;                         break;
+            case 'd':
+                if (parseDelay(optarg, &rs.delay) == -1)
+                {
+                    printf("The delay must be fixed:MS, uniform:MIN:MAX, normal:MEAN:STDDEV, exp:MEAN or pareto:MIN:SHAPE (in milliseconds).\n");
+                    return 0;
+                }
+
+                break;
+            default:
+                printf("Correct usage: ./responder [-I iface] [-b batch] [-d delay] [-l loss_percent] [-o reorder_percent] [-O reorder_ms] [-q queue] [-R rcvbuf_bytes] [-S summary_seconds] [-s seed] [-K]\n");
+                return 0;
+        }
+    }
+
+    if (batch < 1 || batch > BATCH_MAX)
+    {
+        printf("The batch must be between 1 and %d packets.\n", BATCH_MAX);
+        return 0;
+    }
+
+    if (rs.loss < 0 || rs.loss > 1 || rs.reorder < 0 || rs.reorder > 1 || reorderMs < 0 || queue < 1 || rcvbuf < 0 || period < 0)
+    {
+        printf("The loss and reorder percentages must be between 0 and 100, and the queue, receive buffer and periods can't be negative.\n");
+        return 0;
+    }
+
+    rs.reorderNs = (uint64_t)(reorderMs * 1e6);
+    rs.rng = seed != 0 ? seed : (realtimeNs() ^ ((uint64_t)getpid() << 32)) | 1;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onStopSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);      // the terminal went away - we still put the kernel's setting back
+
+    // We now open the sockets: one that sends the replies, IP header and all, and one (or a ring) that gets the echo requests.
+    // Either way the filter keeps everything but the echo requests out - the replies we send on loopback included.
+
+    rs.txsock = socket(AF_INET, SOCK_RAW, IPPROTO_RAW);
+
+    if (rs.txsock == -1)
+    {
+        fprintf(stderr, "socket() failed with error: %d\n", errno);
+        fprintf(stderr, "To create a raw socket, the process needs to be run by Admin/root user.\n\n");
+        return -1;
+    }
+
+    struct pollfd fds;
+    fds.events = POLLIN;
+
+    if (rs.iface != NULL)
+    {
+        if (packetRingOpen(&rs.ring, rs.iface, ring_timeout_ms) == -1)
+        {
+            printf("Opening the capture ring on %s failed with error: %d\n", rs.iface, errno);
+            close(rs.txsock);
+            return -1;
+        }
+
+        if (attachRequestFilter(rs.ring.fd) == -1 || packetRingBind(&rs.ring) == -1)
+        {
+            printf("Setting up the capture ring on %s failed with error: %d\n", rs.iface, errno);
+            packetRingClose(&rs.ring);
+            close(rs.txsock);
+            return -1;
+        }
+
+        fds.fd = rs.ring.fd;
+    }
+    else
+    {
+        rs.rxsock = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+
+        if (rs.rxsock == -1 || attachRequestFilter(rs.rxsock) == -1)
+        {
+            printf("Opening the raw ICMP socket failed with error: %d\n", errno);
+            close(rs.txsock);
+            return -1;
+        }
+
+        // A burst of requests must fit in the socket's buffer while we are busy sending. Root may go past net.core.rmem_max.
+
+        if (rcvbuf > 0 && setsockopt(rs.rxsock, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) == -1)
+        {
+            setsockopt(rs.rxsock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        }
+
+        int on = 1;
+        setsockopt(rs.rxsock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+        fcntl(rs.rxsock, F_SETFL, fcntl(rs.rxsock, F_GETFL, 0) | O_NONBLOCK);
+        enableTimestamps(rs.rxsock);
+
+        fds.fd = rs.rxsock;
+    }
+
+    // Every buffer fits the largest request we answer. A held reply's buffer has its timer in front of it.
+
+    if ((rs.iface == NULL && batchInit(&rs.rx, batch, BATCH_SLOT) == -1) || batchInit(&rs.tx, batch, BATCH_SLOT) == -1
+        || poolInit(&rs.held, queue, sizeof(struct held_reply) + BATCH_SLOT) == -1)
+    {
+        printf("Out of memory while allocating the packet buffers.\n");
+        batchFree(&rs.rx);
+        batchFree(&rs.tx);
+        packetRingClose(&rs.ring);
+        close(rs.rxsock);
+        close(rs.txsock);
+        return -1;
+    }
+
+    int savedEcho = quiet ? quietKernel() : -1;
+
+    twInit(&rs.wheel, monotonicNs() / tick_ns);
+
+    printf("Answering echo requests from %s, %d per syscall", rs.iface != NULL ? rs.iface : "a raw socket", batch);
+
+    if (rs.delay.kind != DELAY_NONE)
+    {
+        printf(", delayed");
+    }
+
+    if (rs.loss > 0)
+    {
+        printf(", %.2f%% lost", rs.loss * 100);
+    }
+
+    if (rs.reorder > 0)
+    {
+        printf(", %.2f%% reordered", rs.reorder * 100);
+    }
+
+    printf(".\n");
+
+    uint64_t periodNs = (uint64_t)(period * 1e9);
+    uint64_t nextSummary = monotonicNs() + periodNs;
+
+    while (!stop)
+    {
+        // The kernel stamps the requests on CLOCK_REALTIME, and the wheel runs on CLOCK_MONOTONIC - the offset between the two converts.
+
+        int64_t offset = (int64_t)(realtimeNs() - monotonicNs());
+        int got = rs.iface != NULL ? receiveRing(&rs, offset) : receiveRaw(&rs, offset);
+
+        if (got == -1)
+        {
+            printf("Receiving failed with error: %d\n", errno);
+            break;
+        }
+
+        uint64_t now = monotonicNs();
+
+        twAdvance(&rs.wheel, now / tick_ns);
+        flushReplies(&rs);
+
+        if (periodNs > 0 && now >= nextSummary)
+        {
+            printCounters(&rs);
+            nextSummary += periodNs;
+        }
+
+        // A full batch means there may be more waiting - we go on reading. Otherwise we sleep until the next reply is due or a request arrives.
+
+        if (got == batch)
+        {
+            continue;
+        }
+
+        int64_t next = twNextExpiry(&rs.wheel);
+        uint64_t wake = next == -1 ? UINT64_MAX : (uint64_t)next * tick_ns;
+
+        if (periodNs > 0 && nextSummary < wake)
+        {
+            wake = nextSummary;
+        }
+
+        if (wake <= now)
+        {
+            continue;
+        }
+
+        uint64_t wait = wake - now;
+        struct timespec ts = { wait / 1000000000ull, wait % 1000000000ull };
+
+        if (ppoll(&fds, 1, wake == UINT64_MAX ? NULL : &ts, NULL) == -1 && errno != EINTR)
+        {
+            printf("Error : ppoll() failed with error: %d\n", errno);
+            break;
+        }
+    }
+
+    printCounters(&rs);
+
+    if (savedEcho != -1)
+    {
+        restoreKernel(savedEcho);
+    }
+
+    batchFree(&rs.rx);
+    batchFree(&rs.tx);
+    poolFree(&rs.held);
+    packetRingClose(&rs.ring);
+    close(rs.rxsock);
+    close(rs.txsock);
+
+    return 0;
+}
+
+
+//// onStopSignal() - asks the main loop to stop, on SIGINT, SIGTERM or SIGHUP.
+
+static void onStopSignal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+
+//// parseDelay() - reads a delay distribution ("fixed:5", "5", "uniform:1:10", "normal:5:1", "exp:5" or "pareto:2:1.5", in milliseconds).
+//// Returns 0 on success, -1 if the spec isn't one of those.
+
+static int parseDelay(const char *spec, struct delay_dist *d)
+{
+    static const struct { const char *name; int kind; int params; } kinds[] =
+    {
+        { "fixed", DELAY_FIXED, 1 },
+        { "uniform", DELAY_UNIFORM, 2 },
+        { "normal", DELAY_NORMAL, 2 },
+        { "exp", DELAY_EXP, 1 },
+        { "pareto", DELAY_PARETO, 2 },
+    };
+
+    memset(d, 0, sizeof(*d));
+
+    const char *colon = strchr(spec, ':');
+    int params = 1;
+    d->kind = DELAY_FIXED;
+
+    if (colon != NULL)
+    {
+        d->kind = DELAY_NONE;
+
+        for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++)
+        {
+            if (strlen(kinds[i].name) == (size_t)(colon - spec) && strncmp(spec, kinds[i].name, colon - spec) == 0)
+            {
+                d->kind = kinds[i].kind;
+                params = kinds[i].params;
+            }
+        }
+
+        if (d->kind == DELAY_NONE)
+        {
+            return -1;
+        }
+
+        spec = colon + 1;
+    }
+
+    char *end;
+    d->a = strtod(spec, &end);
+
+    if (end == spec || (params == 2 && *end != ':') || (params == 1 && *end != '\0'))
+    {
+        return -1;
+    }
+
+    if (params == 2)
+    {
+        const char *second = end + 1;
+        d->b = strtod(second, &end);
+
+        if (end == second || *end != '\0')
+        {
+            return -1;
+        }
+    }
+
+    if (d->a < 0 || d->b < 0 || (d->kind == DELAY_UNIFORM && d->b < d->a) || (d->kind == DELAY_PARETO && d->b == 0))
+    {
+        return -1;
+    }
+
+    // Everything but the pareto shape is a time, kept in nanoseconds.
+
+    d->a *= 1e6;
+
+    if (d->kind != DELAY_PARETO)
+    {
+        d->b *= 1e6;
+    }
+
+    return 0;
+}
+
+
+//// nextRandom() - returns the next number of a xorshift64* generator. Fast, and good enough for picking which packets misbehave.
+
+static uint64_t nextRandom(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+
+//// uniform() - returns a random number in [0, 1).
+
+static double uniform(uint64_t *state)
+{
+    return (nextRandom(state) >> 11) * 0x1.0p-53;
+}
+
+
+//// sampleDelay() - draws the delay of a reply from the distribution, in nanoseconds.
+
+static uint64_t sampleDelay(struct responder *rs)
+{
+    struct delay_dist *d = &rs->delay;
+    double v = 0;
+
+    switch (d->kind)
+    {
+        case DELAY_NONE:
+            return 0;
+        case DELAY_FIXED:
+            v = d->a;
+            break;
+        case DELAY_UNIFORM:
+            v = d->a + (d->b - d->a) * uniform(&rs->rng);
+            break;
+        case DELAY_NORMAL:
+            // The Box-Muller transform, with the first draw kept away from 0 for the logarithm.
+            v = d->a + d->b * sqrt(-2 * log(1 - uniform(&rs->rng))) * cos(2 * M_PI * uniform(&rs->rng));
+            break;
+        case DELAY_EXP:
+            v = -d->a * log(1 - uniform(&rs->rng));
+            break;
+        case DELAY_PARETO:
+            v = d->a / pow(1 - uniform(&rs->rng), 1 / d->b);
+            break;
+    }
+
+    // The wheel reaches only so far - a longer delay (the tail of a pareto) is cut to that.
+
+    double max = (double)TW_MAX_TICKS * tick_ns;
+
+    return v <= 0 ? 0 : (v >= max ? (uint64_t)max : (uint64_t)v);
+}
+
+
+//// requestLength() - checks that a packet (from its IP header on) is a whole ICMP echo request with a valid checksum, that fits our buffers.
+//// Returns the length of its ICMP message, and the length of its IP header in 'iplen' - or -1 if we can't answer it.
+//// The packet may be longer than its IP header says (the ring has frames as they came off the link, short ones padded), but not shorter.
+
+static int requestLength(const unsigned char *pac, uint32_t len, int *iplen)
+{
+    if (len < IP4_HDRLEN)
+    {
+        return -1;
+    }
+
+    const struct ip *ip = (const struct ip *)pac;
+    uint32_t total = ntohs(ip->ip_len);
+    *iplen = ip->ip_hl * 4;
+
+    // A fragment can't be answered on its own - the raw socket gets whole datagrams, the ring doesn't.
+
+    if (ip->ip_p != IPPROTO_ICMP || *iplen < IP4_HDRLEN || total > len || (ntohs(ip->ip_off) & (IP_MF | IP_OFFMASK)) != 0)
+    {
+        return -1;
+    }
+
+    int icmplen = total - *iplen;
+
+    if (icmplen < ICMP_HDRLEN || IP4_HDRLEN + icmplen > BATCH_SLOT)
+    {
+        return -1;
+    }
+
+    const struct icmp *icmp = (const struct icmp *)(pac + *iplen);
+
+    if (icmp->icmp_type != ICMP_ECHO || icmp->icmp_code != 0 || calculate_checksum((unsigned short *)icmp, icmplen) != 0)
+    {
+        return -1;
+    }
+
+    return icmplen;
+}
+
+
+//// buildReply() - writes the echo reply to a request into 'out': a plain IP header from the address the request went to, back to its sender,
+//// and the request's ICMP message with its type flipped. The checksum is patched for the new type rather than summed again.
+//// Returns the length of the reply, and where it goes in 'to'. The kernel fills in the IP id and checksum.
+
+static int buildReply(const unsigned char *req, int iplen, int icmplen, char *out, struct in_addr *to)
+{
+    const struct ip *rip = (const struct ip *)req;
+    struct ip *ip = (struct ip *)out;
+
+    memset(ip, 0, IP4_HDRLEN);
+    ip->ip_v = 4;
+    ip->ip_hl = IP4_HDRLEN / 4;
+    ip->ip_tos = rip->ip_tos;
+    ip->ip_len = htons(IP4_HDRLEN + icmplen);
+    ip->ip_ttl = 64;
+    ip->ip_p = IPPROTO_ICMP;
+    ip->ip_src = rip->ip_dst;
+    ip->ip_dst = rip->ip_src;
+
+    struct icmp *icmp = (struct icmp *)(out + IP4_HDRLEN);
+    memcpy(icmp, req + iplen, icmplen);
+
+    uint16_t oldWord, newWord;
+
+    memcpy(&oldWord, icmp, 2);      // the type and the code
+    icmp->icmp_type = ICMP_ECHOREPLY;
+    memcpy(&newWord, icmp, 2);
+    icmp->icmp_cksum = checksumAdjust(icmp->icmp_cksum, &oldWord, &newWord, 2);
+
+    *to = rip->ip_src;
+
+    return IP4_HDRLEN + icmplen;
+}
+
+
+//// handleRequest() - answers a request that arrived at 'arrived' (CLOCK_MONOTONIC, nanoseconds): drops it, queues its reply for the next send,
+//// or holds the reply back in the wheel until its delay has passed since the request arrived.
+
+static void handleRequest(struct responder *rs, const unsigned char *pac, uint32_t len, uint64_t arrived, uint64_t now)
+{
+    int iplen = 0;
+    int icmplen = requestLength(pac, len, &iplen);
+
+    if (icmplen == -1)
+    {
+        rs->ignored++;
+        return;
+    }
+
+    rs->requests++;
+
+    if (rs->loss > 0 && uniform(&rs->rng) < rs->loss)
+    {
+        rs->lost++;
+        return;
+    }
+
+    uint64_t delay = sampleDelay(rs);
+
+    if (rs->reorder > 0 && uniform(&rs->rng) < rs->reorder)
+    {
+        delay += rs->reorderNs;
+        rs->reordered++;
+    }
+
+    uint64_t due = arrived + delay;
+
+    // A reply that is already due goes straight into the send batch.
+
+    if (due <= now)
+    {
+        struct in_addr to;
+        int rlen = buildReply(pac, iplen, icmplen, batchBuffer(&rs->tx, rs->pending), &to);
+
+        batchSetPacket(&rs->tx, rs->pending, rlen, to);
+
+        if (++rs->pending == rs->tx.size)
+        {
+            flushReplies(rs);
+        }
+
+        return;
+    }
+
+    struct held_reply *h = (struct held_reply *)poolGet(&rs->held);
+
+    if (h == NULL)
+    {
+        rs->queueFull++;
+        return;
+    }
+
+    h->rs = rs;
+    h->len = buildReply(pac, iplen, icmplen, h->pac, &h->to);
+
+    // The tick is rounded up, so a reply never leaves before it is due.
+
+    twTimerInit(&h->timer, onDue, h);
+    twArm(&rs->wheel, &h->timer, (due + tick_ns - 1) / tick_ns);
+}
+
+
+//// onDue() - moves a held reply into the send batch, once it is due. Called by the wheel.
+
+static void onDue(struct tw_timer *timer, void *data)
+{
+    (void)timer;
+
+    struct held_reply *h = data;
+    struct responder *rs = h->rs;
+
+    memcpy(batchBuffer(&rs->tx, rs->pending), h->pac, h->len);
+    batchSetPacket(&rs->tx, rs->pending, h->len, h->to);
+    poolPut(&rs->held, (char *)h);
+
+    if (++rs->pending == rs->tx.size)
+    {
+        flushReplies(rs);
+    }
+}
+
+
+//// flushReplies() - sends the replies in the batch. A reply the kernel refuses (e.g. one "from" a broadcast address) is counted and skipped,
+//// and the rest of the batch still goes out.
+
+static void flushReplies(struct responder *rs)
+{
+    int done = 0;
+
+    while (done < rs->pending)
+    {
+        rs->sendCalls++;
+
+        int sent = sendmmsg(rs->txsock, rs->tx.msgs + done, rs->pending - done, 0);
+
+        if (sent == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            rs->sendFailed++;
+            done++;
+            continue;
+        }
+
+        rs->answered += sent;
+        done += sent;
+    }
+
+    rs->pending = 0;
+}
+
+
+//// receiveRaw() - reads a batch of requests off the raw socket with one recvmmsg() call, and handles them.
+//// Returns how many packets were read, or -1 on error.
+
+static int receiveRaw(struct responder *rs, int64_t offset)
+{
+    struct tstamp stamps[BATCH_MAX];
+
+    rs->recvCalls++;
+
+    int got = batchRecv(rs->rxsock, &rs->rx, stamps);
+
+    if (got == -1)
+    {
+        return -1;
+    }
+
+    uint64_t now = monotonicNs();
+
+    for (int i = 0; i < got; i++)
+    {
+        uint64_t arrived = stamps[i].kernel != 0 ? stamps[i].kernel - offset : stamps[i].mono;
+
+        handleRequest(rs, (const unsigned char *)batchBuffer(&rs->rx, i), rs->rx.msgs[i].msg_len, arrived, now);
+    }
+
+    return got;
+}
+
+
+//// receiveRing() - handles every request the ring has for us, where the kernel wrote it. Returns how many packets there were.
+
+static int receiveRing(struct responder *rs, int64_t offset)
+{
+    struct packet_frame frame;
+    uint64_t now = monotonicNs();
+    int got = 0;
+
+    while (packetRingNext(&rs->ring, &frame) == 1)
+    {
+        handleRequest(rs, frame.data, frame.len, frame.time - offset, now);
+        got++;
+    }
+
+    return got;
+}
+
+
+//// printCounters() - prints what the responder did so far, and what the kernel dropped before we could read it.
+
+static void printCounters(struct responder *rs)
+{
+    printf("--- %lu requests, %lu replies sent, %lu lost on purpose, %lu reordered, %lu dropped (queue full), %lu send failures, %lu held, %lu ignored ---\n",
+           (unsigned long)rs->requests, (unsigned long)rs->answered, (unsigned long)rs->lost, (unsigned long)rs->reordered,
+           (unsigned long)rs->queueFull, (unsigned long)rs->sendFailed, (unsigned long)rs->wheel.count, (unsigned long)rs->ignored);
+
+    if (rs->iface != NULL)
+    {
+        printf("--- %lu send syscalls, %lu packets read off the ring on %s, %lu dropped by the kernel (ring full) ---\n",
+               (unsigned long)rs->sendCalls, (unsigned long)rs->ring.packets, rs->iface, (unsigned long)packetRingDrops(&rs->ring));
+    }
+    else
+    {
+        printf("--- %lu send syscalls, %lu receive syscalls, %lu dropped by the kernel at the socket (SO_RXQ_OVFL) ---\n",
+               (unsigned long)rs->sendCalls, (unsigned long)rs->recvCalls, (unsigned long)rs->rx.overflows);
+    }
+
+    fflush(stdout);
+}
+
+
+//// quietKernel() - stops the kernel from answering echo requests itself, so only our replies go out. Returns the old setting,
+//// or -1 if it couldn't be changed (then both of us answer).
+
+static int quietKernel(void)
+{
+    FILE *f = fopen(echo_sysctl, "r+");
+    int saved = -1;
+
+    if (f == NULL || fscanf(f, "%d", &saved) != 1 || fseek(f, 0, SEEK_SET) != 0 || fprintf(f, "1\n") < 0 || fflush(f) != 0)
+    {
+        printf("Turning off the kernel's echo replies (%s) failed - it answers too.\n", echo_sysctl);
+        saved = -1;
+    }
+
+    if (f != NULL)
+    {
+        fclose(f);
+    }
+
+    return saved;
+}
+
+
+//// restoreKernel() - puts back the kernel's echo reply setting.
+
+static void restoreKernel(int saved)
+{
+    FILE *f = fopen(echo_sysctl, "w");
+
+    if (f == NULL || fprintf(f, "%d\n", saved) < 0)
+    {
+        printf("Restoring %s to %d failed.\n", echo_sysctl, saved);
+    }
+
+    if (f != NULL)
+    {
+        fclose(f);
+    }
+}
@@ -0,0 +1,95 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "spsc_ring.h"
+
+
+// # The Functions #
+
+//// ringInit() - allocates an empty ring of 'size' slots (a power of two) of up to 'slot' bytes each. Returns 0 on success, -1 if we are out of memory.
+
+int ringInit(struct spsc_ring *r, uint32_t size, size_t slot)
+{
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    r->size = size;
+    r->stamps = calloc(size, sizeof(*r->stamps));
+
+    if (r->stamps == NULL || batchInit(&r->slots, size, slot) == -1)
+    {
+        free(r->stamps);
+        r->stamps = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+//// ringFree() - releases the memory of a ring.
+
+void ringFree(struct spsc_ring *r)
+{
+    batchFree(&r->slots);
+    free(r->stamps);
+    r->stamps = NULL;
+}
+
+
+//// ringReserve() - producer side: finds up to 'max' free slots in a row (they stop at the end of the buffer, so recvmmsg() can fill them in one call).
+//// The first of them is slot '*first'. Returns how many there are - 0 if the ring is full.
+
+uint32_t ringReserve(struct spsc_ring *r, uint32_t max, uint32_t *first)
+{
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);     // the consumer is done with the slots before it
+    uint32_t space = r->size - (head - tail);
+    uint32_t index = head & (r->size - 1);
+
+    if (space > r->size - index)
+    {
+        space = r->size - index;
+    }
+
+    *first = index;
+
+    return space < max ? space : max;
+}
+
+
+//// ringPublish() - producer side: hands the next 'count' reserved slots, now filled, to the consumer.
+
+void ringPublish(struct spsc_ring *r, uint32_t count)
+{
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    atomic_store_explicit(&r->head, head + count, memory_order_release);
+}
+
+
+//// ringPeek() - consumer side: finds the published slots in a row, starting at slot '*first'. Returns how many there are - 0 if the ring is empty.
+
+uint32_t ringPeek(struct spsc_ring *r, uint32_t *first)
+{
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);     // the producer filled the slots before it
+    uint32_t used = head - tail;
+    uint32_t index = tail & (r->size - 1);
+
+    if (used > r->size - index)
+    {
+        used = r->size - index;
+    }
+
+    *first = index;
+
+    return used;
+}
+
+
+//// ringRelease() - consumer side: gives the next 'count' slots back to the producer, once we are done with them.
+
+void ringRelease(struct spsc_ring *r, uint32_t count)
+{
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    atomic_store_explicit(&r->tail, tail + count, memory_order_release);
+}
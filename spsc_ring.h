@@ -0,0 +1,38 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "batch_io.h"
+#include "tstamp.h"
+
+// A lock-free ring of received packets, between exactly one producer thread (the sweep's RX thread) and one consumer thread (a worker).
+// The packet buffers are preallocated once: the ring is a receive batch (see batch_io.h) whose slots are handed back and forth,
+// so the producer reads packets straight into the slots with recvmmsg(), and nothing is copied or allocated per packet.
+//
+// 'head' counts the packets ever published and 'tail' the packets ever released. Each side only writes its own counter
+// (with a release store, after the slots it covers are written or read) and reads the other's (with an acquire load),
+// so no locks or read-modify-write instructions are needed. The two counters live on separate cache lines, so they don't bounce.
+
+#define RING_CACHE_LINE 64
+
+struct spsc_ring
+{
+    _Alignas(RING_CACHE_LINE) _Atomic uint32_t head;     // written by the producer only
+    _Alignas(RING_CACHE_LINE) _Atomic uint32_t tail;     // written by the consumer only
+    _Alignas(RING_CACHE_LINE) uint32_t size;             // the number of slots, a power of two
+    struct batch slots;                                  // the packet buffers, source addresses and lengths
+    struct tstamp *stamps;                               // the arrival time of the packet in each slot
+};
+
+// # Function Headers #
+
+int ringInit(struct spsc_ring *r, uint32_t size, size_t slot);
+void ringFree(struct spsc_ring *r);
+uint32_t ringReserve(struct spsc_ring *r, uint32_t max, uint32_t *first);
+void ringPublish(struct spsc_ring *r, uint32_t count);
+uint32_t ringPeek(struct spsc_ring *r, uint32_t *first);
+void ringRelease(struct spsc_ring *r, uint32_t count);
+
+#endif
@@ -0,0 +1,284 @@
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "stats.h"
+
+static volatile sig_atomic_t stopRequested = 0;
+
+// # Function Headers #
+
+static int bucketOf(int64_t value);
+static int64_t bucketValue(int bucket);
+static void onSigint(int sig);
+
+
+// # The Functions #
+
+//// statsInit() - resets the statistics.
+
+void statsInit(struct stats *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->min = INT64_MAX;
+}
+
+
+//// statsSent() - counts an echo request that was sent.
+
+void statsSent(struct stats *st)
+{
+    st->sent++;
+}
+
+
+//// statsLost() - counts an echo request whose reply never came.
+
+void statsLost(struct stats *st)
+{
+    st->lost++;
+}
+
+
+//// statsCorrupted() - counts an echo reply that came back altered. It doesn't answer its request, which is later counted as lost.
+
+void statsCorrupted(struct stats *st)
+{
+    st->corrupted++;
+}
+
+
+//// statsReply() - folds the RTT of a reply (in nanoseconds) into the statistics.
+
+void statsReply(struct stats *st, int64_t rtt)
+{
+    if (rtt < 0)
+    {
+        rtt = 0;
+    }
+
+    st->received++;
+
+    if (rtt < st->min)
+    {
+        st->min = rtt;
+    }
+
+    if (rtt > st->max)
+    {
+        st->max = rtt;
+    }
+
+    // Welford's method keeps the mean and variance stable without storing the samples.
+
+    double delta = rtt - st->mean;
+    st->mean += delta / st->received;
+    st->m2 += delta * (rtt - st->mean);
+
+    // The jitter follows RFC 3550: a running average of the difference between consecutive RTTs, with a gain of 1/16.
+
+    if (st->received > 1)
+    {
+        int64_t diff = rtt > st->last ? rtt - st->last : st->last - rtt;
+        st->jitter += (diff - st->jitter) / 16.0;
+    }
+
+    st->last = rtt;
+    st->buckets[bucketOf(rtt)]++;
+}
+
+
+//// statsMerge() - folds the statistics in 'src' into 'dst', as if all of its requests and replies were counted in 'dst' too.
+//// Means and variances are combined with Chan's formula. The jitter depends on the order of the replies, which is lost,
+//// so the merged jitter is the average of the two, weighted by their replies.
+
+void statsMerge(struct stats *dst, const struct stats *src)
+{
+    uint64_t received = dst->received + src->received;
+
+    if (src->received > 0)
+    {
+        double delta = src->mean - dst->mean;
+
+        dst->m2 += src->m2 + delta * delta * ((double)dst->received * src->received / received);
+        dst->mean += delta * src->received / received;
+        dst->jitter = (dst->jitter * dst->received + src->jitter * src->received) / received;
+        dst->last = src->last;
+    }
+
+    if (src->min < dst->min)
+    {
+        dst->min = src->min;
+    }
+
+    if (src->max > dst->max)
+    {
+        dst->max = src->max;
+    }
+
+    dst->sent += src->sent;
+    dst->received = received;
+    dst->lost += src->lost;
+    dst->corrupted += src->corrupted;
+
+    for (int i = 0; i < STATS_BUCKETS; i++)
+    {
+        dst->buckets[i] += src->buckets[i];
+    }
+}
+
+
+//// statsPercentile() - returns the RTT (in nanoseconds) below which the given percentage of the replies fall.
+
+int64_t statsPercentile(const struct stats *st, double percentile)
+{
+    if (st->received == 0)
+    {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)ceil(percentile / 100.0 * st->received);
+    uint64_t seen = 0;
+
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+
+    for (int i = 0; i < STATS_BUCKETS; i++)
+    {
+        seen += st->buckets[i];
+
+        if (seen >= rank)
+        {
+            // We report the middle of the bucket, clamped to the RTTs we actually saw.
+
+            int64_t value = (bucketValue(i) + bucketValue(i + 1) - 1) / 2;
+
+            if (value < st->min)
+            {
+                value = st->min;
+            }
+
+            if (value > st->max)
+            {
+                value = st->max;
+            }
+
+            return value;
+        }
+    }
+
+    return st->max;
+}
+
+
+//// statsPrint() - prints a summary of the statistics, in the style of the classic ping summary.
+
+void statsPrint(const struct stats *st, const char *name)
+{
+    uint64_t answered = st->received + st->lost;
+    uint64_t inflight = st->sent - answered;
+
+    printf("--- %s statistics ---\n", name);
+    printf("%lu packets transmitted, %lu received, %.1f%% packet loss",
+           (unsigned long)st->sent, (unsigned long)st->received, answered ? 100.0 * st->lost / answered : 0.0);
+
+    if (inflight > 0)
+    {
+        printf(", %lu in flight", (unsigned long)inflight);
+    }
+
+    if (st->corrupted > 0)
+    {
+        printf(", %lu corrupted", (unsigned long)st->corrupted);
+    }
+
+    printf("\n");
+
+    if (st->received == 0)
+    {
+        return;
+    }
+
+    double stddev = st->received > 1 ? sqrt(st->m2 / (st->received - 1)) : 0.0;
+
+    printf("rtt min/avg/max/stddev = %.3f/%.3f/%.3f/%.3f ms, jitter = %.3f ms\n",
+           st->min / 1e6, st->mean / 1e6, st->max / 1e6, stddev / 1e6, st->jitter / 1e6);
+
+    printf("rtt p50/p90/p99/p99.9 = %.3f/%.3f/%.3f/%.3f ms\n",
+           statsPercentile(st, 50) / 1e6, statsPercentile(st, 90) / 1e6,
+           statsPercentile(st, 99) / 1e6, statsPercentile(st, 99.9) / 1e6);
+}
+
+
+//// statsCatchSigint() - makes Ctrl+C stop the pinger gracefully instead of killing it, so it can print its summary.
+//// The handler doesn't restart system calls, so a pinger blocked in poll() or recvfrom() wakes up with EINTR.
+
+void statsCatchSigint(void)
+{
+    struct sigaction action;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSigint;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+}
+
+
+//// statsStopRequested() - tells whether Ctrl+C was pressed.
+
+int statsStopRequested(void)
+{
+    return stopRequested;
+}
+
+
+//// bucketOf() - returns the histogram bucket of a value.
+//// Values below 2 * STATS_SUB_COUNT get a bucket each. Above that, every power of two gets STATS_SUB_COUNT buckets,
+//// indexed by the STATS_SUB_BITS bits that follow the most significant bit.
+
+static int bucketOf(int64_t value)
+{
+    if (value < 2 * STATS_SUB_COUNT)
+    {
+        return (int)value;
+    }
+
+    int msb = 63 - __builtin_clzll((uint64_t)value);
+
+    if (msb >= STATS_MAX_BITS)
+    {
+        return STATS_BUCKETS - 1;
+    }
+
+    int shift = msb - STATS_SUB_BITS;
+
+    return 2 * STATS_SUB_COUNT + (shift - 1) * STATS_SUB_COUNT + (int)((value >> shift) - STATS_SUB_COUNT);
+}
+
+
+//// bucketValue() - returns the smallest value that falls into a bucket.
+
+static int64_t bucketValue(int bucket)
+{
+    if (bucket < 2 * STATS_SUB_COUNT)
+    {
+        return bucket;
+    }
+
+    int shift = (bucket - 2 * STATS_SUB_COUNT) / STATS_SUB_COUNT + 1;
+    int64_t sub = (bucket - 2 * STATS_SUB_COUNT) % STATS_SUB_COUNT + STATS_SUB_COUNT;
+
+    return sub << shift;
+}
+
+
+//// onSigint() - the SIGINT handler, which only raises a flag for the main loop to see.
+
+static void onSigint(int sig)
+{
+    (void)sig;
+    stopRequested = 1;
+}
@@ -0,0 +1,44 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+// Streaming RTT statistics for the pingers.
+// Every reply is folded into the summary in O(1) and nothing is kept per probe, so a run of millions of probes
+// costs the same memory as a run of ten. Percentiles come from an HDR-style histogram: each power of two
+// is split into 64 linear sub-buckets, so a percentile is off by less than 1/64 (1.6%) of its value.
+
+#define STATS_SUB_BITS 6                                          // 2^6 sub-buckets per power of two
+#define STATS_SUB_COUNT (1 << STATS_SUB_BITS)
+#define STATS_MAX_BITS 42                                         // RTTs up to 2^42 ns (about 73 minutes) are kept exactly
+#define STATS_BUCKETS (2 * STATS_SUB_COUNT + (STATS_MAX_BITS - STATS_SUB_BITS - 1) * STATS_SUB_COUNT)
+
+struct stats
+{
+    uint64_t sent;                        // echo requests sent
+    uint64_t received;                    // echo replies matched to a request
+    uint64_t lost;                        // requests that timed out
+    uint64_t corrupted;                   // replies whose payload didn't come back as it was sent
+    int64_t min;                          // the smallest RTT (nanoseconds)
+    int64_t max;                          // the largest RTT (nanoseconds)
+    double mean;                          // the running mean of the RTT (nanoseconds)
+    double m2;                            // the running sum of squared differences from the mean (Welford's method)
+    double jitter;                        // the smoothed RTT variation between consecutive replies (RFC 3550)
+    int64_t last;                         // the previous RTT, for the jitter
+    uint64_t buckets[STATS_BUCKETS];      // the RTT histogram
+};
+
+// # Function Headers #
+
+void statsInit(struct stats *st);
+void statsSent(struct stats *st);
+void statsLost(struct stats *st);
+void statsCorrupted(struct stats *st);
+void statsReply(struct stats *st, int64_t rtt);
+void statsMerge(struct stats *dst, const struct stats *src);
+int64_t statsPercentile(const struct stats *st, double percentile);
+void statsPrint(const struct stats *st, const char *name);
+void statsCatchSigint(void);
+int statsStopRequested(void);
+
+#endif
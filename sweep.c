@@ -0,0 +1,1696 @@
+#define _GNU_SOURCE    // ppoll(), SO_RCVBUFFORCE, pthread_setaffinity_np()
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch_io.h"
+#include "filter.h"
+#include "icmp_util.h"
+#include "packet_ring.h"
+#include "spsc_ring.h"
+#include "sweep.h"
+
+#define SWEEP_BURST 64   // the most probes we send in a row before checking for replies again
+#define SWEEP_RING 4096                 // the slots of each worker's ring...
+#define SWEEP_RING_BYTES (16 << 20)     // ...unless that takes more than this many bytes of buffers (with large payloads)
+#define SWEEP_SPIN 64                   // how many times an idle worker looks at its ring before it starts napping
+#define SWEEP_NAP_NS 50000              // how long an idle worker naps between looks
+#define SWEEP_SENDER_NAP_NS 100000000   // the longest a sender sleeps at once, so it notices when it is asked to stop
+#define SWEEP_PENDING_NS 1000000        // how soon the main thread looks again at a target a sender is late with
+
+// With sw->workers set, the replies go through a pipeline instead of being handled between sends on the main thread:
+//
+//     main thread:   paces and sends the probes, and expires the targets that timed out
+//     RX thread:     only drains the socket - the TX timestamps first, then the replies, with recvmmsg() straight into the ring of one worker after the other
+//     workers:       parse the replies, match them to their targets and fold their RTTs into their own statistics
+//
+// The socket is drained as fast as it fills even when matching falls behind, so the kernel drops less. The workers print no line per reply
+// (they would all queue on stdout's lock) - the alive targets are listed once the sweep is done.
+// A drop at any stage is counted: the kernel's (the socket buffer overflowed), the RX thread's (a ring was full),
+// and the workers' (the packet wasn't a reply to a pending probe).
+
+struct sweep_worker
+{
+    struct spsc_ring ring;            // the packets the RX thread handed us
+    struct sweep *sw;
+    struct sweep_pipeline *pl;
+    struct packet_template *tmpl;
+    pthread_t thread;
+    pthread_mutex_t lock;             // guards 'stats', which the main thread merges for the periodic summaries - held only to update them
+    struct stats stats;               // the replies this worker matched
+    uint32_t alive;                   // the targets this worker found alive
+    uint64_t ignored;                 // the packets that weren't replies to pending probes
+    _Atomic int stop;                 // set once the RX thread is gone - the worker empties its ring and exits
+};
+
+// With sw->senders set, the probes are sent by that many threads instead of the main thread. Sender i owns targets i, i + senders,
+// i + 2 * senders... and its own raw socket, which only sends (a filter drops everything it would receive). Each sender runs on a core of
+// its own and paces its shard at rate / senders, starting 1 / rate after the sender before it - so together they send at the exact rate,
+// evenly spread, and the targets still go out (and expire) in about their order. The sleeps between probes are absolute, on CLOCK_MONOTONIC
+// (hrtimers), so lateness doesn't accumulate: a sender that wakes up late sends at most one batch at once, and if it is further behind than
+// that, it drops the lag and carries on at the rate from now - it never bursts to catch up.
+// The replies come back to the main socket, as without senders.
+
+struct sweep_sender
+{
+    struct sweep *sw;
+    struct sweep_senders *group;
+    int index;                        // the first target of the shard - and the stride between its targets is the number of senders
+    int sock;                         // the sender's own raw socket
+    int stamping;                     // the kind of kernel timestamps the socket gives us
+    struct batch tx;                  // the sender's own buffers, each a copy of the template
+    pthread_t thread;
+    _Atomic uint32_t sent;            // the targets of the shard sent so far
+    uint64_t lastSend;                // when the sender last sent
+    uint64_t sendCalls;               // how many send syscalls the sender made
+};
+
+struct sweep_senders
+{
+    struct sweep_sender *senders;
+    int count;                        // the number of senders
+    struct packet_template *tmpl;
+    uint64_t start;                   // when the first probe is due
+    _Atomic uint32_t *inflight;       // the probes in flight, counted for the workers (NULL without workers)
+    _Atomic int stop;                 // set by the main thread when the sweep ends early
+    _Atomic int failed;               // set by a sender whose socket failed for good
+};
+
+struct sweep_pipeline
+{
+    struct sweep *sw;
+    int sock;
+    int stamping;                     // the kind of kernel timestamps the socket gives us
+    int wake;                         // an eventfd that tells the RX thread to stop
+    int settled;                      // an eventfd the workers wake the main thread with, when no probe is in flight anymore
+    _Atomic uint32_t inflight;        // the probes in flight: added by the main thread before sending, taken off by whoever settles them
+    pthread_t rx;
+    struct sweep_worker *workers;
+    int count;                        // the number of workers
+    struct batch scratch;             // where the RX thread reads the packets no ring has room for, only to drop them
+};
+
+// # Function Headers #
+
+static int sweep_append(struct sweep *sw, uint32_t addr);
+static int sweep_packet(struct sweep *sw, struct packet_template *tmpl, uint32_t index, uint64_t now, char *pac);
+static int sweep_send(struct sweep *sw, int rawsock, struct batch *tx, struct packet_template *tmpl, uint32_t first, uint32_t stride, uint32_t count, uint64_t *calls);
+static void sweep_receive(struct sweep *sw, int rawsock, struct batch *io, struct packet_template *tmpl, uint32_t *alive);
+static void sweep_receive_ring(struct sweep *sw, struct packet_ring *ring, struct packet_template *tmpl, uint32_t *alive);
+static void sweep_match(struct sweep *sw, struct packet_template *tmpl, char *pac, ssize_t rec, struct sockaddr_in *from, struct tstamp *arrived, struct stats *st, pthread_mutex_t *lock, uint32_t *alive, uint64_t *ignored);
+static uint32_t sweep_tx_stamps(struct sweep *sw, int rawsock, uint32_t first, uint32_t stride, uint32_t sent);
+static int sweep_filter(struct sweep *sw, int rawsock);
+static void sweep_rcvbuf(struct sweep *sw, int rawsock);
+static int sweep_pipeline_start(struct sweep_pipeline *pl, struct sweep *sw, int rawsock, int stamping, struct packet_template *tmpl, size_t slot);
+static uint32_t sweep_pipeline_stop(struct sweep_pipeline *pl);
+static void sweep_pipeline_stats(struct sweep_pipeline *pl, struct stats *st);
+static void *sweep_rx_thread(void *arg);
+static void *sweep_worker_thread(void *arg);
+static int sweep_senders_start(struct sweep_senders *ss, struct sweep *sw, struct packet_template *tmpl, size_t slot, _Atomic uint32_t *inflight, uint64_t start);
+static uint32_t sweep_senders_stop(struct sweep_senders *ss, uint64_t *lastSend);
+static uint32_t sweep_senders_sent(struct sweep_senders *ss);
+static void *sweep_sender_thread(void *arg);
+
+
+// # The Functions #
+
+//// sweep_init() - resets a sweep to an empty target list with the default rate and timeout.
+
+void sweep_init(struct sweep *sw)
+{
+    memset(sw, 0, sizeof(*sw));
+    sw->ident = processIdent();
+    sw->rate = SWEEP_DEFAULT_RATE;
+    sw->timeout = SWEEP_DEFAULT_TIMEOUT;
+    sw->batch = BATCH_DEFAULT;
+    sw->size = PAYLOAD_DEFAULT;
+    statsInit(&sw->stats);
+}
+
+
+//// sweep_add_targets() - adds a single host ("10.0.0.1") or a CIDR range ("10.0.0.0/16") to the sweep.
+//// For ranges wider than /31 the network and broadcast addresses are skipped. Returns 0 on success, -1 on a bad spec.
+
+int sweep_add_targets(struct sweep *sw, const char *spec)
+{
+    char ip[INET_ADDRSTRLEN];
+    int prefix = 32;
+
+    const char *slash = strchr(spec, '/');
+    size_t iplen = slash ? (size_t)(slash - spec) : strlen(spec);
+
+    if (iplen >= sizeof(ip))
+    {
+        return -1;
+    }
+
+    memcpy(ip, spec, iplen);
+    ip[iplen] = '\0';
+
+    if (slash != NULL)
+    {
+        char *end = NULL;
+        long bits = strtol(slash + 1, &end, 10);
+
+        if (end == slash + 1 || *end != '\0' || bits < 0 || bits > 32)
+        {
+            return -1;
+        }
+
+        prefix = (int)bits;
+    }
+
+    struct in_addr base;
+
+    if (inet_pton(AF_INET, ip, &base) != 1)
+    {
+        return -1;
+    }
+
+    // We walk the range in host byte order, so consecutive addresses are probed one after the other.
+
+    uint32_t mask = prefix == 0 ? 0 : 0xffffffffu << (32 - prefix);
+    uint32_t first = ntohl(base.s_addr) & mask;
+    uint32_t last = first | ~mask;
+
+    if (prefix < 31)
+    {
+        first++;
+        last--;
+    }
+
+    for (uint64_t addr = first; addr <= last; addr++)
+    {
+        if (sweep_append(sw, (uint32_t)addr) == -1)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+//// sweep_add_file() - adds every host or range listed in a file, one per line. Empty lines and lines starting with '#' are ignored.
+
+int sweep_add_file(struct sweep *sw, const char *path)
+{
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL)
+    {
+        printf("Could not open the target list %s, error: %d\n", path, errno);
+        return -1;
+    }
+
+    char line[256];
+    int status = 0;
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        char *spec = line + strspn(line, " \t");
+        spec[strcspn(spec, " \t\r\n#")] = '\0';
+
+        if (*spec == '\0')
+        {
+            continue;
+        }
+
+        if (sweep_add_targets(sw, spec) == -1)
+        {
+            printf("Invalid target in %s: %s\n", path, spec);
+            status = -1;
+            break;
+        }
+    }
+
+    fclose(file);
+
+    return status;
+}
+
+
+//// sweep_run() - probes all the targets over the given socket (raw, or a ping socket if sw->dgram is set).
+//// Echo requests are paced at the configured aggregate rate, and many of them are in flight at once.
+//// Each reply is matched back to its target by the target index in its payload, and targets that don't answer within the timeout are counted as down.
+//// With sw->workers set, the replies are received and matched on other threads (see struct sweep_pipeline above),
+//// and with sw->senders set, the probes are sent by other threads (see struct sweep_sender above).
+//// With sw->iface set, the replies are read off a TPACKET_V3 ring on that interface (see packet_ring.h), and the raw socket only sends.
+
+int sweep_run(struct sweep *sw, int rawsock)
+{
+    if (sw->count == 0)
+    {
+        printf("No targets to probe.\n");
+        return -1;
+    }
+
+    // The socket is drained until it has nothing more to give, so it must not block.
+
+    if (fcntl(rawsock, F_SETFL, fcntl(rawsock, F_GETFL, 0) | O_NONBLOCK) == -1)
+    {
+        printf("Setting rawsock to be non-blocking failed, error: %d\n", errno);
+        return -1;
+    }
+
+    uint64_t interval = (uint64_t)(1e9 / sw->rate);          // time between two probes, in nanoseconds
+    uint64_t timeout = (uint64_t)(sw->timeout * 1e9);        // reply timeout, in nanoseconds
+    uint64_t period = (uint64_t)(sw->period * 1e9);          // summary period, in nanoseconds
+
+    uint32_t sent = 0;        // the targets before this index got their echo request
+    uint32_t expired = 0;     // the targets before this index are either alive or dead
+    uint32_t alive = 0;
+
+    // The echo request is built once, and every buffer of the send batch starts as a copy of it.
+    // From then on a probe only patches its sequence number and send time (and the checksum) into a buffer.
+    // The receive batch holds the replies of one recvmmsg() call, so its buffers must fit our largest reply and its IP header.
+
+    struct packet_template tmpl;
+    struct batch tx, io;
+
+    if (makeTemplate(&tmpl, sw->ident, sw->size, sw->pattern, sw->patternLen) == -1)
+    {
+        printf("Out of memory while building the echo request.\n");
+        return -1;
+    }
+
+    size_t slot = tmpl.len + IP4_MAXHDRLEN > BATCH_SLOT ? (size_t)tmpl.len + IP4_MAXHDRLEN : BATCH_SLOT;
+
+    memset(&io, 0, sizeof(io));     // so it can be freed even if the first batch failed and it was never set up
+
+    if (batchInit(&tx, sw->batch, slot) == -1 || batchInit(&io, sw->batch, slot) == -1)
+    {
+        printf("Out of memory while allocating the batch buffers.\n");
+        batchFree(&tx);
+        batchFree(&io);
+        freeTemplate(&tmpl);
+        return -1;
+    }
+
+    for (int i = 0; i < tx.size; i++)
+    {
+        copyTemplate(&tmpl, batchBuffer(&tx, i));
+    }
+
+    int burst = sw->batch > SWEEP_BURST ? sw->batch : SWEEP_BURST;
+
+    struct pollfd fds;
+    fds.fd = rawsock;
+    fds.events = POLLIN;
+
+    // A raw socket gets a copy of every ICMP packet on the host. We ask the kernel to drop all but the echo replies carrying our id -
+    // and, for a sweep small enough, coming from one of our targets. Without the filter we still work, just with more wakeups.
+
+    if (!sw->dgram && sweep_filter(sw, rawsock) == -1)
+    {
+        printf("Attaching the socket filter failed with error: %d, filtering in userspace only.\n", errno);
+    }
+
+    // The kernel timestamps the probes as they leave and the replies as they arrive, when it can.
+
+    int stamping = enableTimestamps(rawsock);
+
+    // With an interface to capture on, the replies are read off a ring the kernel writes them into, and the raw socket gets a filter
+    // that drops everything - it only sends, and gives us the TX timestamps on its error queue. The ring's own filter is the reply filter:
+    // its packets start at the IP header too. It is in place before the ring is bound, so nothing else ever gets in.
+
+    struct packet_ring ring;
+
+    if (sw->iface != NULL)
+    {
+        if (packetRingOpen(&ring, sw->iface, PACKET_RING_BLOCK_TIMEOUT_MS) == -1)
+        {
+            printf("Opening the capture ring on %s failed with error: %d\n", sw->iface, errno);
+            batchFree(&tx);
+            batchFree(&io);
+            freeTemplate(&tmpl);
+            return -1;
+        }
+
+        if (sweep_filter(sw, ring.fd) == -1)
+        {
+            printf("Attaching the ring's filter failed with error: %d, filtering in userspace only.\n", errno);
+        }
+
+        if (packetRingBind(&ring) == -1)
+        {
+            printf("Binding the capture ring to %s failed with error: %d\n", sw->iface, errno);
+            packetRingClose(&ring);
+            batchFree(&tx);
+            batchFree(&io);
+            freeTemplate(&tmpl);
+            return -1;
+        }
+
+        if (attachDropFilter(rawsock) == -1)
+        {
+            printf("Attaching the drop filter failed with error: %d, the raw socket's replies are discarded in userspace.\n", errno);
+        }
+
+        fds.fd = ring.fd;
+
+        // A reply sits in a block that isn't ours yet until the block fills up or its timeout passes, so a target is given that much longer
+        // before it counts as down.
+
+        timeout += PACKET_RING_BLOCK_TIMEOUT_MS * 1000000ull;
+    }
+
+    sweep_rcvbuf(sw, rawsock);
+
+    // From here on the socket is read only by the RX thread, if there is one. The main thread sleeps on the workers' eventfd instead,
+    // which tells it that every probe sent so far was answered.
+
+    struct sweep_pipeline pl;
+
+    if (sw->workers > 0)
+    {
+        if (sweep_pipeline_start(&pl, sw, rawsock, stamping, &tmpl, slot) == -1)
+        {
+            if (sw->iface != NULL)
+            {
+                packetRingClose(&ring);
+            }
+
+            batchFree(&tx);
+            batchFree(&io);
+            freeTemplate(&tmpl);
+            return -1;
+        }
+
+        fds.fd = pl.settled;
+    }
+
+    printf("Sweeping %u targets at %.0f probes/s, %d probes per syscall, over a %s socket", sw->count, sw->rate, sw->batch, sw->dgram ? "ping" : "raw");
+
+    if (sw->iface != NULL)
+    {
+        printf(", replies from a ring on %s", sw->iface);
+    }
+
+    if (sw->senders > 0)
+    {
+        printf(", %d senders", sw->senders);
+    }
+
+    if (sw->workers > 0)
+    {
+        printf(", %d reply workers", sw->workers);
+    }
+
+    printf(".\n");
+
+    uint64_t start = monotonicNs();
+    uint64_t next_send = start;
+    uint64_t last_send = start;
+    uint64_t next_summary = start + period;
+
+    // The sender threads take over the sending, if we have them. The main thread is left with the replies (unless the workers have them too)
+    // and the timeouts - it looks at every target in order, waiting for the senders to reach it.
+
+    struct sweep_senders ss;
+
+    if (sw->senders > 0 && sweep_senders_start(&ss, sw, &tmpl, slot, sw->workers > 0 ? &pl.inflight : NULL, start) == -1)
+    {
+        if (sw->workers > 0)
+        {
+            sweep_pipeline_stop(&pl);
+        }
+
+        if (sw->iface != NULL)
+        {
+            packetRingClose(&ring);
+        }
+
+        batchFree(&tx);
+        batchFree(&io);
+        freeTemplate(&tmpl);
+        return -1;
+    }
+
+    uint32_t bound = sw->senders > 0 ? sw->count : 0;      // the targets before this index may have been sent
+
+    while (expired < sw->count && !statsStopRequested())
+    {
+        uint64_t now = monotonicNs();
+
+        if (sw->senders > 0 && atomic_load(&ss.failed))
+        {
+            printf("Sending packet failed on a sender thread.\n");
+            sweep_senders_stop(&ss, &last_send);
+
+            if (sw->workers > 0)
+            {
+                sweep_pipeline_stop(&pl);
+            }
+
+            if (sw->iface != NULL)
+            {
+                packetRingClose(&ring);
+            }
+
+            batchFree(&tx);
+            batchFree(&io);
+            freeTemplate(&tmpl);
+            return -1;
+        }
+
+        // Send all the probes that are due. Probes are sent in target order, which is also the order in which they expire.
+
+        uint32_t due = 0;
+
+        while (sw->senders == 0 && due < (uint32_t)burst && sent + due < sw->count && next_send + due * interval <= now)
+        {
+            due++;
+        }
+
+        if (due > 0)
+        {
+            // The targets are in flight before their probes leave - a worker may see a reply before sweep_send() even returns.
+
+            for (uint32_t i = 0; i < due; i++)
+            {
+                stampNow(&sw->targets[sent + i].sent);
+                sw->targets[sent + i].state = TARGET_INFLIGHT;
+            }
+
+            if (sw->workers > 0)
+            {
+                atomic_fetch_add(&pl.inflight, due);
+            }
+
+            int done = sweep_send(sw, rawsock, &tx, &tmpl, sent, 1, due, &sw->sendCalls);
+
+            if (done == -1)
+            {
+                printf("Sending packet failed with error: %d\n", errno);
+
+                if (sw->workers > 0)
+                {
+                    sweep_pipeline_stop(&pl);
+                }
+
+                if (sw->iface != NULL)
+                {
+                    packetRingClose(&ring);
+                }
+
+                batchFree(&tx);
+                batchFree(&io);
+                freeTemplate(&tmpl);
+                return -1;
+            }
+
+            // Whatever didn't fit in the send buffer will be tried again on the next round.
+
+            for (uint32_t i = done; i < due; i++)
+            {
+                sw->targets[sent + i].state = TARGET_PENDING;
+            }
+
+            if (sw->workers > 0)
+            {
+                atomic_fetch_sub(&pl.inflight, due - done);
+            }
+
+            for (int i = 0; i < done; i++)
+            {
+                statsSent(&sw->stats);
+                sent++;
+            }
+
+            bound = sent;
+
+            if (done > 0)
+            {
+                last_send = now;
+                next_send += done * interval;
+            }
+        }
+
+        // Collect the TX timestamps and the replies that already arrived.
+
+        // Right after sending, the timestamps are collected before the replies even without POLLERR - a fast reply may already be waiting.
+
+        // The ring's wakeups are for replies only - the raw socket's error queue is read whenever a block of them came in.
+
+        if (sw->workers == 0)
+        {
+            if (stamping == TSTAMP_RXTX && ((fds.revents & POLLERR) || due > 0 || (sw->iface != NULL && (fds.revents & POLLIN))))
+            {
+                sweep_tx_stamps(sw, rawsock, 0, 1, sent);
+            }
+
+            if (sw->iface != NULL)
+            {
+                sweep_receive_ring(sw, &ring, &tmpl, &alive);
+            }
+            else
+            {
+                sweep_receive(sw, rawsock, &io, &tmpl, &alive);
+            }
+        }
+        else if (fds.revents & POLLIN)
+        {
+            uint64_t wakeups = 0;
+
+            if (read(pl.settled, &wakeups, sizeof(wakeups)) == -1 && errno != EAGAIN)
+            {
+                printf("Error : Reading the workers' eventfd failed with error: %d\n", errno);
+            }
+        }
+
+        fds.revents = 0;
+
+        // Expire the targets that waited too long. Since all the probes share the same timeout, the oldest one always expires first.
+        // A worker may be matching the reply at this very moment, so whichever of us settles the target's state first wins.
+        // With senders, a target may not have been sent yet - then we wait for it.
+
+        now = monotonicNs();
+
+        while (expired < bound)
+        {
+            struct sweep_target *t = &sw->targets[expired];
+
+            if (t->state == TARGET_PENDING)
+            {
+                break;
+            }
+
+            if (t->state == TARGET_INFLIGHT)
+            {
+                if (now - t->sent.mono < timeout)
+                {
+                    break;
+                }
+
+                int inflight = TARGET_INFLIGHT;
+
+                if (atomic_compare_exchange_strong(&t->state, &inflight, TARGET_DEAD))
+                {
+                    statsLost(&sw->stats);
+
+                    if (sw->workers > 0)
+                    {
+                        atomic_fetch_sub(&pl.inflight, 1);
+                    }
+                }
+            }
+
+            expired++;
+        }
+
+        if (expired == sw->count)
+        {
+            break;
+        }
+
+        if (period > 0 && now >= next_summary)
+        {
+            struct stats snapshot = sw->stats;
+
+            if (sw->workers > 0)
+            {
+                sweep_pipeline_stats(&pl, &snapshot);
+            }
+
+            if (sw->senders > 0)
+            {
+                snapshot.sent += sweep_senders_sent(&ss);
+            }
+
+            statsPrint(&snapshot, "sweep");
+            next_summary += period;
+        }
+
+        // Sleep until the next probe is due, the oldest probe expires or a reply arrives - whichever comes first.
+
+        uint64_t wake = UINT64_MAX;
+
+        if (sw->senders == 0 && sent < sw->count)
+        {
+            wake = next_send;
+        }
+
+        if (expired < bound && sw->targets[expired].state == TARGET_PENDING)
+        {
+            // The senders' schedule tells when the target is due - if they are running late, we look again shortly.
+
+            uint64_t due_at = start + (uint64_t)(expired * 1e9 / sw->rate);
+            wake = due_at > now ? due_at : now + SWEEP_PENDING_NS;
+        }
+        else if (expired < bound && sw->targets[expired].sent.mono + timeout < wake)
+        {
+            wake = sw->targets[expired].sent.mono + timeout;
+        }
+
+        if (period > 0 && next_summary < wake)
+        {
+            wake = next_summary;
+        }
+
+        if (wake > now)
+        {
+            uint64_t wait = wake - now;
+            struct timespec ts = { wait / 1000000000ull, wait % 1000000000ull };
+
+            if (ppoll(&fds, 1, &ts, NULL) == -1 && errno != EINTR)
+            {
+                printf("Error : ppoll() failed with error: %d\n", errno);
+
+                if (sw->senders > 0)
+                {
+                    sweep_senders_stop(&ss, &last_send);
+                }
+
+                if (sw->workers > 0)
+                {
+                    sweep_pipeline_stop(&pl);
+                }
+
+                if (sw->iface != NULL)
+                {
+                    packetRingClose(&ring);
+                }
+
+                batchFree(&tx);
+                batchFree(&io);
+                freeTemplate(&tmpl);
+                return -1;
+            }
+        }
+    }
+
+    // The senders' counts, and the workers' replies and statistics, are folded back in once they are done.
+
+    if (sw->senders > 0)
+    {
+        sent = sweep_senders_stop(&ss, &last_send);
+        sw->stats.sent += sent;
+    }
+
+    if (sw->workers > 0)
+    {
+        alive += sweep_pipeline_stop(&pl);
+
+        // The workers printed nothing per reply, so the alive targets are listed now, in their order.
+
+        for (uint32_t i = 0; i < sw->count; i++)
+        {
+            if (atomic_load(&sw->targets[i].state) == TARGET_ALIVE)
+            {
+                char addr[INET_ADDRSTRLEN];
+
+                printf("-- Reply from %s : seq = %u, time = %.3f ms.\n",
+                       inet_ntop(AF_INET, &sw->targets[i].addr, addr, sizeof(addr)), i, sw->targets[i].rtt / 1e6);
+            }
+        }
+    }
+
+    double seconds = (monotonicNs() - start) / 1e9;
+    double sending = (last_send - start) / 1e9;
+
+    statsPrint(&sw->stats, "sweep");
+    printf("--- sweep done: %u targets, %u alive, %u down, %.3f s, %.0f probes/s ---\n",
+           sw->count, alive, expired - alive, seconds, sent > 1 && sending > 0 ? (sent - 1) / sending : sent);
+    printf("--- %lu send syscalls, %lu receive syscalls ---\n", (unsigned long)sw->sendCalls, (unsigned long)sw->recvCalls);
+
+    if (sw->workers > 0)
+    {
+        printf("--- %lu packets received, %lu dropped by the kernel at the socket (SO_RXQ_OVFL), %lu dropped by the RX thread (ring full), %lu ignored by the workers ---\n",
+               (unsigned long)sw->rxPackets, (unsigned long)sw->kernelDrops, (unsigned long)sw->ringDrops, (unsigned long)sw->ignored);
+    }
+
+    if (sw->iface != NULL)
+    {
+        sw->captureDrops = packetRingDrops(&ring);
+        printf("--- %lu packets read off the ring on %s, %lu dropped by the kernel (ring full) ---\n",
+               (unsigned long)sw->captured, sw->iface, (unsigned long)sw->captureDrops);
+        packetRingClose(&ring);
+    }
+
+    batchFree(&tx);
+    batchFree(&io);
+    freeTemplate(&tmpl);
+
+    return 0;
+}
+
+
+//// sweep_free() - releases the target list.
+
+void sweep_free(struct sweep *sw)
+{
+    free(sw->targets);
+    memset(sw, 0, sizeof(*sw));
+}
+
+
+//// sweep_append() - adds a single address (in host byte order) to the end of the target list.
+
+static int sweep_append(struct sweep *sw, uint32_t addr)
+{
+    if (sw->count == sw->capacity)
+    {
+        uint32_t capacity = sw->capacity ? sw->capacity * 2 : 256;
+        struct sweep_target *targets = realloc(sw->targets, capacity * sizeof(*targets));
+
+        if (targets == NULL)
+        {
+            printf("Out of memory while adding targets.\n");
+            return -1;
+        }
+
+        sw->targets = targets;
+        sw->capacity = capacity;
+    }
+
+    struct sweep_target *t = &sw->targets[sw->count++];
+    memset(t, 0, sizeof(*t));
+    t->addr.s_addr = htonl(addr);
+
+    return 0;
+}
+
+
+//// sweep_packet() - turns a buffer holding a copy of the template into the echo request for the target at the given index, sent at 'now'.
+//// The payload carries the whole index (and the header its low 16 bits as the sequence number),
+//// so a reply can be traced back to its target without any lookup.
+
+static int sweep_packet(struct sweep *sw, struct packet_template *tmpl, uint32_t index, uint64_t now, char *pac)
+{
+    patchPacket(tmpl, pac, sw->ident, index, now);
+
+    return tmpl->len;
+}
+
+
+//// sweep_send() - sends the echo requests of 'count' targets: the one at index 'first', and every 'stride'-th one after it.
+//// With a batch size of 1 every request costs its own sendto(), otherwise the whole vector goes out in one sendmmsg().
+//// Every send syscall is counted in '*calls'. Returns how many requests were sent (fewer than asked if the send buffer filled up), or -1 on error.
+
+static int sweep_send(struct sweep *sw, int rawsock, struct batch *tx, struct packet_template *tmpl, uint32_t first, uint32_t stride, uint32_t count, uint64_t *calls)
+{
+    if (sw->batch == 1)
+    {
+        char *pac = batchBuffer(tx, 0);
+        uint32_t done = 0;
+
+        for (; done < count; done++)
+        {
+            uint32_t index = first + done * stride;
+            int len = sweep_packet(sw, tmpl, index, monotonicNs(), pac);
+
+            struct sockaddr_in address;
+            memset(&address, 0, sizeof(address));
+            address.sin_family = AF_INET;
+            address.sin_addr = sw->targets[index].addr;
+
+            (*calls)++;
+
+            if (sendto(rawsock, pac, len, 0, (struct sockaddr *)&address, sizeof(address)) == -1)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+                {
+                    break;
+                }
+
+                return -1;
+            }
+        }
+
+        return done;
+    }
+
+    // All the headers of the batch are patched up front, then submitted together.
+
+    int total = 0;
+
+    while ((uint32_t)total < count)
+    {
+        int n = count - total < (uint32_t)tx->size ? (int)(count - total) : tx->size;
+        uint64_t now = monotonicNs();
+
+        for (int i = 0; i < n; i++)
+        {
+            uint32_t index = first + (total + i) * stride;
+            int len = sweep_packet(sw, tmpl, index, now, batchBuffer(tx, i));
+            batchSetPacket(tx, i, len, sw->targets[index].addr);
+        }
+
+        (*calls)++;
+
+        int done = batchSend(rawsock, tx, n);
+
+        if (done == -1)
+        {
+            return -1;
+        }
+
+        total += done;
+
+        if (done < n)
+        {
+            break;
+        }
+    }
+
+    return total;
+}
+
+
+//// sweep_receive() - drains the raw socket, and matches every echo reply to the target it answers.
+//// With a batch size of 1 every datagram costs its own recvmsg(), otherwise whole bursts are read with recvmmsg().
+
+static void sweep_receive(struct sweep *sw, int rawsock, struct batch *io, struct packet_template *tmpl, uint32_t *alive)
+{
+    if (sw->batch == 1)
+    {
+        char *pac = batchBuffer(io, 0);
+
+        while (1)
+        {
+            struct sockaddr_in from;
+            struct tstamp arrived;
+
+            sw->recvCalls++;
+
+            ssize_t rec = recvStamped(rawsock, pac, io->slot, &from, &arrived);
+
+            if (rec <= 0)
+            {
+                return;    // EAGAIN - nothing more to read for now
+            }
+
+            sweep_match(sw, tmpl, pac, rec, &from, &arrived, &sw->stats, NULL, alive, &sw->ignored);
+        }
+    }
+
+    struct tstamp arrived[BATCH_MAX];
+
+    while (1)
+    {
+        sw->recvCalls++;
+
+        int got = batchRecv(rawsock, io, arrived);
+
+        for (int i = 0; i < got; i++)
+        {
+            sweep_match(sw, tmpl, batchBuffer(io, i), io->msgs[i].msg_len, &io->addrs[i], &arrived[i], &sw->stats, NULL, alive, &sw->ignored);
+        }
+
+        if (got < io->size)
+        {
+            return;    // a short burst means the socket is drained
+        }
+    }
+}
+
+
+//// sweep_receive_ring() - matches every packet the ring has for us to the target it answers, reading it where the kernel wrote it.
+//// The ring's filter is the raw socket's, so these are IP packets like the raw socket's, and each comes with the kernel's RX timestamp.
+
+static void sweep_receive_ring(struct sweep *sw, struct packet_ring *ring, struct packet_template *tmpl, uint32_t *alive)
+{
+    struct packet_frame frame;
+    struct tstamp arrived;
+
+    // A block may have waited in the ring until its timeout, so our own clock reading would be late for every packet in it.
+    // Instead each packet gets its kernel stamp (CLOCK_REALTIME) on the monotonic clock as well, through the offset between the two -
+    // then its RTT is its own, even for a probe that has no TX stamp.
+
+    int64_t offset = (int64_t)(realtimeNs() - monotonicNs());
+
+    while (packetRingNext(ring, &frame) == 1)
+    {
+        struct sockaddr_in from;
+        memset(&from, 0, sizeof(from));
+        from.sin_family = AF_INET;
+
+        if (frame.len < sizeof(struct ip))
+        {
+            sw->ignored++;
+            continue;
+        }
+
+        // Unlike a raw socket, the ring has the frame as it came off the link - short ones padded - so the IP header tells where the packet ends.
+
+        const struct ip *iphdr = (const struct ip *)frame.data;
+        uint32_t len = ntohs(iphdr->ip_len);
+
+        if (len > frame.len)
+        {
+            len = frame.len;
+        }
+
+        from.sin_addr = iphdr->ip_src;
+        arrived.kernel = frame.time;
+        arrived.mono = (uint64_t)((int64_t)frame.time - offset);
+
+        sweep_match(sw, tmpl, (char *)frame.data, len, &from, &arrived, &sw->stats, NULL, alive, &sw->ignored);
+    }
+
+    sw->captured = ring->packets;
+}
+
+
+//// sweep_match() - matches a datagram read from the raw socket to the target it answers, if it is one of our echo replies.
+//// Anything else (other pingers' replies, our own requests on loopback, late or duplicate replies) is counted as ignored,
+//// and replies whose payload came back altered are counted as corrupted. The reply is folded into 'st', which belongs to the calling thread.
+//// When another thread reads 'st' too (a worker's, which the main thread merges), 'lock' guards each update - otherwise it is NULL.
+//// The RTT is measured from the send time in the payload, unless the kernel gave us the probe's TX timestamp.
+//// A line is printed for every reply, except on the workers.
+
+static void sweep_match(struct sweep *sw, struct packet_template *tmpl, char *pac, ssize_t rec, struct sockaddr_in *from, struct tstamp *arrived, struct stats *st, pthread_mutex_t *lock, uint32_t *alive, uint64_t *ignored)
+{
+    struct icmp *reply = NULL;
+    int icmplen = parseReply(pac, rec, !sw->dgram, sw->ident, NULL, &reply);
+
+    if (icmplen == -1)
+    {
+        (*ignored)++;
+        return;
+    }
+
+    uint32_t index = 0;
+    uint64_t sentNs = 0;
+
+    if (parsePayload(tmpl, reply, icmplen, &index, &sentNs) == -1)
+    {
+        if (lock != NULL)
+        {
+            pthread_mutex_lock(lock);
+        }
+
+        statsCorrupted(st);
+
+        if (lock != NULL)
+        {
+            pthread_mutex_unlock(lock);
+        }
+
+        return;
+    }
+
+    // Only a target still in flight can be answered - and only once, even if the timeout is settling it at the same moment.
+
+    struct sweep_target *t = index < sw->count ? &sw->targets[index] : NULL;
+    int inflight = TARGET_INFLIGHT;
+
+    if (t == NULL || t->addr.s_addr != from->sin_addr.s_addr || !atomic_compare_exchange_strong(&t->state, &inflight, TARGET_ALIVE))
+    {
+        (*ignored)++;
+        return;
+    }
+
+    // The TX timestamp is stored by the main thread, possibly while a worker reads it here.
+
+    struct tstamp start = { __atomic_load_n(&t->sent.kernel, __ATOMIC_RELAXED), sentNs };
+    char addr[INET_ADDRSTRLEN];
+
+    t->rtt = stampDiff(&start, arrived);
+    (*alive)++;
+
+    if (lock != NULL)
+    {
+        pthread_mutex_lock(lock);
+        statsReply(st, t->rtt);
+        pthread_mutex_unlock(lock);
+        return;
+    }
+
+    statsReply(st, t->rtt);
+
+    printf("-- Reply from %s : seq = %u, bytes = %ld, time = %.3f ms.\n",
+           inet_ntop(AF_INET, &t->addr, addr, sizeof(addr)), index, (long)icmplen, t->rtt / 1e6);
+}
+
+
+//// sweep_tx_stamps() - attaches the kernel's TX timestamps to the probes they belong to.
+//// The timestamps are keyed by the order the probes were sent in on the socket: the socket sent the targets 'first', 'first + stride'
+//// and so on, in order, and 'sent' of them so far. Returns how many timestamps it read.
+
+static uint32_t sweep_tx_stamps(struct sweep *sw, int rawsock, uint32_t first, uint32_t stride, uint32_t sent)
+{
+    uint32_t key = 0;
+    uint64_t stamp = 0;
+    uint32_t read = 0;
+
+    while (recvTxStamp(rawsock, &key, &stamp) == 1)
+    {
+        uint32_t index = first + key * stride;
+        read++;
+
+        if (key < sent && index < sw->count && sw->targets[index].state == TARGET_INFLIGHT)
+        {
+            __atomic_store_n(&sw->targets[index].sent.kernel, stamp, __ATOMIC_RELAXED);
+        }
+    }
+
+    return read;
+}
+
+
+//// sweep_filter() - attaches the in-kernel reply filter to the raw socket. The targets' addresses are part of the filter
+//// only when there are few enough of them to compare one by one.
+
+static int sweep_filter(struct sweep *sw, int rawsock)
+{
+    struct in_addr addrs[FILTER_MAX_ADDRS];
+    int count = 0;
+
+    if (sw->count <= FILTER_MAX_ADDRS)
+    {
+        for (uint32_t i = 0; i < sw->count; i++)
+        {
+            addrs[count++] = sw->targets[i].addr;
+        }
+    }
+
+    return attachReplyFilter(rawsock, sw->ident, addrs, count);
+}
+
+
+//// sweep_rcvbuf() - sizes the socket's receive buffer: as asked (sw->rcvbuf), or large enough for a burst of replies when they are handled
+//// by workers. Root may go past net.core.rmem_max with SO_RCVBUFFORCE, anyone else gets at most that.
+
+static void sweep_rcvbuf(struct sweep *sw, int rawsock)
+{
+    int size = sw->rcvbuf > 0 ? sw->rcvbuf : (sw->workers > 0 ? SWEEP_PIPELINE_RCVBUF : 0);
+
+    if (size == 0)
+    {
+        return;
+    }
+
+    if (setsockopt(rawsock, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == -1)
+    {
+        setsockopt(rawsock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+
+    int got = 0;
+    socklen_t len = sizeof(got);
+
+    if (getsockopt(rawsock, SOL_SOCKET, SO_RCVBUF, &got, &len) == 0)
+    {
+        printf("The socket's receive buffer is %d bytes (the kernel doubles what it is asked for, for its own bookkeeping).\n", got);
+    }
+}
+
+
+//// sweep_pipeline_start() - starts the workers and the RX thread. Each worker gets a ring of 'slot'-byte buffers.
+//// Returns 0 on success, -1 on failure (nothing is left running).
+
+static int sweep_pipeline_start(struct sweep_pipeline *pl, struct sweep *sw, int rawsock, int stamping, struct packet_template *tmpl, size_t slot)
+{
+    memset(pl, 0, sizeof(*pl));
+    pl->sw = sw;
+    pl->sock = rawsock;
+    pl->stamping = stamping;
+    atomic_init(&pl->inflight, 0);
+
+    // The kernel tells us with every packet how many it dropped so far for lack of buffer space.
+
+    int on = 1;
+    setsockopt(rawsock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+
+    uint32_t size = SWEEP_RING;
+
+    while (size > 2 * (uint32_t)sw->batch && size * slot > SWEEP_RING_BYTES)
+    {
+        size /= 2;
+    }
+
+    pl->wake = eventfd(0, EFD_CLOEXEC);
+    pl->settled = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    pl->workers = aligned_alloc(RING_CACHE_LINE, sw->workers * sizeof(struct sweep_worker));
+
+    if (pl->wake == -1 || pl->settled == -1 || pl->workers == NULL || batchInit(&pl->scratch, sw->batch, slot) == -1)
+    {
+        printf("Out of memory while starting the reply workers.\n");
+        free(pl->workers);
+        if (pl->wake != -1)
+        {
+            close(pl->wake);
+        }
+        if (pl->settled != -1)
+        {
+            close(pl->settled);
+        }
+        return -1;
+    }
+
+    memset(pl->workers, 0, sw->workers * sizeof(struct sweep_worker));
+
+    for (pl->count = 0; pl->count < sw->workers; pl->count++)
+    {
+        struct sweep_worker *w = &pl->workers[pl->count];
+
+        w->sw = sw;
+        w->pl = pl;
+        w->tmpl = tmpl;
+        statsInit(&w->stats);
+        pthread_mutex_init(&w->lock, NULL);
+        atomic_init(&w->stop, 0);
+
+        if (ringInit(&w->ring, size, slot) == -1)
+        {
+            printf("Out of memory while allocating the reply rings.\n");
+            break;
+        }
+
+        if (pthread_create(&w->thread, NULL, sweep_worker_thread, w) != 0)
+        {
+            printf("Starting a reply worker failed.\n");
+            ringFree(&w->ring);
+            break;
+        }
+    }
+
+    if (pl->count < sw->workers || pthread_create(&pl->rx, NULL, sweep_rx_thread, pl) != 0)
+    {
+        // The threads that did start are stopped like at the end of a sweep - with no RX thread to wait for.
+
+        for (int i = 0; i < pl->count; i++)
+        {
+            atomic_store_explicit(&pl->workers[i].stop, 1, memory_order_release);
+            pthread_join(pl->workers[i].thread, NULL);
+            ringFree(&pl->workers[i].ring);
+        }
+
+        free(pl->workers);
+        batchFree(&pl->scratch);
+        close(pl->wake);
+        close(pl->settled);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+//// sweep_pipeline_stop() - stops the RX thread, then lets every worker empty its ring and stop. Their statistics and counters are folded
+//// into the sweep's. Returns how many targets the workers found alive.
+
+static uint32_t sweep_pipeline_stop(struct sweep_pipeline *pl)
+{
+    struct sweep *sw = pl->sw;
+    uint64_t one = 1;
+    uint32_t alive = 0;
+
+    if (write(pl->wake, &one, sizeof(one)) != sizeof(one))
+    {
+        printf("Error : Waking the RX thread failed with error: %d\n", errno);
+    }
+
+    pthread_join(pl->rx, NULL);
+
+    for (int i = 0; i < pl->count; i++)
+    {
+        struct sweep_worker *w = &pl->workers[i];
+
+        atomic_store_explicit(&w->stop, 1, memory_order_release);
+        pthread_join(w->thread, NULL);
+
+        statsMerge(&sw->stats, &w->stats);
+        alive += w->alive;
+        sw->ignored += w->ignored;
+
+        pthread_mutex_destroy(&w->lock);
+        ringFree(&w->ring);
+    }
+
+    free(pl->workers);
+    batchFree(&pl->scratch);
+    close(pl->wake);
+    close(pl->settled);
+
+    return alive;
+}
+
+
+//// sweep_pipeline_stats() - the statistics of the sweep so far: the main thread's (probes sent and lost) and every worker's (replies).
+
+static void sweep_pipeline_stats(struct sweep_pipeline *pl, struct stats *st)
+{
+    *st = pl->sw->stats;
+
+    for (int i = 0; i < pl->count; i++)
+    {
+        pthread_mutex_lock(&pl->workers[i].lock);
+        statsMerge(st, &pl->workers[i].stats);
+        pthread_mutex_unlock(&pl->workers[i].lock);
+    }
+}
+
+
+//// sweep_rx_thread() - the RX thread: sleeps until the socket is readable, collects the TX timestamps (before the replies they belong to
+//// are matched, and so that a pending error queue doesn't keep waking us), then drains the socket in bursts straight into the workers' rings,
+//// one ring after the other. When a ring is full, the burst is read into a scratch batch and dropped (and counted), so the socket keeps
+//// draining - a slow worker costs its own replies, not everyone's. Stops when the eventfd is written.
+
+static void *sweep_rx_thread(void *arg)
+{
+    struct sweep_pipeline *pl = arg;
+    struct sweep *sw = pl->sw;
+    struct tstamp dropped[BATCH_MAX];
+    int next = 0;
+
+    struct pollfd fds[2];
+    fds[0].fd = pl->sock;    fds[0].events = POLLIN;
+    fds[1].fd = pl->wake;    fds[1].events = POLLIN;
+
+    while (1)
+    {
+        if (poll(fds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            printf("Error : poll() failed on the RX thread with error: %d\n", errno);
+            return NULL;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            return NULL;
+        }
+
+        if (pl->stamping == TSTAMP_RXTX)
+        {
+            sweep_tx_stamps(sw, pl->sock, 0, 1, sw->count);
+        }
+
+        while (1)
+        {
+            struct sweep_worker *w = &pl->workers[next];
+            uint32_t first = 0;
+            uint32_t room = ringReserve(&w->ring, sw->batch, &first);
+            struct batch *b = room > 0 ? &w->ring.slots : &pl->scratch;
+            int want = room > 0 ? (int)room : pl->scratch.size;
+
+            next = (next + 1) % pl->count;
+            sw->recvCalls++;
+
+            int got = room > 0 ? batchRecvRange(pl->sock, b, first, room, w->ring.stamps + first) : batchRecv(pl->sock, b, dropped);
+
+            if (got == -1)
+            {
+                printf("Error : Receiving on the RX thread failed with error: %d\n", errno);
+                return NULL;
+            }
+
+            if (b->overflows > sw->kernelDrops)
+            {
+                sw->kernelDrops = b->overflows;
+            }
+
+            sw->rxPackets += got;
+
+            if (room > 0)
+            {
+                ringPublish(&w->ring, got);
+            }
+            else
+            {
+                sw->ringDrops += got;
+            }
+
+            if (got < want)
+            {
+                break;    // a short burst means the socket is drained
+            }
+        }
+    }
+}
+
+
+//// sweep_worker_thread() - a worker: matches the replies in its ring, a run of slots at a time, and gives the slots back.
+//// When the replies it matched leave no probe in flight, it wakes the main thread, which may be done.
+//// An empty ring is looked at again a few times, then napped on - the replies already carry their arrival times, so a worker's delay
+//// doesn't show in the RTTs. Stops once it was asked to and its ring is empty.
+
+static void *sweep_worker_thread(void *arg)
+{
+    struct sweep_worker *w = arg;
+    int idle = 0;
+
+    while (1)
+    {
+        uint32_t first = 0;
+        uint32_t count = ringPeek(&w->ring, &first);
+
+        if (count == 0)
+        {
+            if (atomic_load_explicit(&w->stop, memory_order_acquire))
+            {
+                if (ringPeek(&w->ring, &first) == 0)
+                {
+                    return NULL;
+                }
+
+                continue;
+            }
+
+            if (++idle < SWEEP_SPIN)
+            {
+                sched_yield();
+            }
+            else
+            {
+                struct timespec nap = { 0, SWEEP_NAP_NS };
+                nanosleep(&nap, NULL);
+            }
+
+            continue;
+        }
+
+        idle = 0;
+
+        struct batch *b = &w->ring.slots;
+        uint32_t alive = w->alive;
+
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            sweep_match(w->sw, w->tmpl, batchBuffer(b, i), b->msgs[i].msg_len, &b->addrs[i], &w->ring.stamps[i], &w->stats, &w->lock, &w->alive, &w->ignored);
+        }
+
+        ringRelease(&w->ring, count);
+
+        if (w->alive > alive && atomic_fetch_sub(&w->pl->inflight, w->alive - alive) == w->alive - alive)
+        {
+            uint64_t one = 1;
+
+            if (write(w->pl->settled, &one, sizeof(one)) == -1)
+            {
+                printf("Error : Waking the main thread failed with error: %d\n", errno);
+            }
+        }
+    }
+}
+
+
+//// sweep_senders_start() - opens a raw socket for every sender, and starts them. Sender i runs on the i-th CPU we may run on.
+//// Returns 0 on success, -1 on failure (nothing is left running).
+
+static int sweep_senders_start(struct sweep_senders *ss, struct sweep *sw, struct packet_template *tmpl, size_t slot, _Atomic uint32_t *inflight, uint64_t start)
+{
+    memset(ss, 0, sizeof(*ss));
+    ss->tmpl = tmpl;
+    ss->start = start;
+    ss->inflight = inflight;
+    atomic_init(&ss->stop, 0);
+    atomic_init(&ss->failed, 0);
+
+    ss->senders = calloc(sw->senders, sizeof(struct sweep_sender));
+
+    if (ss->senders == NULL)
+    {
+        printf("Out of memory while starting the senders.\n");
+        return -1;
+    }
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+
+    int cpus = CPU_COUNT(&allowed);
+    int cpu = -1;
+    int status = 0;
+
+    for (ss->count = 0; ss->count < sw->senders; ss->count++)
+    {
+        struct sweep_sender *s = &ss->senders[ss->count];
+
+        s->sw = sw;
+        s->group = ss;
+        s->index = ss->count;
+        atomic_init(&s->sent, 0);
+
+        int kind = ICMP_SOCK_RAW;
+        int ident = sw->ident;
+
+        s->sock = openIcmpSocket(&kind, &ident);
+
+        if (s->sock == -1)
+        {
+            printf("Opening the raw socket of a sender failed with error: %d\n", errno);
+            status = -1;
+            break;
+        }
+
+        // The sender's socket would get a copy of every ICMP packet on the host, like any raw socket - it drops them all instead,
+        // the replies are read on the main socket.
+
+        if (attachDropFilter(s->sock) == -1)
+        {
+            printf("Attaching the drop-all filter to a sender's socket failed with error: %d\n", errno);
+        }
+
+        fcntl(s->sock, F_SETFL, fcntl(s->sock, F_GETFL, 0) | O_NONBLOCK);
+        s->stamping = enableTimestamps(s->sock);
+
+        if (batchInit(&s->tx, sw->batch, slot) == -1)
+        {
+            printf("Out of memory while allocating the senders' buffers.\n");
+            close(s->sock);
+            status = -1;
+            break;
+        }
+
+        for (int i = 0; i < s->tx.size; i++)
+        {
+            copyTemplate(tmpl, batchBuffer(&s->tx, i));
+        }
+
+        if (pthread_create(&s->thread, NULL, sweep_sender_thread, s) != 0)
+        {
+            printf("Starting a sender failed.\n");
+            batchFree(&s->tx);
+            close(s->sock);
+            status = -1;
+            break;
+        }
+
+        // One core per sender, while there are cores - a sender that can't be pinned still runs, wherever the scheduler puts it.
+
+        if (cpus > 0)
+        {
+            do
+            {
+                cpu = (cpu + 1) % CPU_SETSIZE;
+            }
+            while (!CPU_ISSET(cpu, &allowed));
+
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            pthread_setaffinity_np(s->thread, sizeof(one), &one);
+        }
+    }
+
+    if (status == -1)
+    {
+        uint64_t lastSend = 0;
+        sweep_senders_stop(ss, &lastSend);
+    }
+
+    return status;
+}
+
+
+//// sweep_senders_stop() - stops the senders (they may be done already), and closes their sockets. Their syscalls are added to the sweep's.
+//// Returns how many probes they sent, and sets '*lastSend' to the last time any of them sent.
+
+static uint32_t sweep_senders_stop(struct sweep_senders *ss, uint64_t *lastSend)
+{
+    uint32_t sent = 0;
+
+    atomic_store(&ss->stop, 1);
+
+    for (int i = 0; i < ss->count; i++)
+    {
+        struct sweep_sender *s = &ss->senders[i];
+
+        pthread_join(s->thread, NULL);
+
+        sent += atomic_load(&s->sent);
+        s->sw->sendCalls += s->sendCalls;
+
+        if (s->lastSend > *lastSend)
+        {
+            *lastSend = s->lastSend;
+        }
+
+        batchFree(&s->tx);
+        close(s->sock);
+    }
+
+    free(ss->senders);
+    ss->senders = NULL;
+    ss->count = 0;
+
+    return sent;
+}
+
+
+//// sweep_senders_sent() - how many probes the senders sent so far.
+
+static uint32_t sweep_senders_sent(struct sweep_senders *ss)
+{
+    uint32_t sent = 0;
+
+    for (int i = 0; i < ss->count; i++)
+    {
+        sent += atomic_load_explicit(&ss->senders[i].sent, memory_order_relaxed);
+    }
+
+    return sent;
+}
+
+
+//// sweep_sender_thread() - a sender: sends the probes of its shard as they come due, then collects their TX timestamps.
+//// Probe k of the shard is due at start + (index + k * senders) / rate. The sender sleeps until then with an absolute deadline,
+//// and if it woke up late, sends what is due by now in one go - at most a batch, and the rest of its lag is dropped.
+//// Once the shard is sent, it waits for the TX timestamps still on their way (behind a qdisc, say) until the reply timeout passes.
+
+static void *sweep_sender_thread(void *arg)
+{
+    struct sweep_sender *s = arg;
+    struct sweep_senders *ss = s->group;
+    struct sweep *sw = s->sw;
+    uint32_t stride = sw->senders;
+    uint32_t total = (uint32_t)s->index < sw->count ? (sw->count - s->index + stride - 1) / stride : 0;
+    double interval = 1e9 * stride / sw->rate;                       // time between two probes of the shard, in nanoseconds
+    uint64_t first = ss->start + (uint64_t)(s->index * 1e9 / sw->rate);
+    uint32_t sent = 0;
+    uint32_t stamped = 0;                                           // the TX timestamps read so far
+
+    while (sent < total && !atomic_load_explicit(&ss->stop, memory_order_relaxed))
+    {
+        uint64_t now = monotonicNs();
+        uint64_t next = first + (uint64_t)(sent * interval);
+
+        // More than a batch behind (the sender was preempted, or the send buffer was full), the schedule starts over from now.
+
+        if (next + (uint64_t)(sw->batch * interval) < now)
+        {
+            first = now - (uint64_t)(sent * interval);
+            next = now;
+        }
+
+        if (next > now)
+        {
+            uint64_t until = next - now > SWEEP_SENDER_NAP_NS ? now + SWEEP_SENDER_NAP_NS : next;
+            struct timespec ts = { until / 1000000000ull, until % 1000000000ull };
+
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            continue;
+        }
+
+        uint32_t due = 0;
+
+        while (due < (uint32_t)sw->batch && sent + due < total && first + (uint64_t)((sent + due) * interval) <= now)
+        {
+            due++;
+        }
+
+        // The targets are in flight before their probes leave, as on the main thread.
+
+        uint32_t index = s->index + sent * stride;
+
+        for (uint32_t i = 0; i < due; i++)
+        {
+            stampNow(&sw->targets[index + i * stride].sent);
+            sw->targets[index + i * stride].state = TARGET_INFLIGHT;
+        }
+
+        if (ss->inflight != NULL)
+        {
+            atomic_fetch_add(ss->inflight, due);
+        }
+
+        int done = sweep_send(sw, s->sock, &s->tx, ss->tmpl, index, stride, due, &s->sendCalls);
+
+        if (done == -1)
+        {
+            printf("Sending packet failed with error: %d\n", errno);
+            atomic_store(&ss->failed, 1);
+            return NULL;
+        }
+
+        for (uint32_t i = done; i < due; i++)
+        {
+            sw->targets[index + i * stride].state = TARGET_PENDING;
+        }
+
+        if (ss->inflight != NULL)
+        {
+            atomic_fetch_sub(ss->inflight, due - done);
+        }
+
+        sent += done;
+        atomic_store_explicit(&s->sent, sent, memory_order_relaxed);
+
+        if (done > 0)
+        {
+            s->lastSend = now;
+        }
+        else
+        {
+            // The send buffer is full - we wait a little for it to drain, rather than spin.
+
+            struct pollfd fds;
+            fds.fd = s->sock;
+            fds.events = POLLOUT;
+            poll(&fds, 1, 1);
+        }
+
+        if (s->stamping == TSTAMP_RXTX)
+        {
+            stamped += sweep_tx_stamps(sw, s->sock, s->index, stride, sent);
+        }
+    }
+
+    // The last batch's timestamps may not be on the error queue yet - we wait for them, or until the reply timeout of the last probe passes.
+
+    uint64_t deadline = s->lastSend + (uint64_t)(sw->timeout * 1e9);
+
+    while (s->stamping == TSTAMP_RXTX && stamped < sent && !atomic_load_explicit(&ss->stop, memory_order_relaxed))
+    {
+        uint64_t now = monotonicNs();
+
+        if (now >= deadline)
+        {
+            break;
+        }
+
+        // POLLERR is reported whenever the error queue holds something. We nap at most SWEEP_SENDER_NAP_NS, to notice a stop.
+
+        uint64_t wait = deadline - now < SWEEP_SENDER_NAP_NS ? deadline - now : SWEEP_SENDER_NAP_NS;
+        struct pollfd fds;
+        fds.fd = s->sock;
+        fds.events = 0;
+        fds.revents = 0;
+        poll(&fds, 1, (int)(wait / 1000000) + 1);
+
+        stamped += sweep_tx_stamps(sw, s->sock, s->index, stride, sent);
+    }
+
+    return NULL;
+}
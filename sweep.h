@@ -0,0 +1,76 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <netinet/in.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "icmp_util.h"
+#include "stats.h"
+#include "tstamp.h"
+
+// The multi-target mode of ping.c: many IPv4 hosts are probed over a single raw socket (or one per sender thread),
+// with many echo requests in flight at once and an aggregate packets-per-second budget.
+
+#define SWEEP_DEFAULT_RATE 1000       // probes per second, across all targets
+#define SWEEP_DEFAULT_TIMEOUT 1.0     // seconds to wait for a reply before a host counts as down
+#define SWEEP_MAX_WORKERS 64          // the most reply-processing threads a sweep may have
+#define SWEEP_MAX_SENDERS 64          // the most sender threads a sweep may have
+#define SWEEP_PIPELINE_RCVBUF (4 << 20)   // the receive buffer we ask for when the replies are processed by workers, unless told otherwise
+
+// The state of a single target during a sweep.
+
+enum target_state
+{
+    TARGET_PENDING = 0,               // no echo request was sent yet
+    TARGET_INFLIGHT,                  // an echo request was sent, waiting for the reply
+    TARGET_ALIVE,                     // we got the reply
+    TARGET_DEAD                       // the timeout passed without a reply
+};
+
+struct sweep_target
+{
+    struct in_addr addr;              // the address of the target
+    struct tstamp sent;               // when the echo request was sent
+    int64_t rtt;                      // the round trip time in nanoseconds, once the target is alive
+    _Atomic int state;                // one of the target_state values - a reply (on a worker) and the timeout (on the main thread) race to settle it
+};
+
+struct sweep
+{
+    struct sweep_target *targets;     // all the targets, in the order they will be probed
+    uint32_t count;                   // the number of targets
+    uint32_t capacity;                // the number of allocated targets
+    uint16_t ident;                   // the ICMP id used by this process
+    double rate;                      // the aggregate probe rate, in packets per second
+    double timeout;                   // the reply timeout, in seconds
+    double period;                    // seconds between two statistics summaries (0 - only at the end)
+    int dgram;                        // whether the socket is a ping socket (SOCK_DGRAM), whose replies come without their IP header
+    int batch;                        // packets per sendmmsg()/recvmmsg() call (1 - one sendto()/recvmsg() per packet)
+    int size;                         // the payload size of every probe, in bytes
+    unsigned char pattern[PATTERN_MAX];   // the pattern the payload is filled with
+    int patternLen;                   // the length of the pattern (0 - the default one)
+    int senders;                      // sender threads, each with its own raw socket and shard of the targets (0 - the main thread sends)
+    int workers;                      // reply-processing threads, fed by a separate RX thread (0 - everything on the main thread)
+    int rcvbuf;                       // the socket's receive buffer size to ask for, in bytes (0 - the system default)
+    const char *iface;                // read the replies off a TPACKET_V3 ring on this interface instead of the raw socket (NULL - the socket)
+    uint64_t sendCalls;               // how many send syscalls the sweep made
+    uint64_t recvCalls;               // how many receive syscalls the sweep made
+    uint64_t rxPackets;               // the packets the RX thread read off the socket
+    uint64_t kernelDrops;             // the packets the kernel dropped at the socket, mostly because its receive buffer was full (SO_RXQ_OVFL)
+    uint64_t ringDrops;               // the packets the RX thread dropped because a worker's ring was full
+    uint64_t ignored;                 // the packets the workers found weren't replies to pending probes (other traffic, duplicates, late replies)
+    uint64_t captured;                // the packets read off the TPACKET_V3 ring
+    uint64_t captureDrops;            // the packets the kernel dropped because the ring was full
+    struct stats stats;               // the RTT statistics across all the targets
+};
+
+// # Function Headers #
+
+void sweep_init(struct sweep *sw);
+int sweep_add_targets(struct sweep *sw, const char *spec);
+int sweep_add_file(struct sweep *sw, const char *path);
+int sweep_run(struct sweep *sw, int rawsock);
+void sweep_free(struct sweep *sw);
+
+#endif
@@ -0,0 +1,266 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "timerwheel.h"
+
+// # Function Headers #
+
+static void linkTimer(struct timer_wheel *w, struct tw_timer *t);
+static void unlinkTimer(struct timer_wheel *w, struct tw_timer *t);
+static int cascade(struct timer_wheel *w, int level);
+
+
+// # The Functions #
+
+//// twInit() - empties a wheel, whose clock starts at tick 'now'.
+
+void twInit(struct timer_wheel *w, uint64_t now)
+{
+    memset(w, 0, sizeof(*w));
+    w->now = now;
+}
+
+
+//// twTimerInit() - prepares a timer, which calls 'expire' with 'data' when it expires.
+
+void twTimerInit(struct tw_timer *t, void (*expire)(struct tw_timer *timer, void *data), void *data)
+{
+    memset(t, 0, sizeof(*t));
+    t->expire = expire;
+    t->data = data;
+}
+
+
+//// twArm() - arms a timer to expire at tick 'expires' (re-arming it if it was already armed). A tick in the past expires on the next advance.
+
+void twArm(struct timer_wheel *w, struct tw_timer *t, uint64_t expires)
+{
+    if (t->armed)
+    {
+        unlinkTimer(w, t);
+        w->count--;
+    }
+
+    t->expires = expires;
+    t->armed = 1;
+    w->count++;
+
+    linkTimer(w, t);
+}
+
+
+//// twCancel() - disarms a timer. Cancelling a timer that isn't armed does nothing.
+
+void twCancel(struct timer_wheel *w, struct tw_timer *t)
+{
+    if (!t->armed)
+    {
+        return;
+    }
+
+    unlinkTimer(w, t);
+    t->armed = 0;
+    w->count--;
+}
+
+
+//// twAdvance() - moves the wheel's clock up to tick 'now', and expires every timer due by then, in order.
+//// Each tick first cascades the higher wheels whose turn came (when the lower wheel wraps around), then expires the timers of its slot.
+//// The ticks with nothing to do are skipped, so the cost doesn't grow with how far the clock moves. A callback may arm or cancel any timer,
+//// itself included.
+
+void twAdvance(struct timer_wheel *w, uint64_t now)
+{
+    while (w->now <= now)
+    {
+        // With no timers at all there is nothing to cascade or expire, so the clock jumps straight to the end.
+        // Otherwise it jumps to the next tick that expires a timer or cascades an occupied slot - the ticks before it are empty.
+
+        int64_t next = twNextExpiry(w);
+
+        if (next == -1 || (uint64_t)next > now)
+        {
+            w->now = now + 1;
+            break;
+        }
+
+        if ((uint64_t)next > w->now)
+        {
+            w->now = next;
+        }
+
+        int slot = w->now & (TW_SLOTS - 1);
+
+        if (slot == 0)
+        {
+            for (int level = 1; level < TW_LEVELS && cascade(w, level) == 0; level++)
+            {
+            }
+        }
+
+        while (w->slots[0][slot] != NULL)
+        {
+            struct tw_timer *t = w->slots[0][slot];
+
+            unlinkTimer(w, t);
+            t->armed = 0;
+            w->count--;
+
+            t->expire(t, t->data);
+        }
+
+        w->now++;
+    }
+}
+
+
+//// twNextExpiry() - returns the tick at which the wheel next has work to do: a timer expiring, or a higher wheel cascading down
+//// a slot that holds timers. Sleeping until then (and advancing) never misses a timer. Returns -1 if no timer is armed.
+
+int64_t twNextExpiry(const struct timer_wheel *w)
+{
+    if (w->count == 0)
+    {
+        return -1;
+    }
+
+    int64_t next = -1;
+
+    for (int level = 0; level < TW_LEVELS; level++)
+    {
+        if (w->occupied[level] == 0)
+        {
+            continue;
+        }
+
+        // The slot of this wheel the clock is in, and how far into it the clock is.
+
+        int shift = TW_BITS * level;
+        uint64_t unit = 1ull << shift;
+        int current = (w->now >> shift) & (TW_SLOTS - 1);
+        uint64_t bits = w->occupied[level];
+
+        // Rotate the bitmap so bit k is the slot k steps ahead of the current one, and find the nearest occupied one.
+        // On the higher wheels the current slot was already cascaded, unless the clock is exactly at its start -
+        // a timer there now belongs to the next round.
+
+        uint64_t rotated = current == 0 ? bits : (bits >> current) | (bits << (TW_SLOTS - current));
+        int passed = level > 0 && (w->now & (unit - 1)) != 0;
+
+        if (passed)
+        {
+            rotated &= ~1ull;
+        }
+
+        uint64_t steps = rotated != 0 ? (uint64_t)__builtin_ctzll(rotated) : TW_SLOTS;
+        uint64_t tick = level == 0 ? w->now + steps : (w->now & ~(unit - 1)) + steps * unit;
+
+        if (next == -1 || (int64_t)tick < next)
+        {
+            next = tick;
+        }
+    }
+
+    return next;
+}
+
+
+//// linkTimer() - links a timer into the slot its expiry falls in: the lowest wheel whose span (from the current tick) reaches it.
+
+static void linkTimer(struct timer_wheel *w, struct tw_timer *t)
+{
+    uint64_t expires = t->expires;
+    int level = 0;
+
+    if (expires < w->now)
+    {
+        expires = w->now;        // already due - it goes in the slot about to be processed
+    }
+    else if (expires - w->now > TW_MAX_TICKS)
+    {
+        expires = w->now + TW_MAX_TICKS;
+    }
+
+    uint64_t delta = expires - w->now;
+
+    while (level < TW_LEVELS - 1 && delta >= 1ull << (TW_BITS * (level + 1)))
+    {
+        level++;
+    }
+
+    int slot = (expires >> (TW_BITS * level)) & (TW_SLOTS - 1);
+
+    // The timer goes at the end of the slot's list, so the timers of a tick expire in the order they were armed.
+
+    t->level = level;
+    t->slot = slot;
+    t->next = NULL;
+    t->prev = w->tails[level][slot];
+
+    if (t->prev != NULL)
+    {
+        t->prev->next = t;
+    }
+    else
+    {
+        w->slots[level][slot] = t;
+    }
+
+    w->tails[level][slot] = t;
+    w->occupied[level] |= 1ull << slot;
+}
+
+
+//// unlinkTimer() - takes a timer out of its slot list.
+
+static void unlinkTimer(struct timer_wheel *w, struct tw_timer *t)
+{
+    if (t->prev != NULL)
+    {
+        t->prev->next = t->next;
+    }
+    else
+    {
+        w->slots[t->level][t->slot] = t->next;
+    }
+
+    if (t->next != NULL)
+    {
+        t->next->prev = t->prev;
+    }
+    else
+    {
+        w->tails[t->level][t->slot] = t->prev;
+    }
+
+    if (w->slots[t->level][t->slot] == NULL)
+    {
+        w->occupied[t->level] &= ~(1ull << t->slot);
+    }
+
+    t->next = t->prev = NULL;
+}
+
+
+//// cascade() - moves the timers of the current slot of a higher wheel down to the wheels below it, now that their span is near.
+//// Returns the index of that slot: when it is 0, this wheel wrapped around too, and the next wheel up has to cascade as well.
+
+static int cascade(struct timer_wheel *w, int level)
+{
+    int slot = (w->now >> (TW_BITS * level)) & (TW_SLOTS - 1);
+    struct tw_timer *t = w->slots[level][slot];
+
+    w->slots[level][slot] = NULL;
+    w->tails[level][slot] = NULL;
+    w->occupied[level] &= ~(1ull << slot);
+
+    while (t != NULL)
+    {
+        struct tw_timer *next = t->next;
+
+        linkTimer(w, t);
+        t = next;
+    }
+
+    return slot;
+}
@@ -0,0 +1,49 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stdint.h>
+
+// A hierarchical timer wheel, for the watchdog's per-client deadlines and the responder's delayed replies.
+// Time is counted in ticks (milliseconds for the watchdog, microseconds for the responder). There are TW_LEVELS wheels of TW_SLOTS slots each:
+// a slot of the first wheel holds the timers of a single tick, a slot of the second wheel those of 64 ticks, and so on - 4 levels cover 2^24 ticks,
+// about 4.6 hours in milliseconds.
+// Arming and cancelling a timer is O(1): it is linked into (or out of) the slot list its expiry falls in. As time passes,
+// the slots of a higher wheel are cascaded down into the wheel below it, until the timers reach the first wheel and expire.
+// The timers of the same tick expire in the order they were armed.
+
+#define TW_BITS 6
+#define TW_SLOTS (1 << TW_BITS)
+#define TW_LEVELS 4
+#define TW_MAX_TICKS ((1ull << (TW_BITS * TW_LEVELS)) - 1)     // the furthest a timer can be armed - later expiries are clamped to it
+
+struct tw_timer
+{
+    struct tw_timer *next;        // the other timers in the same slot
+    struct tw_timer *prev;
+    uint64_t expires;             // the tick the timer expires at
+    void (*expire)(struct tw_timer *timer, void *data);    // called when the timer expires
+    void *data;                   // handed to 'expire'
+    int armed;                    // whether the timer is linked into the wheel
+    int level;                    // the wheel and slot the timer is linked into, so it can be unlinked in O(1)
+    int slot;
+};
+
+struct timer_wheel
+{
+    uint64_t now;                             // the next tick to process
+    uint64_t count;                           // how many timers are armed
+    uint64_t occupied[TW_LEVELS];             // one bit per slot that holds timers
+    struct tw_timer *slots[TW_LEVELS][TW_SLOTS];      // the first timer of every slot...
+    struct tw_timer *tails[TW_LEVELS][TW_SLOTS];      // ...and the last one
+};
+
+// # Function Headers #
+
+void twInit(struct timer_wheel *w, uint64_t now);
+void twTimerInit(struct tw_timer *t, void (*expire)(struct tw_timer *timer, void *data), void *data);
+void twArm(struct timer_wheel *w, struct tw_timer *t, uint64_t expires);
+void twCancel(struct timer_wheel *w, struct tw_timer *t);
+void twAdvance(struct timer_wheel *w, uint64_t now);
+int64_t twNextExpiry(const struct timer_wheel *w);
+
+#endif
@@ -0,0 +1,220 @@
+#include <errno.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>             // must come before linux/errqueue.h, which needs struct timespec
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
+#include "tstamp.h"
+
+#ifndef SCM_TIMESTAMPING
+#define SCM_TIMESTAMPING SO_TIMESTAMPING
+#endif
+
+#ifndef SCM_TIMESTAMPNS
+#define SCM_TIMESTAMPNS SO_TIMESTAMPNS
+#endif
+
+
+// # The Functions #
+
+//// monotonicNs() - returns CLOCK_MONOTONIC in nanoseconds.
+
+uint64_t monotonicNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+//// realtimeNs() - returns CLOCK_REALTIME in nanoseconds, the clock the kernel stamps packets with.
+
+uint64_t realtimeNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+//// enableTimestamps() - asks the kernel to timestamp the packets of a socket, and returns which timestamps we will get.
+//// We first try SO_TIMESTAMPING with software RX and TX timestamps. Each TX timestamp is looped back on the socket's
+//// error queue tagged with a counter of the packets sent (OPT_ID), and without a copy of the packet (OPT_TSONLY).
+//// If that is not supported, SO_TIMESTAMPNS still gives us RX timestamps.
+
+int enableTimestamps(int sock)
+{
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE
+              | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+
+    if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0)
+    {
+        return TSTAMP_RXTX;
+    }
+
+    int on = 1;
+
+    if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == 0)
+    {
+        return TSTAMP_RX;
+    }
+
+    return TSTAMP_NONE;
+}
+
+
+//// stampNow() - stamps a packet we are about to send. The kernel's TX timestamp, if any, is filled in later by recvTxStamp().
+
+void stampNow(struct tstamp *stamp)
+{
+    stamp->kernel = 0;
+    stamp->mono = monotonicNs();
+}
+
+
+//// recvStamped() - works like recvfrom(), and also hands back when the datagram arrived.
+//// The kernel's RX timestamp is read from the control messages recvmsg() gives us.
+
+ssize_t recvStamped(int sock, char *buf, size_t len, struct sockaddr_in *from, struct tstamp *stamp)
+{
+    char control[256];
+    struct iovec iov = { buf, len };
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = from;
+    msg.msg_namelen = sizeof(*from);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t rec = recvmsg(sock, &msg, 0);
+
+    if (rec == -1)
+    {
+        return -1;
+    }
+
+    stampNow(stamp);
+    readRxStamp(&msg, stamp);
+
+    return rec;
+}
+
+
+//// readRxStamp() - fills in the kernel's RX timestamp of a received message, if recvmsg() handed us one.
+
+void readRxStamp(struct msghdr *msg, struct tstamp *stamp)
+{
+    stamp->kernel = 0;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET)
+        {
+            continue;
+        }
+
+        // SO_TIMESTAMPING hands us three timestamps - the first one is the software timestamp.
+
+        if (cmsg->cmsg_type == SCM_TIMESTAMPING || cmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+
+            if (ts.tv_sec != 0 || ts.tv_nsec != 0)
+            {
+                stamp->kernel = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+            }
+        }
+    }
+}
+
+
+//// recvTxStamp() - reads one TX timestamp from the socket's error queue.
+//// 'key' is the counter of the packet it belongs to: the first packet sent on the socket has key 0, the next 1 and so on.
+//// Returns 1 if we got a timestamp, 0 if the error queue is empty and -1 on error.
+
+int recvTxStamp(int sock, uint32_t *key, uint64_t *stamp)
+{
+    char control[256];
+    struct msghdr msg;
+
+    while (1)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+        {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+
+        // Anything else on the error queue (an ICMP error about one of our packets) is not a timestamp - skip it.
+
+        if (readTxStamp(&msg, key, stamp) == 1)
+        {
+            return 1;
+        }
+    }
+}
+
+
+//// readTxStamp() - finds the TX timestamp and its key in a message read from the error queue.
+//// Returns 1 if the message was a timestamp, 0 if it was something else.
+
+int readTxStamp(struct msghdr *msg, uint32_t *key, uint64_t *stamp)
+{
+    uint64_t ns = 0;
+    int found = 0;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING)
+        {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+        }
+        else if (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+        {
+            struct sock_extended_err err;
+            memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+
+            if (err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING)
+            {
+                *key = err.ee_data;
+                found = 1;
+            }
+        }
+    }
+
+    if (!found || ns == 0)
+    {
+        return 0;
+    }
+
+    *stamp = ns;
+
+    return 1;
+}
+
+
+//// stampDiff() - returns the time in nanoseconds from 'tx' to 'rx'.
+//// When the kernel stamped both ends we use its timestamps, otherwise we fall back to the monotonic clock.
+
+int64_t stampDiff(const struct tstamp *tx, const struct tstamp *rx)
+{
+    if (tx->kernel != 0 && rx->kernel != 0)
+    {
+        return (int64_t)(rx->kernel - tx->kernel);
+    }
+
+    return (int64_t)(rx->mono - tx->mono);
+}
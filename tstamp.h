@@ -0,0 +1,37 @@
+#ifndef TSTAMP_H
+#define TSTAMP_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+// Timestamps for measuring round trip times.
+// Where the kernel supports it, the time a packet left (TX) and arrived (RX) is taken by the kernel itself
+// through SO_TIMESTAMPING, so the RTT reflects the wire and not how soon our process got scheduled.
+// Every timestamp also carries a CLOCK_MONOTONIC reading taken in userspace, which is used when a kernel timestamp is missing.
+// All times are stored as integer nanoseconds.
+
+#define TSTAMP_NONE 0       // no kernel timestamps, only the userspace clock
+#define TSTAMP_RX 1         // kernel receive timestamps only (SO_TIMESTAMPNS)
+#define TSTAMP_RXTX 2       // kernel receive and transmit timestamps (SO_TIMESTAMPING)
+
+struct tstamp
+{
+    uint64_t kernel;        // the kernel's timestamp (CLOCK_REALTIME, nanoseconds), or 0 if there is none
+    uint64_t mono;          // CLOCK_MONOTONIC in nanoseconds, read in userspace
+};
+
+// # Function Headers #
+
+uint64_t monotonicNs(void);
+uint64_t realtimeNs(void);
+int enableTimestamps(int sock);
+void stampNow(struct tstamp *stamp);
+ssize_t recvStamped(int sock, char *buf, size_t len, struct sockaddr_in *from, struct tstamp *stamp);
+void readRxStamp(struct msghdr *msg, struct tstamp *stamp);
+int recvTxStamp(int sock, uint32_t *key, uint64_t *stamp);
+int readTxStamp(struct msghdr *msg, uint32_t *key, uint64_t *stamp);
+int64_t stampDiff(const struct tstamp *tx, const struct tstamp *rx);
+
+#endif
@@ -0,0 +1,357 @@
+#define _GNU_SOURCE    // syscall()
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+
+// # The Functions #
+
+//// uringInit() - creates a ring of 'entries' submission and 'cqEntries' completion slots (both powers of two), and maps its queues.
+//// Returns 0 on success, or -1 with errno set if the kernel has no io_uring (or it is disabled).
+
+int uringInit(struct uring *u, uint32_t entries, uint32_t cqEntries)
+{
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+
+    // Only this thread submits, and it reaps the completions itself - so the kernel needn't interrupt it to run their task work.
+    // Older kernels don't know these flags, so we try again without them.
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = cqEntries;
+
+    u->fd = syscall(__NR_io_uring_setup, entries, &params);
+
+    if (u->fd == -1 && errno == EINVAL)
+    {
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = cqEntries;
+
+        u->fd = syscall(__NR_io_uring_setup, entries, &params);
+    }
+
+    if (u->fd == -1)
+    {
+        return -1;
+    }
+
+    u->features = params.features;
+    u->sqEntries = params.sq_entries;
+
+    // We now map the two rings and the submission entries. Newer kernels map both rings with one call.
+
+    u->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    u->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (u->features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (u->cqRingSize > u->sqRingSize)
+        {
+            u->sqRingSize = u->cqRingSize;
+        }
+
+        u->cqRingSize = u->sqRingSize;
+    }
+
+    u->sqRing = mmap(NULL, u->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+
+    if (u->sqRing == MAP_FAILED)
+    {
+        u->sqRing = NULL;
+        uringFree(u);
+        return -1;
+    }
+
+    if (u->features & IORING_FEAT_SINGLE_MMAP)
+    {
+        u->cqRing = u->sqRing;
+    }
+    else
+    {
+        u->cqRing = mmap(NULL, u->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+
+        if (u->cqRing == MAP_FAILED)
+        {
+            u->cqRing = NULL;
+            uringFree(u);
+            return -1;
+        }
+    }
+
+    u->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+
+    if (u->sqes == MAP_FAILED)
+    {
+        u->sqes = NULL;
+        uringFree(u);
+        return -1;
+    }
+
+    char *sq = u->sqRing;
+    char *cq = u->cqRing;
+
+    u->sqHead = (_Atomic uint32_t *)(sq + params.sq_off.head);
+    u->sqTail = (_Atomic uint32_t *)(sq + params.sq_off.tail);
+    u->sqArray = (uint32_t *)(sq + params.sq_off.array);
+    u->sqMask = *(uint32_t *)(sq + params.sq_off.ring_mask);
+    u->sqLocalTail = atomic_load_explicit(u->sqTail, memory_order_relaxed);
+
+    u->cqHead = (_Atomic uint32_t *)(cq + params.cq_off.head);
+    u->cqTail = (_Atomic uint32_t *)(cq + params.cq_off.tail);
+    u->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    u->cqMask = *(uint32_t *)(cq + params.cq_off.ring_mask);
+
+    // Submission entry i always sits at SQ ring position i, so the ring's indirection array is filled in once.
+
+    for (uint32_t i = 0; i < u->sqEntries; i++)
+    {
+        u->sqArray[i] = i;
+    }
+
+    return 0;
+}
+
+
+//// uringFree() - unmaps the queues and closes the ring. Requests still in flight are cancelled by the kernel.
+
+void uringFree(struct uring *u)
+{
+    if (u->sqes != NULL)
+    {
+        munmap(u->sqes, u->sqesSize);
+    }
+
+    if (u->cqRing != NULL && u->cqRing != u->sqRing)
+    {
+        munmap(u->cqRing, u->cqRingSize);
+    }
+
+    if (u->sqRing != NULL)
+    {
+        munmap(u->sqRing, u->sqRingSize);
+    }
+
+    if (u->fd != -1)
+    {
+        close(u->fd);
+    }
+
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+}
+
+
+//// uringSqSpace() - returns how many submission entries can be filled in before the queue is full.
+
+uint32_t uringSqSpace(struct uring *u)
+{
+    return u->sqEntries - (u->sqLocalTail - atomic_load_explicit(u->sqHead, memory_order_acquire));
+}
+
+
+//// uringGetSqe() - returns a cleared submission entry to fill in, or NULL if the queue is full (submit with uringEnter() and try again).
+
+struct io_uring_sqe *uringGetSqe(struct uring *u)
+{
+    uint32_t head = atomic_load_explicit(u->sqHead, memory_order_acquire);
+
+    if (u->sqLocalTail - head >= u->sqEntries)
+    {
+        return NULL;
+    }
+
+    struct io_uring_sqe *sqe = &u->sqes[u->sqLocalTail & u->sqMask];
+    u->sqLocalTail++;
+
+    memset(sqe, 0, sizeof(*sqe));
+
+    return sqe;
+}
+
+
+//// uringEnter() - submits every entry filled in since the last call, and waits until at least 'waitFor' completions are ready
+//// or 'timeout_ns' passed (0 - no limit). With 'waitFor' 0, it only submits. Returns 0 on success (a timeout included), -1 with errno set on error.
+
+int uringEnter(struct uring *u, uint32_t waitFor, uint64_t timeout_ns)
+{
+    uint32_t tail = atomic_load_explicit(u->sqTail, memory_order_relaxed);
+    uint32_t toSubmit = u->sqLocalTail - tail;
+
+    // The entries are published with a release store of the tail, so the kernel sees them filled in.
+
+    atomic_store_explicit(u->sqTail, u->sqLocalTail, memory_order_release);
+
+    if (toSubmit == 0 && waitFor == 0)
+    {
+        return 0;
+    }
+
+    unsigned flags = waitFor > 0 ? IORING_ENTER_GETEVENTS : 0;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    void *argp = NULL;
+    size_t argSize = 0;
+
+    // The timeout goes with the call itself, so waiting for a completion or a deadline (whichever comes first) takes one system call.
+
+    if (waitFor > 0 && timeout_ns > 0 && (u->features & IORING_FEAT_EXT_ARG))
+    {
+        ts.tv_sec = timeout_ns / 1000000000ull;
+        ts.tv_nsec = timeout_ns % 1000000000ull;
+
+        memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+
+        flags |= IORING_ENTER_EXT_ARG;
+        argp = &arg;
+        argSize = sizeof(arg);
+    }
+
+    u->enterCalls++;
+
+    if (syscall(__NR_io_uring_enter, u->fd, toSubmit, waitFor, flags, argp, argSize) == -1)
+    {
+        // Running out of time, or a signal, before a completion arrived is not an error - the caller looks at the clock anyway.
+
+        if (errno == ETIME || errno == EINTR)
+        {
+            return 0;
+        }
+
+        return -1;
+    }
+
+    return 0;
+}
+
+
+//// uringPeekCqe() - returns the oldest completion we haven't seen yet, or NULL if there is none. No system call is made.
+
+struct io_uring_cqe *uringPeekCqe(struct uring *u)
+{
+    uint32_t head = atomic_load_explicit(u->cqHead, memory_order_relaxed);
+
+    if (head == atomic_load_explicit(u->cqTail, memory_order_acquire))
+    {
+        return NULL;
+    }
+
+    return &u->cqes[head & u->cqMask];
+}
+
+
+//// uringCqeSeen() - hands the completion returned by uringPeekCqe() back to the kernel, once we are done reading it.
+
+void uringCqeSeen(struct uring *u)
+{
+    uint32_t head = atomic_load_explicit(u->cqHead, memory_order_relaxed);
+
+    atomic_store_explicit(u->cqHead, head + 1, memory_order_release);
+}
+
+
+//// uringRegisterBuffers() - registers a region of memory as fixed buffer 0, so reads and writes from it skip pinning its pages on every request.
+//// Returns 0 on success, -1 with errno set on error (e.g. over the memlock limit).
+
+int uringRegisterBuffers(struct uring *u, void *base, size_t len)
+{
+    struct iovec iov = { base, len };
+
+    return syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS, &iov, 1) == -1 ? -1 : 0;
+}
+
+
+//// uringBufRingInit() - maps an empty ring of 'entries' provided buffers (a power of two) and registers it as buffer group 'group'.
+//// Returns 0 on success, -1 with errno set on error (kernels before 5.19 have no buffer rings).
+
+int uringBufRingInit(struct uring *u, struct uring_bufring *br, uint16_t group, uint16_t entries)
+{
+    memset(br, 0, sizeof(*br));
+
+    br->size = entries * sizeof(struct io_uring_buf);
+    br->entries = entries;
+    br->group = group;
+
+    // The ring must start on a page, so it gets a mapping of its own.
+
+    void *ring = mmap(NULL, br->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (ring == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring;
+    reg.ring_entries = entries;
+    reg.bgid = group;
+
+    if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+    {
+        int saved = errno;
+        munmap(ring, br->size);
+        errno = saved;
+        return -1;
+    }
+
+    br->ring = ring;
+
+    return 0;
+}
+
+
+//// uringBufRingAdd() - adds a buffer to the ring. The kernel only sees it after uringBufRingPublish().
+
+void uringBufRingAdd(struct uring_bufring *br, void *addr, uint32_t len, uint16_t bid)
+{
+    struct io_uring_buf *buf = &br->ring->bufs[br->tail & (br->entries - 1)];
+
+    buf->addr = (uint64_t)(uintptr_t)addr;
+    buf->len = len;
+    buf->bid = bid;
+    br->tail++;
+}
+
+
+//// uringBufRingPublish() - makes the buffers added since the last call available to the kernel.
+
+void uringBufRingPublish(struct uring_bufring *br)
+{
+    atomic_store_explicit((_Atomic uint16_t *)&br->ring->tail, br->tail, memory_order_release);
+}
+
+
+//// uringBufRingFree() - unregisters the ring and unmaps it.
+
+void uringBufRingFree(struct uring *u, struct uring_bufring *br)
+{
+    if (br->ring == NULL)
+    {
+        return;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = br->group;
+
+    if (u->fd != -1)
+    {
+        syscall(__NR_io_uring_register, u->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    }
+
+    munmap(br->ring, br->size);
+    memset(br, 0, sizeof(*br));
+}
@@ -0,0 +1,67 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A minimal io_uring, driven through the raw system calls (no liburing).
+// Requests are written into the submission queue (SQ) in shared memory, and their results are read from the completion queue (CQ),
+// also in shared memory - so a single io_uring_enter() call submits every request queued since the last one and waits for results,
+// and reading the results costs no system call at all.
+//
+// The ring is used from one thread only. The kernel is the other side of both queues: we own the SQ tail and the CQ head,
+// it owns the SQ head and the CQ tail, and each side publishes its own index with a release store after the entries it covers.
+
+struct uring
+{
+    int fd;                         // the ring's file descriptor
+    void *sqRing;                   // the mapped SQ ring (and CQ ring, when the kernel maps both at once)
+    void *cqRing;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    struct io_uring_sqe *sqes;      // the submission entries
+    size_t sqesSize;
+    _Atomic uint32_t *sqHead;       // written by the kernel
+    _Atomic uint32_t *sqTail;       // written by us
+    uint32_t *sqArray;              // the SQ ring proper: indexes into 'sqes'
+    uint32_t sqMask;
+    uint32_t sqEntries;
+    uint32_t sqLocalTail;           // the entries we filled in, published at the next uringEnter()
+    _Atomic uint32_t *cqHead;       // written by us
+    _Atomic uint32_t *cqTail;       // written by the kernel
+    struct io_uring_cqe *cqes;
+    uint32_t cqMask;
+    uint32_t features;              // the IORING_FEAT_* flags of the kernel
+    uint64_t enterCalls;            // how many io_uring_enter() calls we made
+};
+
+// A ring of provided buffers: the kernel picks a free one for every packet a multishot receive delivers,
+// and tells us which in the completion. We hand buffers back by adding them to the ring again.
+
+struct uring_bufring
+{
+    struct io_uring_buf_ring *ring;     // the ring, shared with the kernel
+    size_t size;                        // the size of its mapping
+    uint16_t entries;                   // a power of two
+    uint16_t group;                     // the buffer group id requests pick buffers from
+    uint16_t tail;                      // the buffers we added, published by uringBufRingPublish()
+};
+
+// # Function Headers #
+
+int uringInit(struct uring *u, uint32_t entries, uint32_t cqEntries);
+void uringFree(struct uring *u);
+uint32_t uringSqSpace(struct uring *u);
+struct io_uring_sqe *uringGetSqe(struct uring *u);
+int uringEnter(struct uring *u, uint32_t waitFor, uint64_t timeout_ns);
+struct io_uring_cqe *uringPeekCqe(struct uring *u);
+void uringCqeSeen(struct uring *u);
+int uringRegisterBuffers(struct uring *u, void *base, size_t len);
+int uringBufRingInit(struct uring *u, struct uring_bufring *br, uint16_t group, uint16_t entries);
+void uringBufRingAdd(struct uring_bufring *br, void *addr, uint32_t len, uint16_t bid);
+void uringBufRingPublish(struct uring_bufring *br);
+void uringBufRingFree(struct uring *u, struct uring_bufring *br);
+
+#endif
@@ -0,0 +1,560 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "buf_pool.h"
+#include "tstamp.h"
+#include "uring.h"
+#include "uring_ping.h"
+
+#define URING_ENTRIES 1024           // submission queue entries - two per probe, so this many over two probes can be sent per io_uring_enter()
+#define URING_CQ_ENTRIES 8192        // completion queue entries - the replies and deadlines of many rounds may pile up between two calls
+#define URING_SEND_SLOTS 1024        // echo requests that may be in the middle of being written at once
+#define URING_RECV_BUFS 1024         // provided buffers for the replies (a power of two)
+#define URING_CONTROL 128            // bytes of control messages (the RX timestamp) per reply
+#define URING_TX_READS 64            // error queue reads kept in flight, for the TX timestamps - each one takes one, and they share the receive buffer with the replies
+#define URING_TX_KEYS 65536          // sends whose TX timestamp key we remember (a power of two)
+#define URING_BUF_GROUP 0
+
+// Every request carries what it is in the top byte of its user data, and which probe (or buffer) it is about below that.
+
+#define KIND_SEND 1ull               // the write of a probe: its send slot (bits 32-55) and its sequence number (bits 0-31)
+#define KIND_DEADLINE 2ull           // the deadline of a probe: its sequence number
+#define KIND_RECV 3ull               // the multishot receive of the replies
+#define KIND_TXSTAMP 4ull            // an error queue read: its index in 'txMsgs'
+
+#define USER_DATA(kind, high, low) ((kind) << 56 | (uint64_t)(high) << 32 | (uint32_t)(low))
+
+// The TX timestamps are keyed by the order the kernel sent the packets in. A write that failed isn't counted by the kernel,
+// so we remember which probe every successful write was - the key of a timestamp is checked, so a stale entry is never used.
+
+struct tx_key
+{
+    uint32_t key;                    // the kernel's counter of the send
+    uint32_t seq;                    // the probe it sent
+};
+
+struct uring_engine
+{
+    struct uring ring;
+    struct buf_pool sends;           // one slab per echo request being written, in an arena registered with the ring
+    int fixed;                       // whether the arena is registered (otherwise plain writes are used)
+    struct buf_pool recvs;           // the buffers the replies are received into
+    struct uring_bufring bufring;    // the ring the kernel picks the reply buffers from
+    struct msghdr recvMsg;           // the layout of every reply buffer: the name and control lengths
+    int recvArmed;                   // whether the multishot receive is in flight
+    struct msghdr txMsgs[URING_TX_READS];
+    char txControl[URING_TX_READS][256];
+    struct tx_key txKeys[URING_TX_KEYS];
+    uint32_t txSent;                 // the successful writes so far - the key of the next TX timestamp
+    struct __kernel_timespec deadline;   // the timeout of every probe
+    uint32_t writing;                // writes in flight
+};
+
+// # Function Headers #
+
+static int engineInit(struct uring_ping *up, struct uring_engine *e);
+static void engineFree(struct uring_engine *e);
+static int armRecv(struct uring_engine *e, int sock);
+static int armTxRead(struct uring_engine *e, int sock, int i);
+static int queueProbe(struct uring_ping *up, struct uring_engine *e, uint32_t seq);
+static int reap(struct uring_ping *up, struct uring_engine *e);
+static void onReply(struct uring_ping *up, struct uring_engine *e, char *buf, uint32_t len);
+
+
+// # The Functions #
+
+//// uringPing() - pings a single destination through io_uring, until 'count' probes were answered or lost or we are asked to stop.
+//// Returns 0 when it is done, or -1 (with a message printed) if io_uring can't be set up or the socket fails.
+
+int uringPing(struct uring_ping *up)
+{
+    // The writes carry no destination, so the socket is connected to it. A raw socket then also gets only the packets coming from there.
+
+    if (connect(up->sock, (struct sockaddr *)&up->address, sizeof(up->address)) == -1)
+    {
+        printf("Connecting the socket to the destination failed with error: %d\n", errno);
+        return -1;
+    }
+
+    struct uring_engine *e = calloc(1, sizeof(struct uring_engine));
+
+    if (e == NULL || engineInit(up, e) == -1)
+    {
+        free(e);
+        return -1;
+    }
+
+    uint32_t seq = 0;
+    int held = 0;           // whether a due probe couldn't be queued (no free send slot, or the in-flight FIFO is full)
+    uint64_t nextSend = monotonicNs();
+    uint64_t nextSummary = nextSend + up->period_ns;
+    int status = 0;
+
+    while (!statsStopRequested())
+    {
+        // First the completions: replies, deadlines that passed, finished writes and TX timestamps. Reading them costs no system call.
+
+        if (reap(up, e) == -1)
+        {
+            status = -1;
+            break;
+        }
+
+        // Probes that were answered (or lost) are dropped from the front of the in-flight FIFO, so they don't hold room in it.
+        // Their deadlines are kept by the kernel, so nothing expires here.
+
+        struct in_addr none;
+        uint32_t noSeq;
+        inflightExpire(up->inflight, 0, &none, &noSeq);
+
+        uint64_t now = monotonicNs();
+
+        if (up->count > 0 && seq >= up->count && inflightCount(up->inflight) == 0 && e->writing == 0)
+        {
+            break;
+        }
+
+        // Queue every probe that is due, as long as there is room in the window, a free send slot and room in the submission queue.
+
+        held = 0;
+
+        while (nextSend <= now && (up->count == 0 || seq < up->count) && inflightCount(up->inflight) < (uint64_t)up->window)
+        {
+            int queued = queueProbe(up, e, seq);
+
+            if (queued == -1)
+            {
+                status = -1;
+                break;
+            }
+
+            if (queued == 0)
+            {
+                held = 1;
+                break;
+            }
+
+            seq++;
+            nextSend += up->interval_ns;
+        }
+
+        if (status == -1)
+        {
+            break;
+        }
+
+        if (up->period_ns > 0 && now >= nextSummary)
+        {
+            statsPrint(up->st, up->ip);
+            nextSummary += up->period_ns;
+        }
+
+        // Submit what we queued and sleep until a completion arrives or the next probe (or summary) is due - all in one system call.
+
+        uint64_t wake = now + up->timeout_ns;
+
+        if (up->count > 0 && seq >= up->count)
+        {
+            // Nothing more to send, we are only waiting for the last replies and deadlines.
+        }
+        else if (inflightCount(up->inflight) < (uint64_t)up->window && !held)
+        {
+            wake = nextSend;
+        }
+        else if (nextSend < now)
+        {
+            nextSend = now;     // A full window held the next probe back - don't make up for it with a burst once a slot frees.
+        }
+
+        if (up->period_ns > 0 && nextSummary < wake)
+        {
+            wake = nextSummary;
+        }
+
+        now = monotonicNs();
+
+        if (uringEnter(&e->ring, wake > now ? 1 : 0, wake > now ? wake - now : 0) == -1)
+        {
+            printf("Error : io_uring_enter() failed with error: %d\n", errno);
+            status = -1;
+            break;
+        }
+    }
+
+    up->enterCalls = e->ring.enterCalls;
+    engineFree(e);
+    free(e);
+
+    return status;
+}
+
+
+//// engineInit() - sets up the ring, the send slots (registered with it) and the reply buffers, and arms the receives.
+//// Returns 0 on success, or -1 with a message printed.
+
+static int engineInit(struct uring_ping *up, struct uring_engine *e)
+{
+    if (uringInit(&e->ring, URING_ENTRIES, URING_CQ_ENTRIES) == -1)
+    {
+        printf("Setting up io_uring failed with error: %d (the kernel may have it disabled, see kernel.io_uring_disabled).\n", errno);
+        return -1;
+    }
+
+    // Every send slot starts as a copy of the template, and from then on a probe only patches its fields into one.
+
+    if (poolInit(&e->sends, URING_SEND_SLOTS, up->tmpl->len) == -1
+        || poolInit(&e->recvs, URING_RECV_BUFS, sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + URING_CONTROL + up->tmpl->len + IP4_MAXHDRLEN) == -1)
+    {
+        printf("Out of memory.\n");
+        engineFree(e);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < URING_SEND_SLOTS; i++)
+    {
+        copyTemplate(up->tmpl, poolSlab(&e->sends, i));
+    }
+
+    // With the arena registered, the kernel pins its pages once, instead of on every write. Without it (e.g. over the memlock limit) we still work.
+
+    e->fixed = uringRegisterBuffers(&e->ring, e->sends.arena, e->sends.arenaSize) == 0;
+
+    if (!e->fixed)
+    {
+        printf("Registering the send buffers failed with error: %d, using plain writes.\n", errno);
+    }
+
+    // The reply buffers all go into the provided-buffer ring up front; each is added back once its reply was read.
+
+    if (uringBufRingInit(&e->ring, &e->bufring, URING_BUF_GROUP, URING_RECV_BUFS) == -1)
+    {
+        printf("Setting up the io_uring buffer ring failed with error: %d (it needs Linux 5.19 or later).\n", errno);
+        engineFree(e);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < URING_RECV_BUFS; i++)
+    {
+        uringBufRingAdd(&e->bufring, poolSlab(&e->recvs, i), e->recvs.slab, i);
+    }
+
+    uringBufRingPublish(&e->bufring);
+
+    e->recvMsg.msg_namelen = sizeof(struct sockaddr_in);
+    e->recvMsg.msg_controllen = URING_CONTROL;
+
+    e->deadline.tv_sec = up->timeout_ns / 1000000000ull;
+    e->deadline.tv_nsec = up->timeout_ns % 1000000000ull;
+
+    if (armRecv(e, up->sock) == -1)
+    {
+        engineFree(e);
+        return -1;
+    }
+
+    for (int i = 0; up->stamping == TSTAMP_RXTX && i < URING_TX_READS; i++)
+    {
+        armTxRead(e, up->sock, i);
+    }
+
+    return 0;
+}
+
+
+//// engineFree() - closes the ring (which cancels every request still in flight) and frees the buffers.
+
+static void engineFree(struct uring_engine *e)
+{
+    uringBufRingFree(&e->ring, &e->bufring);
+    uringFree(&e->ring);
+    poolFree(&e->sends);
+    poolFree(&e->recvs);
+}
+
+
+//// armRecv() - queues the multishot receive: one request that completes once for every reply, each in a buffer the kernel picks from the ring.
+//// Returns 0 on success, -1 if the submission queue is full.
+
+static int armRecv(struct uring_engine *e, int sock)
+{
+    struct io_uring_sqe *sqe = uringGetSqe(&e->ring);
+
+    if (sqe == NULL)
+    {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = sock;
+    sqe->addr = (uint64_t)(uintptr_t)&e->recvMsg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = USER_DATA(KIND_RECV, 0, 0);
+
+    e->recvArmed = 1;
+
+    return 0;
+}
+
+
+//// armTxRead() - queues a read of one message from the socket's error queue into the i-th TX message. It completes once a TX timestamp is there.
+//// Returns 0 on success, -1 if the submission queue is full.
+
+static int armTxRead(struct uring_engine *e, int sock, int i)
+{
+    struct io_uring_sqe *sqe = uringGetSqe(&e->ring);
+
+    if (sqe == NULL)
+    {
+        return -1;
+    }
+
+    memset(&e->txMsgs[i], 0, sizeof(e->txMsgs[i]));
+    e->txMsgs[i].msg_control = e->txControl[i];
+    e->txMsgs[i].msg_controllen = sizeof(e->txControl[i]);
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = sock;
+    sqe->addr = (uint64_t)(uintptr_t)&e->txMsgs[i];
+    sqe->len = 1;
+    sqe->msg_flags = MSG_ERRQUEUE;
+    sqe->user_data = USER_DATA(KIND_TXSTAMP, 0, i);
+
+    return 0;
+}
+
+
+//// queueProbe() - queues the next probe: the write of the echo request, and its deadline linked behind it, so the clock starts once it was sent.
+//// Returns 1 if it was queued, 0 if there is no room for it right now (no free send slot or submission entries), and -1 on error.
+
+static int queueProbe(struct uring_ping *up, struct uring_engine *e, uint32_t seq)
+{
+    if (uringSqSpace(&e->ring) < 2)
+    {
+        return 0;
+    }
+
+    char *pac = poolGet(&e->sends);
+
+    if (pac == NULL)
+    {
+        return 0;
+    }
+
+    struct tstamp sent;
+    stampNow(&sent);
+    patchPacket(up->tmpl, pac, up->ident, seq, sent.mono);
+
+    // The probe is in the table before it is submitted, since its reply may be delivered in the same io_uring_enter() call.
+
+    if (inflightInsert(up->inflight, up->address.sin_addr, up->ident, seq, sent.mono) == -1)
+    {
+        poolPut(&e->sends, pac);
+        return 0;
+    }
+
+    uint32_t slot = (uint32_t)((pac - e->sends.arena) / e->sends.slab);
+
+    struct io_uring_sqe *sqe = uringGetSqe(&e->ring);
+    sqe->opcode = e->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->fd = up->sock;
+    sqe->addr = (uint64_t)(uintptr_t)pac;
+    sqe->len = up->tmpl->len;
+    sqe->buf_index = 0;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = USER_DATA(KIND_SEND, slot, seq);
+
+    sqe = uringGetSqe(&e->ring);
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (uint64_t)(uintptr_t)&e->deadline;
+    sqe->len = 1;
+    sqe->user_data = USER_DATA(KIND_DEADLINE, 0, seq);
+
+    e->writing++;
+
+    return 1;
+}
+
+
+//// reap() - handles every completion that is ready. Returns 0 on success, -1 (with a message printed) if the socket failed.
+
+static int reap(struct uring_ping *up, struct uring_engine *e)
+{
+    struct io_uring_cqe *cqe;
+    int returned = 0;       // reply buffers handed back to the ring
+
+    while ((cqe = uringPeekCqe(&e->ring)) != NULL)
+    {
+        uint64_t kind = cqe->user_data >> 56;
+        uint32_t low = (uint32_t)cqe->user_data;
+        uint32_t high = (uint32_t)(cqe->user_data >> 32) & 0xffffff;
+        int res = cqe->res;
+        uint32_t flags = cqe->flags;
+
+        uringCqeSeen(&e->ring);
+
+        if (kind == KIND_SEND)
+        {
+            e->writing--;
+            poolPut(&e->sends, poolSlab(&e->sends, high));
+
+            if (res < 0)
+            {
+                // The probe never left (its deadline gets cancelled along with it). A full send buffer only costs this probe.
+
+                struct tstamp unsent;
+                inflightTake(up->inflight, up->address.sin_addr, up->ident, low, &unsent);
+
+                if (res != -EAGAIN && res != -ENOBUFS)
+                {
+                    printf("Sending packet failed with error: %d\n", -res);
+                    return -1;
+                }
+
+                continue;
+            }
+
+            e->txKeys[e->txSent & (URING_TX_KEYS - 1)].key = e->txSent;
+            e->txKeys[e->txSent & (URING_TX_KEYS - 1)].seq = low;
+            e->txSent++;
+
+            statsSent(up->st);
+        }
+        else if (kind == KIND_DEADLINE)
+        {
+            // The deadline passed. If the probe is still in flight, it is lost; if it was answered meanwhile, there is nothing to do.
+
+            struct tstamp lost;
+
+            if (res == -ETIME && inflightTake(up->inflight, up->address.sin_addr, up->ident, low, &lost) == 1)
+            {
+                printf("-- Request timeout for seq = %u.\n", low);
+                statsLost(up->st);
+            }
+        }
+        else if (kind == KIND_RECV)
+        {
+            if (flags & IORING_CQE_F_BUFFER)
+            {
+                uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+                char *buf = poolSlab(&e->recvs, bid);
+
+                if (res > 0)
+                {
+                    onReply(up, e, buf, res);
+                }
+
+                uringBufRingAdd(&e->bufring, buf, e->recvs.slab, bid);
+                returned++;
+            }
+            else if (res < 0 && res != -ENOBUFS)
+            {
+                printf("Receiving packet failed with error: %d\n", -res);
+                return -1;
+            }
+
+            // The receive stops when it ran out of buffers (or the kernel ended it for another reason) - we arm it again.
+
+            if (!(flags & IORING_CQE_F_MORE))
+            {
+                e->recvArmed = 0;
+            }
+        }
+        else if (kind == KIND_TXSTAMP)
+        {
+            uint32_t key = 0;
+            uint64_t txStamp = 0;
+
+            if (res >= 0 && readTxStamp(&e->txMsgs[low], &key, &txStamp) == 1)
+            {
+                struct tx_key *k = &e->txKeys[key & (URING_TX_KEYS - 1)];
+
+                if (k->key == key && key < e->txSent)
+                {
+                    inflightSetKernel(up->inflight, up->address.sin_addr, k->seq, txStamp);
+                }
+            }
+
+            armTxRead(e, up->sock, low);
+        }
+    }
+
+    if (returned > 0)
+    {
+        uringBufRingPublish(&e->bufring);
+    }
+
+    if (!e->recvArmed)
+    {
+        armRecv(e, up->sock);
+    }
+
+    return 0;
+}
+
+
+//// onReply() - matches a reply the multishot receive delivered to its probe. The buffer holds the receive's header,
+//// the source address, the control messages (the RX timestamp) and the packet, in that order.
+
+static void onReply(struct uring_ping *up, struct uring_engine *e, char *buf, uint32_t len)
+{
+    struct tstamp end;
+    stampNow(&end);
+
+    struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buf;
+    size_t offset = sizeof(*out) + e->recvMsg.msg_namelen + e->recvMsg.msg_controllen;
+
+    if (len < offset)
+    {
+        return;
+    }
+
+    struct sockaddr_in from;
+    memcpy(&from, buf + sizeof(*out), sizeof(from));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = buf + sizeof(*out) + e->recvMsg.msg_namelen;
+    msg.msg_controllen = out->controllen;
+    readRxStamp(&msg, &end);
+
+    char *pac = buf + offset;
+    ssize_t recv = len - offset;
+    struct icmp *reply = NULL;
+    int icmplen = -1;
+
+    if (from.sin_addr.s_addr != up->address.sin_addr.s_addr || (icmplen = parseReply(pac, recv, up->ipHeader, up->ident, NULL, &reply)) == -1)
+    {
+        return;
+    }
+
+    uint32_t replySeq = 0;
+    uint64_t sentNs = 0;
+
+    if (parsePayload(up->tmpl, reply, icmplen, &replySeq, &sentNs) == -1)
+    {
+        printf("-- Corrupted reply from %s : seq = %d, bytes = %ld.\n", up->ip, ntohs(reply->icmp_seq), recv);
+        statsCorrupted(up->st);
+        return;
+    }
+
+    struct tstamp sent;
+
+    if (inflightTake(up->inflight, from.sin_addr, up->ident, replySeq, &sent) == 0)
+    {
+        return;
+    }
+
+    struct tstamp start = { sent.kernel, sentNs };
+    int64_t rtt = stampDiff(&start, &end);
+    statsReply(up->st, rtt);
+
+    printf("-- Reply from %s : seq = %u, bytes = %ld, time = %.3f ms.\n", up->ip, replySeq, recv, rtt / 1e6);
+}
@@ -0,0 +1,41 @@
+#ifndef URING_PING_H
+#define URING_PING_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+
+#include "icmp_util.h"
+#include "inflight.h"
+#include "stats.h"
+
+// The io_uring engine of ping.c's single-destination mode (-E uring), an alternative to its ppoll() loop for the same job.
+// Every probe is two linked requests: a write of the echo request from a registered buffer, and a timeout that starts once
+// the write completes - the probe's deadline, kept by the kernel. One multishot recvmsg() delivers every reply into buffers
+// the kernel picks from a provided-buffer ring, with its RX timestamp, and the TX timestamps are read off the error queue
+// through the ring as well. So a single io_uring_enter() call sends every probe that is due and waits for what comes next,
+// however many probes per second that is.
+
+struct uring_ping
+{
+    int sock;                         // the ICMP socket (raw or ping), non-blocking
+    struct sockaddr_in address;       // the destination - the socket gets connected to it
+    const char *ip;                   // the destination, as it is printed
+    int ident;                        // the ICMP id of our probes
+    int ipHeader;                     // whether the replies come with their IP header (raw socket)
+    int stamping;                     // the timestamps the socket gives us (TSTAMP_*)
+    struct packet_template *tmpl;     // the echo request every probe is patched from
+    struct inflight_table *inflight;  // the probes in flight
+    struct stats *st;                 // the statistics of the replies
+    uint64_t interval_ns;             // the interval between two probes
+    uint64_t timeout_ns;              // the time before an unanswered probe counts as lost
+    uint64_t period_ns;               // the interval between two statistics summaries (0 - only at the end)
+    long count;                       // how many probes to send (0 - until Ctrl+C)
+    int window;                       // how many probes may be in flight at once
+    uint64_t enterCalls;              // out: how many io_uring_enter() calls the run made
+};
+
+// # Function Headers #
+
+int uringPing(struct uring_ping *up);
+
+#endif
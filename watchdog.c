@@ -1,19 +1,113 @@
+#define _GNU_SOURCE    // struct ucred
+
 #include <stdio.h>
 #include <errno.h>
-#include <netinet/in.h>
-#include <netinet/tcp.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
-#include <math.h>
-#include <signal.h>
-#include <sys/time.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "timerwheel.h"
+#include "wdproto.h"
+
+#define default_timeout_ms 10000    // the timeout if a pinger doesn't ask for another one
+#define hello_timeout_ms 5000       // how long a new client has to send its HELLO
+#define max_events 64               // events handled per epoll_wait()
+#define kill_grace_ms 1000          // how long a timed out pinger has to exit on its own, before SIGTERM - and then before SIGKILL
+
+// The watchdog supervises pingers: each one tells it (HELLO) how long it may go without a reply, and stores the time of every reply
+// in a memory region it shares with the watchdog. When a pinger's timeout runs out, the watchdog pushes a TIMEOUT message to it.
+// A healthy pinger exits on its own then. One that is wedged (and never reads the message) gets SIGTERM, and then SIGKILL.
+//
+// It runs in one of two ways:
+//     ./watchdog <channel_fd>      started by better_ping, with one end of a socketpair - it watches that single pinger, and exits with it.
+//     ./watchdog -l <socket_path>  a server for the whole host, listening on a unix socket - any number of pingers connect to it (better_ping -w).
+//                                  It runs until SIGINT or SIGTERM, and removes its socket file on the way out.
+//
+// Either way, a single thread waits in epoll_wait() on every client at once. The deadlines of all the clients live in one timer wheel
+// (see timerwheel.c), so arming and cancelling a deadline is O(1), and the epoll timeout is simply the time until the wheel's next expiry.
+
+// Where a client is in its life: watched, or timed out and on its way out.
+
+enum client_phase
+{
+    CLIENT_WATCHED = 0,               // its deadline moves with every reply
+    CLIENT_TIMED_OUT,                 // TIMEOUT was sent - it has a grace period to exit
+    CLIENT_TERMINATED                 // SIGTERM was sent - it has one more grace period, then SIGKILL
+};
 
-#define server_port 3000
-#define buffer_size 128
+// What an epoll event points at: the listening socket, or a client's socket or pidfd.
+
+enum endpoint_kind
+{
+    EP_LISTENER = 0,
+    EP_SOCKET,
+    EP_PIDFD
+};
+
+struct endpoint
+{
+    int kind;                         // one of the endpoint_kind values
+    struct client *client;            // the client the descriptor belongs to (NULL for the listener)
+};
+
+struct client
+{
+    int sock;                         // the connection to the pinger
+    int pidfd;                        // becomes readable when the pinger exits (-1 if the kernel has no pidfds)
+    pid_t pid;                        // the pinger's pid, from the socket's peer credentials
+    struct wd_shared *shared;         // the heartbeat region, once HELLO brought it
+    struct wd_reader reader;          // the bytes received so far, until they form whole messages
+    uint64_t timeout;                 // the pinger's timeout, in milliseconds
+    struct tw_timer timer;            // the pinger's deadline (or, before HELLO, the deadline for HELLO itself, and after a timeout, the next signal)
+    int phase;                        // one of the client_phase values
+    struct endpoint sockEp;           // what the epoll events of 'sock' and 'pidfd' point at
+    struct endpoint pidEp;
+    int closing;                      // the client was dropped - its memory is freed once the current events are handled
+    struct client *next;              // all the live clients (or, once dropped, the ones waiting to be freed)
+    struct client *prev;
+};
+
+struct server
+{
+    int epfd;
+    int listener;                     // the listening socket (-1 in the private mode)
+    struct endpoint listenEp;
+    int private;                      // whether we watch the single pinger that started us, and exit with it
+    struct timer_wheel wheel;         // the deadlines of all the clients, in milliseconds of CLOCK_MONOTONIC
+    struct client *clients;           // the live clients
+    struct client *closed;            // the dropped clients, to be freed
+    int count;                        // how many clients are live
+};
+
+static volatile sig_atomic_t stop = 0;
+
+// # Function Headers #
+
+static uint64_t nowMs(void);
+static void onStopSignal(int sig);
+static int openListener(const char *path);
+static struct client *addClient(struct server *srv, int sock);
+static void dropClient(struct server *srv, struct client *c);
+static void freeClosed(struct server *srv);
+static void acceptClients(struct server *srv);
+static void readClient(struct server *srv, struct client *c);
+static void onDeadline(struct tw_timer *timer, void *data);
+static int signalClient(struct client *c, int sig);
+
+static struct server *server;         // the server the timer callbacks work on
+
+
+// # The Functions #
 
 int main(int argnum, char *argt[])
 {
@@ -21,197 +115,516 @@ int main(int argnum, char *argt[])
 
     signal(SIGPIPE, SIG_IGN); // Helps preventing crashing when closing the socket later on.
 
-    int temp = 0;             // Setting a temporary variable to help check for errors throughout the program.
+    struct server srv;
+    memset(&srv, 0, sizeof(srv));
+    srv.listener = -1;
+    server = &srv;
+
+    const char *path = NULL;
+
+    if (argnum == 3 && strcmp(argt[1], "-l") == 0)
+    {
+        path = argt[2];
+    }
+    else if (argnum == 2)
+    {
+        srv.private = 1;
+    }
+    else
+    {
+        printf("Correct usage: ./watchdog -l <socket_path> (or started by better_ping)\n");
+        return -1;
+    }
+
+    srv.epfd = epoll_create1(EPOLL_CLOEXEC);
 
-    int listenSock = -1;
-    listenSock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP); // Setting the listening socket
-    if (listenSock == -1)
+    if (srv.epfd == -1)
     {
-        printf("Error : Listen socket creation failed.\n"); // if the creation of the socket failed,
-        return 0;                                           // print the error and exit main.
+        printf("Error : epoll_create1() failed with error: %d\n", errno);
+        return -1;
     }
 
-    int reuse = 1;                                                                   
-    temp = setsockopt(listenSock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(int));     // uses a previously chosen socketopt if there is one.
-    if (temp < 0)
+    twInit(&srv.wheel, nowMs());
+
+    if (srv.private)
     {
-        printf("Error : Failed to set sock options.\n");      // If the socket's reuse failed,
-        return 0;                                                                     // print the error and exit main.
+        // better_ping's end of the socketpair is our only client. Once it is gone, so are we.
+
+        if (addClient(&srv, atoi(argt[1])) == NULL)
+        {
+            return -1;
+        }
     }
+    else
+    {
+        srv.listener = openListener(path);
 
-    struct sockaddr_in server_address;                  // Using the imported struct of a socket address using the IPv4 module.
-    memset(&server_address, 0, sizeof(server_address)); // Resetting it to default values.
+        if (srv.listener == -1)
+        {
+            return -1;
+        }
 
-    server_address.sin_family = AF_INET;                // Server address is type IPv4.
-    server_address.sin_addr.s_addr = INADDR_ANY;        // Get any address that tries to connect.
-    server_address.sin_port = htons(server_port);       // Set the server port to the defined 'server_port'.
+        srv.listenEp.kind = EP_LISTENER;
 
-    temp = bind(listenSock, (struct sockaddr *)&server_address, sizeof(server_address)); // Bind the socket to a port and IP.
-    if (temp == -1)
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &srv.listenEp;
+        epoll_ctl(srv.epfd, EPOLL_CTL_ADD, srv.listener, &ev);
+
+        // We stop on SIGINT and SIGTERM, without SA_RESTART, so they interrupt epoll_wait() and we get to clean up.
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = onStopSignal;
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+
+        printf("Watchdog listening on %s\n", path);
+    }
+
+    struct epoll_event events[max_events];
+
+    while (!stop && (!srv.private || srv.count > 0))
+    {
+        // We sleep until some client speaks or leaves, or until the wheel's next deadline.
+
+        int wait = -1;
+        int64_t next = twNextExpiry(&srv.wheel);
+
+        if (next != -1)
+        {
+            uint64_t now = nowMs();
+            wait = (uint64_t)next > now ? (int)((uint64_t)next - now) : 0;
+        }
+
+        int n = epoll_wait(srv.epfd, events, max_events, wait);
+
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            printf("Error : epoll_wait() failed with error: %d\n", errno);
+            break;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            struct endpoint *ep = events[i].data.ptr;
+
+            if (ep->kind == EP_LISTENER)
+            {
+                acceptClients(&srv);
+            }
+            else if (ep->client->closing)
+            {
+                continue;                           // dropped by an earlier event of this round
+            }
+            else if (ep->kind == EP_PIDFD)
+            {
+                dropClient(&srv, ep->client);       // the pinger exited without saying BYE
+            }
+            else
+            {
+                readClient(&srv, ep->client);
+            }
+        }
+
+        // Every deadline due by now fires (see onDeadline()).
+
+        twAdvance(&srv.wheel, nowMs());
+
+        freeClosed(&srv);
+    }
+
+    while (srv.clients != NULL)
+    {
+        dropClient(&srv, srv.clients);
+    }
+
+    freeClosed(&srv);
+
+    if (srv.listener != -1)
+    {
+        close(srv.listener);
+        unlink(path);
+    }
+
+    close(srv.epfd);
+
+    return 0;
+}
+
+
+//// nowMs() - returns CLOCK_MONOTONIC in milliseconds - the ticks of the timer wheel. The pingers stamp their replies with the same clock.
+
+static uint64_t nowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+
+//// onStopSignal() - asks the server loop to stop.
+
+static void onStopSignal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+
+//// openListener() - creates the unix socket the pingers connect to, at 'path'. A stale socket file left by a previous server is replaced.
+//// Returns the listening socket, or -1 on failure.
+
+static int openListener(const char *path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
     {
-        printf("Error: Binding failed.\n");             // If the binding failed,
-        close(listenSock);                              // print the corresponding error, close the socket and exit main.
+        printf("Error : The socket path is too long.\n");
         return -1;
     }
 
-    temp = listen(listenSock, 3);                       // Start listening, and set the max queue for awaiting client to 3.
-    if (temp == -1)
+    strcpy(addr.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (sock == -1)
     {
-        printf("Error: Listening failed.");             // If listen failed,
-        close(listenSock);                              // print the corresponding error, close the socket and exit main.
+        printf("Error : socket() failed with error: %d\n", errno);
         return -1;
     }
 
-    // Accept and incoming connection
-    struct sockaddr_in client_address;                  // Using the imported struct of a socket address using the IPv4 module.
-    socklen_t client_add_len = sizeof(client_address);  // Setting the size of the address to match what's needed.
-        
-    memset(&client_address, 0, sizeof(client_address));                                       // Resetting address struct to default values.
-    client_add_len = sizeof(client_address);                                                  // Setting the size of the address to match what's needed.
-    int clientSock = accept(listenSock, (struct sockaddr *)&client_address, &client_add_len); // Accepting the clients request to connect.
+    unlink(path);
 
-    char buffer[buffer_size] = {0};        // Setting the buffer size to the defined 'buffer_size'.
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        printf("Error : bind() failed with error: %d\n", errno);
+        close(sock);
+        return -1;
+    }
 
-    // We create a timer which will be used to time out the program if the destination takes too long to respond.
+    if (listen(sock, SOMAXCONN) == -1)
+    {
+        printf("Error : listen() failed with error: %d\n", errno);
+        close(sock);
+        unlink(path);
+        return -1;
+    }
+
+    return sock;
+}
+
+
+//// addClient() - starts watching the pinger on the other end of 'sock': registers the socket (and a pidfd of the pinger) with epoll,
+//// and gives it a while to send its HELLO. Returns the new client, or NULL on failure (the socket is closed).
+
+static struct client *addClient(struct server *srv, int sock)
+{
+    struct client *c = calloc(1, sizeof(struct client));
+
+    if (c == NULL)
+    {
+        printf("Error : Out of memory, dropping a client.\n");
+        close(sock);
+        return NULL;
+    }
 
-    float time = 0;                  // A float that will be used to store the interval.
-    struct timeval start, end;       // A struct of type timeval, which will be used to measure the start and end time.
+    c->sock = sock;
+    c->pidfd = -1;
+    c->timeout = default_timeout_ms;
+    c->sockEp.kind = EP_SOCKET;
+    c->sockEp.client = c;
+    c->pidEp.kind = EP_PIDFD;
+    c->pidEp.client = c;
+    wdReaderInit(&c->reader);
+    twTimerInit(&c->timer, onDeadline, c);
 
-    while(1)
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = &c->sockEp;
+
+    if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, sock, &ev) == -1)
     {
-        
-        memset(buffer, 0, 128);
+        printf("Error : epoll_ctl() failed with error: %d\n", errno);
+        close(sock);
+        free(c);
+        return NULL;
+    }
 
-        int recvResult = recv(clientSock, buffer, 6, 0);   // Receiving the better_ping request.
+    // A pidfd becomes readable when the pinger exits - we notice at once, even if its socket lingers in a child it forked.
+    // Without one (an older kernel, or no peer credentials), a closed socket tells us the same.
 
-        if (recvResult < 0) 
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.pid > 0)
+    {
+        c->pid = cred.pid;
+        c->pidfd = syscall(SYS_pidfd_open, cred.pid, 0);
+    }
+
+    if (c->pidfd != -1)
+    {
+        ev.events = EPOLLIN;
+        ev.data.ptr = &c->pidEp;
+        epoll_ctl(srv->epfd, EPOLL_CTL_ADD, c->pidfd, &ev);
+    }
+
+    twArm(&srv->wheel, &c->timer, nowMs() + hello_timeout_ms);
+
+    c->next = srv->clients;
+    if (c->next != NULL)
+    {
+        c->next->prev = c;
+    }
+    srv->clients = c;
+    srv->count++;
+
+    return c;
+}
+
+
+//// dropClient() - stops watching a client: cancels its deadline and closes its descriptors.
+//// Its memory is only freed by freeClosed(), since events of this round may still point at it.
+
+static void dropClient(struct server *srv, struct client *c)
+{
+    twCancel(&srv->wheel, &c->timer);
+
+    if (c->pidfd != -1)
+    {
+        close(c->pidfd);                           // closing a descriptor also removes it from epoll
+    }
+
+    close(c->sock);
+    wdReaderFree(&c->reader);
+
+    if (c->shared != NULL)
+    {
+        wdSharedUnmap(c->shared);
+    }
+
+    if (c->prev != NULL)
+    {
+        c->prev->next = c->next;
+    }
+    else
+    {
+        srv->clients = c->next;
+    }
+
+    if (c->next != NULL)
+    {
+        c->next->prev = c->prev;
+    }
+
+    srv->count--;
+
+    c->closing = 1;
+    c->prev = NULL;
+    c->next = srv->closed;
+    srv->closed = c;
+}
+
+
+//// freeClosed() - frees the clients dropped during the last round of events.
+
+static void freeClosed(struct server *srv)
+{
+    while (srv->closed != NULL)
+    {
+        struct client *c = srv->closed;
+        srv->closed = c->next;
+        free(c);
+    }
+}
+
+
+//// acceptClients() - accepts every pending connection on the listening socket.
+
+static void acceptClients(struct server *srv)
+{
+    while (1)
+    {
+        int sock = accept4(srv->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (sock == -1)
         {
-            printf("Error : Receiving failed.\n");         // If receiving failed, print an error and exit main.
-            return -1;
-        }         
-        else if (recvResult == 0) 
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+            {
+                printf("Error : accept() failed with error: %d\n", errno);
+            }
+
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+
+            return;
+        }
+
+        addClient(srv, sock);
+    }
+}
+
+
+//// readClient() - reads what a pinger sent, and handles every whole message: HELLO starts its deadline, BYE (or anything else) ends it.
+
+static void readClient(struct server *srv, struct client *c)
+{
+    int temp = wdRead(c->sock, &c->reader);
+
+    if (temp == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+        return;
+    }
+    else if (temp < 0 && errno == ECONNRESET)
+    {
+        dropClient(srv, c);                         // the pinger died with our TIMEOUT still unread
+        return;
+    }
+    else if (temp < 0)
+    {
+        printf("Error : Receiving from pinger %d failed.\n", (int)c->pid);
+        dropClient(srv, c);
+        return;
+    }
+    else if (temp == 0)
+    {
+        dropClient(srv, c);                         // the pinger is closed, there is nothing left to watch
+        return;
+    }
+
+    // The read may hold part of a message, or several of them - we handle every whole message we have.
+
+    struct wd_msg msg;
+
+    while ((temp = wdNext(&c->reader, &msg)) == 1)
+    {
+        if (msg.type == WD_HELLO && c->shared == NULL && msg.fd != -1)
         {
-            printf("Error : better_ping is closed, nothing to receive.\n");   // If receiving failed, print an error and exit main.
-            return -1;
+            // The pinger tells us its timeout, and hands us its heartbeat region. The first deadline is the timeout after the time
+            // it stored there before saying HELLO.
+
+            c->shared = wdSharedMap(msg.fd);
+            close(msg.fd);                          // the mapping stays valid without the descriptor
+
+            if (c->shared == NULL)
+            {
+                printf("Error : Mapping the heartbeat region of pinger %d failed with error: %d\n", (int)c->pid, errno);
+                dropClient(srv, c);
+                return;
+            }
+
+            c->timeout = msg.arg > 0 ? msg.arg : default_timeout_ms;
+
+            uint64_t lastReply = atomic_load_explicit(&c->shared->lastReply, memory_order_acquire);
+            twArm(&srv->wheel, &c->timer, lastReply / 1000000 + c->timeout);
+            continue;
         }
-        else if (recvResult != 6)
+
+        if (msg.fd != -1)
         {
-            printf("Error: Watchdog received a corrupted buffer.\n");
-            return -1;
+            close(msg.fd);
         }
 
-        else if (strcmp(buffer, "start") != 0)
+        if (msg.type != WD_BYE)
         {
-            printf("Error: Invalid request made.\n");
+            printf("watchdog received an invalid message from pinger %d, closing its socket.\n", (int)c->pid);
         }
-        
-        else
+
+        dropClient(srv, c);
+        return;
+    }
+
+    if (temp == -1)
+    {
+        printf("Error: watchdog received a corrupted message (wrong magic or protocol version) from pinger %d.\n", (int)c->pid);
+        dropClient(srv, c);
+    }
+}
+
+
+//// onDeadline() - a client's timer fired. Nothing polls us in between: the wheel alone decides when we look at a client.
+//// While the client is watched, we only now look at its last reply: if one came meanwhile, the deadline moved, and the timer is armed again.
+//// Otherwise time is up - we tell the pinger, and give it a grace period to exit. A pinger that is wedged doesn't read the message,
+//// so when the grace period ends it gets SIGTERM, and after another one SIGKILL. A client that didn't even say HELLO in time is just dropped.
+
+static void onDeadline(struct tw_timer *timer, void *data)
+{
+    struct client *c = data;
+    (void)timer;
+
+    if (c->shared == NULL)
+    {
+        printf("Pinger %d didn't say HELLO in time, closing its socket.\n", (int)c->pid);
+        dropClient(server, c);
+        return;
+    }
+
+    if (c->phase == CLIENT_WATCHED)
+    {
+        uint64_t lastReply = atomic_load_explicit(&c->shared->lastReply, memory_order_acquire) / 1000000;
+
+        if (lastReply + c->timeout > nowMs())
         {
-            memset(buffer, 0, 5);
-
-            gettimeofday(&start, NULL);
-
-            // We now create a loop which will run until the destination responds, or until the timer reaches 10 seconds.
-
-            while(1)
-            { 
-                gettimeofday(&end, NULL);
-
-                time = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
-
-                temp = recv(clientSock, buffer, 10, 0);       // Receiving the client's request to continue.
-                // check errors on recv()
-                if (temp < 0) 
-                {
-                    printf("Error : Receiving failed.\n");    // If receiving failed, print an error and exit main.
-                    close(clientSock);
-                    close(listenSock);
-                    return -1;
-                }
-                else if (temp == 0) 
-                {
-                    printf("Error : better_ping is closed, nothing to receive.\n");   // If receiving failed, print an error and exit main.
-                    close(clientSock);
-                    close(listenSock);
-                    return -1;
-                }
-                else if (temp != 10)
-                {
-                    printf("Error: watchdog received a corrupted buffer.\n");
-                    close(clientSock);
-                    close(listenSock);
-                    return -1;
-                }
-                
-                // better_ping got a reply. reset timeout clock
-                else if ( strcmp(buffer, "got reply") == 0 )
-                {
-                    memset(buffer, 0, 10);
-                    break;
-                }
-                // better_ping didn't dot respond yet. answer him if to continue or to stop if time is up
-                else if ( strcmp(buffer, "continue?") == 0)
-                {
-                    memset(buffer,0,10);
-                
-                    // time is up. send no to watchdog inorder to stop program
-                    if( time >= 10 )
-                    {
-                        strcpy(buffer, "no!");
-                    }
-                    // there is more time - send yes to watchdog inorder to continue 
-                    else
-                    {
-                        strcpy(buffer, "yes");
-                    }
-                
-                    temp = send(clientSock, buffer, strlen(buffer) + 1, 0); // send the answer
-                    
-                    // check errors on send()
-                    if (temp < 0) 
-                    {
-                        printf("Error : Sending failed.\n");    // If receiving failed, print an error and exit main.
-                        close(clientSock);
-                        close(listenSock);
-                        return -1;
-                    } 
-                    else if (temp == 0) 
-                    {
-                        printf("Error : better_ping is closed, nowhere to send to.\n");   // If receiving failed, print an error and exit main.
-                        close(clientSock);
-                        close(listenSock);
-                        return -1;
-                    }
-                    else if (temp != 4)
-                    {
-                        printf("Error: client received a corrupted buffer.\n");
-                        close(clientSock);
-                        close(listenSock);
-                        return -1;
-                    } 
-                    
-                    // time is up. close sockets and stop the program 
-                    else if ( strcmp(buffer, "no!") == 0 )
-                    { 
-                        close(clientSock);
-                        close(listenSock);
-                        return -1;
-                    }
-
-                }
-
-                else 
-                {
-                    printf("watchdog received an invalid request, closing socket.\n");
-                    close(clientSock);
-                    close(listenSock);
-                    return -1;
-                }
-            }
+            twArm(&server->wheel, &c->timer, lastReply + c->timeout);
+            return;
         }
+
+        // The send never blocks: the socket is non-blocking, and a wedged pinger's full buffer just loses the message - the signals follow anyway.
+
+        wdSend(c->sock, WD_TIMEOUT, atomic_load_explicit(&c->shared->seq, memory_order_relaxed), c->timeout);
+
+        c->phase = CLIENT_TIMED_OUT;
+        twArm(&server->wheel, &c->timer, nowMs() + kill_grace_ms);
+        return;
     }
 
-    close(listenSock);
-    close(clientSock);
-    return 0;
-}    
+    // The pinger is still around after its grace period (once it exits, its pidfd or socket drops it before this).
+
+    if (c->phase == CLIENT_TIMED_OUT && signalClient(c, SIGTERM) == 0)
+    {
+        printf("Pinger %d didn't exit after its timeout, sending SIGTERM.\n", (int)c->pid);
+        c->phase = CLIENT_TERMINATED;
+        twArm(&server->wheel, &c->timer, nowMs() + kill_grace_ms);
+        return;
+    }
+
+    if (c->phase == CLIENT_TERMINATED && signalClient(c, SIGKILL) == 0)
+    {
+        printf("Pinger %d didn't exit after SIGTERM, sending SIGKILL.\n", (int)c->pid);
+    }
+
+    dropClient(server, c);
+}
+
+
+//// signalClient() - sends a signal to a client's pinger - through its pidfd, so a recycled pid never gets it by mistake.
+//// Without a pidfd, we fall back to kill() on the pid from the peer credentials. Returns 0 on success, -1 on failure.
+
+static int signalClient(struct client *c, int sig)
+{
+    if (c->pidfd != -1)
+    {
+        return syscall(SYS_pidfd_send_signal, c->pidfd, sig, NULL, 0) == -1 ? -1 : 0;
+    }
+
+    if (c->pid > 0)
+    {
+        return kill(c->pid, sig);
+    }
+
+    return -1;
+}
@@ -0,0 +1,229 @@
+#define _GNU_SOURCE    // memfd_create(), MSG_CMSG_CLOEXEC
+
+#include <arpa/inet.h>
+#include <endian.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "wdproto.h"
+
+
+// # The Functions #
+
+//// wdSend() - sends one message, in full. Returns 0 on success, -1 if the other side is gone or the send failed.
+
+int wdSend(int sock, uint8_t type, uint32_t seq, uint64_t arg)
+{
+    return wdSendFd(sock, type, seq, arg, -1);
+}
+
+
+//// wdSendFd() - sends one message, in full, with a descriptor attached to it (unless 'fd' is -1).
+//// Returns 0 on success, -1 if the other side is gone or the send failed.
+
+int wdSendFd(int sock, uint8_t type, uint32_t seq, uint64_t arg, int fd)
+{
+    unsigned char msg[WD_MSG_LEN];
+    uint32_t seqBe = htonl(seq);
+    uint64_t argBe = htobe64(arg);
+
+    msg[0] = WD_MAGIC;
+    msg[1] = WD_VERSION;
+    msg[2] = type;
+    msg[3] = 0;
+    memcpy(msg + 4, &seqBe, 4);
+    memcpy(msg + 8, &argBe, 8);
+
+    // A stream socket may take a message in pieces, so we keep sending until all of it is out.
+    // The descriptor goes along with the first piece.
+
+    int sent = 0;
+
+    while (sent < WD_MSG_LEN)
+    {
+        struct iovec iov = { msg + sent, WD_MSG_LEN - sent };
+        char control[CMSG_SPACE(sizeof(int))];
+        struct msghdr hdr;
+
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+
+        if (fd != -1 && sent == 0)
+        {
+            memset(control, 0, sizeof(control));
+            hdr.msg_control = control;
+            hdr.msg_controllen = sizeof(control);
+
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+        }
+
+        ssize_t n = sendmsg(sock, &hdr, MSG_NOSIGNAL);
+
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (n <= 0)
+        {
+            return -1;
+        }
+
+        sent += n;
+    }
+
+    return 0;
+}
+
+
+//// wdReaderInit() - empties a reader.
+
+void wdReaderInit(struct wd_reader *r)
+{
+    r->len = 0;
+    r->fd = -1;
+}
+
+
+//// wdReaderFree() - closes a descriptor the reader received, if no message took it.
+
+void wdReaderFree(struct wd_reader *r)
+{
+    if (r->fd != -1)
+    {
+        close(r->fd);
+        r->fd = -1;
+    }
+}
+
+
+//// wdRead() - reads whatever the socket has for us (without blocking) into the reader, along with a descriptor if one was sent.
+//// Returns the number of bytes read, 0 if the other side closed the connection, or -1 on error (errno is EAGAIN if there was nothing to read).
+
+int wdRead(int sock, struct wd_reader *r)
+{
+    struct iovec iov = { r->buf + r->len, sizeof(r->buf) - r->len };
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+
+    ssize_t n = recvmsg(sock, &hdr, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+
+    if (n <= 0)
+    {
+        return n;
+    }
+
+    r->len += n;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len >= CMSG_LEN(sizeof(int)))
+        {
+            wdReaderFree(r);                   // only the latest descriptor is kept
+            memcpy(&r->fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+
+    return n;
+}
+
+
+//// wdNext() - takes the next whole message out of the reader.
+//// Returns 1 if a message was taken, 0 if the reader doesn't hold a whole message yet,
+//// or -1 if the stream is broken (a wrong magic byte or version) - there is no way to find the next message after that.
+
+int wdNext(struct wd_reader *r, struct wd_msg *m)
+{
+    if (r->len < WD_MSG_LEN)
+    {
+        return 0;
+    }
+
+    if (r->buf[0] != WD_MAGIC || r->buf[1] != WD_VERSION)
+    {
+        return -1;
+    }
+
+    uint32_t seqBe;
+    uint64_t argBe;
+
+    memcpy(&seqBe, r->buf + 4, 4);
+    memcpy(&argBe, r->buf + 8, 8);
+
+    m->type = r->buf[2];
+    m->seq = ntohl(seqBe);
+    m->arg = be64toh(argBe);
+    m->fd = r->fd;                          // the descriptor goes with the first message after it arrived - the caller owns it now
+    r->fd = -1;
+
+    r->len -= WD_MSG_LEN;
+    memmove(r->buf, r->buf + WD_MSG_LEN, r->len);
+
+    return 1;
+}
+
+
+//// wdSharedCreate() - creates the shared region in an anonymous memory file, and maps it.
+//// The file descriptor is what the watchdog gets (with HELLO) to map the same region.
+//// Returns the descriptor, or -1 on error.
+
+int wdSharedCreate(struct wd_shared **shared)
+{
+    int fd = memfd_create("watchdog", MFD_CLOEXEC);
+
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    if (ftruncate(fd, sizeof(struct wd_shared)) == -1 || (*shared = wdSharedMap(fd)) == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+//// wdSharedMap() - maps the shared region of a memory file. Returns NULL on error.
+
+struct wd_shared *wdSharedMap(int fd)
+{
+    void *region = mmap(NULL, sizeof(struct wd_shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    return region == MAP_FAILED ? NULL : region;
+}
+
+
+//// wdSharedUnmap() - unmaps the shared region.
+
+void wdSharedUnmap(struct wd_shared *shared)
+{
+    munmap(shared, sizeof(struct wd_shared));
+}
+
+
+//// wdHeartbeat() - records that the reply to probe 'seq' arrived at 'now'. This is the whole cost of a heartbeat: two stores, no syscall.
+//// The time is stored last, with release ordering, so a watchdog that sees the new time also sees the new sequence number.
+
+void wdHeartbeat(struct wd_shared *shared, uint32_t seq, uint64_t now)
+{
+    atomic_store_explicit(&shared->seq, seq, memory_order_relaxed);
+    atomic_store_explicit(&shared->lastReply, now, memory_order_release);
+}
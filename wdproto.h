@@ -0,0 +1,72 @@
+#ifndef WDPROTO_H
+#define WDPROTO_H
+
+#include <stdint.h>
+
+// The protocol between better_ping and the watchdog.
+// Every message has the same fixed size and layout, so the stream is cut into messages by counting bytes -
+// a message split over several reads, or several messages coalesced into one read, are put back together by wdNext().
+//
+//     byte 0       WD_MAGIC
+//     byte 1       WD_VERSION
+//     byte 2       the message type (WD_HELLO, ...)
+//     byte 3       reserved, 0
+//     bytes 4-7    the sequence number of the probe the message is about (network byte order)
+//     bytes 8-15   an argument, depending on the type (network byte order)
+//
+// The messages travel either over a socketpair created by better_ping before it starts its own watchdog, or over a connection
+// to a shared watchdog server listening on a unix socket - there is no port to collide on. They are only exchanged at the edges:
+// HELLO when the pinger starts, BYE when it exits, and TIMEOUT, pushed by the watchdog when the deadline passes.
+// HELLO carries the descriptor of the shared region (SCM_RIGHTS), so the watchdog can map it.
+//
+// The heartbeat itself doesn't go through the socket at all. The pinger shares a small memory region with the watchdog (struct wd_shared),
+// and every reply is one atomic store of its arrival time there. The watchdog owns the deadline (the timeout after the last reply):
+// it sleeps until the deadline, and only then looks at the shared time - if a reply came meanwhile, it just sleeps again.
+
+#define WD_MAGIC 0xd0
+#define WD_VERSION 2
+#define WD_MSG_LEN 16
+
+#define WD_HELLO 1          // pinger -> watchdog: we are starting, 'arg' is the timeout in milliseconds, the shared region comes along
+#define WD_BYE 3            // pinger -> watchdog: we are exiting, stop watching
+#define WD_TIMEOUT 4        // watchdog -> pinger: no reply came in time, 'seq' is the last probe that was answered
+
+struct wd_msg
+{
+    uint8_t type;           // one of the WD_* types
+    uint32_t seq;           // the sequence number of the probe
+    uint64_t arg;           // the argument of the message
+    int fd;                 // a descriptor that came along with the message, or -1
+};
+
+// The region the pinger and the watchdog share. Only the pinger writes it.
+
+struct wd_shared
+{
+    _Atomic uint64_t lastReply;     // when the last reply arrived (CLOCK_MONOTONIC nanoseconds) - set to the start time by the pinger before HELLO
+    _Atomic uint32_t seq;           // the sequence number of the last probe that was answered
+};
+
+// The bytes received so far that don't form a whole message yet.
+
+struct wd_reader
+{
+    unsigned char buf[WD_MSG_LEN * 16];
+    int len;
+    int fd;                 // a descriptor received with the bytes, until the message it came with is taken (-1 if none)
+};
+
+// # Function Headers #
+
+int wdSend(int sock, uint8_t type, uint32_t seq, uint64_t arg);
+int wdSendFd(int sock, uint8_t type, uint32_t seq, uint64_t arg, int fd);
+void wdReaderInit(struct wd_reader *r);
+void wdReaderFree(struct wd_reader *r);
+int wdRead(int sock, struct wd_reader *r);
+int wdNext(struct wd_reader *r, struct wd_msg *m);
+int wdSharedCreate(struct wd_shared **shared);
+struct wd_shared *wdSharedMap(int fd);
+void wdSharedUnmap(struct wd_shared *shared);
+void wdHeartbeat(struct wd_shared *shared, uint32_t seq, uint64_t now);
+
+#endif